@@ -0,0 +1,865 @@
+// order statistic B+tree with the semantics of skiplist.c
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "btree.h"
+#include "slindex.h"
+#include "slsearch.h"
+
+#define BTREE_LEAFMIN (BTREE_LEAFCAP / 2)
+#define BTREE_INNERMIN (BTREE_INNERCAP / 2)
+/* leaves built from sorted input keep room for a few inserts */
+#define BTREE_LEAFFILL (BTREE_LEAFCAP - BTREE_LEAFCAP / 8)
+#define BTREE_SHRINK_MIN 16
+
+/* A node that split on insert: the new right sibling, its lower bound and
+ * the number of elements below it */
+typedef struct btSplit {
+    void *right;
+    uint64_t key;
+    int64_t obj;
+    unsigned long count;
+} btSplit;
+
+/* The element a delete looks for: key/obj, or with byrank the element at
+ * 1-based rank within the subtree. key/obj get the removed element. */
+typedef struct btTarget {
+    int byrank;
+    unsigned long rank;
+    uint64_t key;
+    int64_t obj;
+} btTarget;
+
+/* NULL when the pool cannot grow, callers that may not fail reserve the
+ * nodes first */
+static btLeaf *btNewLeaf(btree *bt) {
+    btLeaf *l = slPoolAlloc(&bt->leaves, 1);
+    if (l == NULL)
+        return NULL;
+    l->prev = l->next = NULL;
+    l->n = 0;
+    return l;
+}
+
+static btInner *btNewInner(btree *bt) {
+    btInner *x = slPoolAlloc(&bt->inners, 1);
+    x->n = 0;
+    return x;
+}
+
+/* Make l the only, empty leaf */
+static void btReset(btree *bt, btLeaf *l) {
+    l->prev = l->next = NULL;
+    l->n = 0;
+    bt->root = bt->head = bt->tail = l;
+    bt->height = 0;
+    bt->length = 0;
+}
+
+/* allocf follows the lua_Alloc protocol, NULL falls back to realloc/free.
+ * Returns NULL if the allocator refuses. */
+btree *btCreate(slAllocFn allocf, void *ud) {
+    btree *bt;
+    btLeaf *l;
+    slAllocator alloc;
+
+    slAllocatorInit(&alloc, allocf, ud);
+    bt = slMemAlloc(&alloc, sizeof(*bt));
+    if (bt == NULL)
+        return NULL;
+    bt->alloc = alloc;
+    bt->cmp = 0; // 默认升序
+    bt->index = NULL;
+    bt->autoshrink = 0;
+    bt->maxlength = 0;
+    slPoolInit(&bt->leaves, &bt->alloc, sizeof(btLeaf), 0);
+    slPoolInit(&bt->inners, &bt->alloc, sizeof(btInner), 0);
+    l = btNewLeaf(bt);
+    if (l == NULL) {
+        slMemFree(&alloc, bt, sizeof(*bt));
+        return NULL;
+    }
+    btReset(bt, l);
+    return bt;
+}
+
+void btFree(btree *bt) {
+    slAllocator alloc;
+
+    slPoolRelease(&bt->leaves);
+    slPoolRelease(&bt->inners);
+    if (bt->index)
+        slIndexFree(bt->index);
+    alloc = bt->alloc;
+    slMemFree(&alloc, bt, sizeof(*bt));
+}
+
+/* Remove every element, keeping the options of the tree. The head leaf
+ * stays as the empty root so clearing never allocates, the slabs of the
+ * other leaves are given back by a shrink. */
+void btClear(btree *bt) {
+    btLeaf *l, *next;
+
+    for (l = bt->head->next; l; l = next) {
+        next = l->next;
+        slPoolFree(&bt->leaves, l, 1);
+    }
+    slPoolRelease(&bt->inners);
+    btReset(bt, bt->head);
+    slPoolShrink(&bt->leaves);
+    if (bt->index)
+        slIndexClear(bt->index);
+}
+
+size_t btMemory(btree *bt) {
+    return bt->alloc.used;
+}
+
+size_t btShrink(btree *bt) {
+    return slPoolShrink(&bt->leaves) + slPoolShrink(&bt->inners);
+}
+
+/* Shrink once the leaves freed since the last shrink outnumber the ones
+ * in use, like the skiplist does with nodes */
+static void btMaybeShrink(btree *bt) {
+    if (bt->autoshrink && bt->leaves.freed > BTREE_SHRINK_MIN && bt->leaves.freed * BTREE_LEAFMIN > bt->length)
+        btShrink(bt);
+}
+
+/* Make sure one more element can go in: a leaf and an inner node per
+ * level may split, and the root may grow a level. Returns 0 if the nodes
+ * or the index slot cannot be had. */
+static int btReserve(btree *bt) {
+    return slPoolReserve(&bt->leaves, 1, 1) && slPoolReserve(&bt->inners, 1, bt->height + 1) &&
+        (bt->index == NULL || slIndexReserve(bt->index, bt->index->count + 1));
+}
+
+/* Point the index at l for the elements from..to-1 of l */
+static void btIndexLeaf(btree *bt, btLeaf *l, int from, int to) {
+    if (bt->index == NULL)
+        return;
+    for (; from < to; from++)
+        slIndexSet(bt->index, l->obj[from], l);
+}
+
+/* Build the obj -> leaf index. Returns 0 if the tree already holds
+ * duplicated objs, which the index cannot represent. */
+int btEnableIndex(btree *bt) {
+    btLeaf *l;
+    int i;
+
+    if (bt->index)
+        return 1;
+    bt->index = slIndexCreate(&bt->alloc);
+    if (bt->index == NULL)
+        return SL_ENOMEM;
+    if (!slIndexReserve(bt->index, bt->length)) {
+        slIndexFree(bt->index);
+        bt->index = NULL;
+        return SL_ENOMEM;
+    }
+    for (l = bt->head; l; l = l->next) {
+        for (i = 0; i < l->n; i++) {
+            if (slIndexGet(bt->index, l->obj[i])) {
+                slIndexFree(bt->index);
+                bt->index = NULL;
+                return 0;
+            }
+            slIndexSet(bt->index, l->obj[i], l);
+        }
+    }
+    return 1;
+}
+
+/* First position of a sorted block not ordering before k/o. The vector
+ * count finds the first key not below k, objs only break runs of k. */
+static inline int btBlockLower(const uint64_t *key, const int64_t *obj, int n, uint64_t k, int64_t o) {
+    int lo = slKeyCountLess(key, n, k), hi = n;
+    if (lo == n || key[lo] != k || obj[lo] >= o)
+        return lo;
+    for (lo++; lo < hi;) {
+        int mid = (lo + hi) >> 1;
+        if (slKeyLess(key[mid], obj[mid], k, o))
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+/* First position of a sorted block ordering after k/o */
+static inline int btBlockUpper(const uint64_t *key, const int64_t *obj, int n, uint64_t k, int64_t o) {
+    int lo = slKeyCountLess(key, n, k), hi = n;
+    if (lo == n || key[lo] != k || obj[lo] > o)
+        return lo;
+    for (lo++; lo < hi;) {
+        int mid = (lo + hi) >> 1;
+        if (slKeyLess(k, o, key[mid], obj[mid]))
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+    return lo;
+}
+
+static int btLeafLower(const btLeaf *l, uint64_t k, int64_t o) {
+    return btBlockLower(l->key, l->obj, l->n, k, o);
+}
+
+static int btLeafUpper(const btLeaf *l, uint64_t k, int64_t o) {
+    return btBlockUpper(l->key, l->obj, l->n, k, o);
+}
+
+/* The child of x whose range holds k/o: the last one whose lower bound
+ * does not order after k/o, child 0 is unbounded below */
+static int btRoute(const btInner *x, uint64_t k, int64_t o) {
+    return btBlockUpper(x->key + 1, x->obj + 1, x->n - 1, k, o);
+}
+
+static inline int btNodeSize(void *node, int h) {
+    return h == 0 ? ((btLeaf *)node)->n : ((btInner *)node)->n;
+}
+
+/* Move n child entries of src starting at si to dst at di */
+static void btInnerMove(btInner *dst, int di, btInner *src, int si, int n) {
+    memmove(dst->key + di, src->key + si, n * sizeof(*dst->key));
+    memmove(dst->obj + di, src->obj + si, n * sizeof(*dst->obj));
+    memmove(dst->count + di, src->count + si, n * sizeof(*dst->count));
+    memmove(dst->child + di, src->child + si, n * sizeof(*dst->child));
+}
+
+static void btLeafMove(btLeaf *dst, int di, btLeaf *src, int si, int n) {
+    memmove(dst->key + di, src->key + si, n * sizeof(*dst->key));
+    memmove(dst->obj + di, src->obj + si, n * sizeof(*dst->obj));
+}
+
+static unsigned long btInnerSum(const btInner *x, int from, int to) {
+    unsigned long sum = 0;
+    for (; from < to; from++)
+        sum += x->count[from];
+    return sum;
+}
+
+/* Insert k/o into leaf l, splitting it in halves when full. The nodes
+ * for the splits are reserved by the caller through btReserve. */
+static void btInsertLeaf(btree *bt, btLeaf *l, uint64_t k, int64_t o, btSplit *sp, btIter *it) {
+    int pos = btLeafLower(l, k, o), half = BTREE_LEAFCAP / 2;
+    btLeaf *r = NULL;
+
+    if (l->n == BTREE_LEAFCAP) {
+        r = btNewLeaf(bt);
+        btLeafMove(r, 0, l, half, l->n - half);
+        r->n = l->n - half;
+        l->n = half;
+        r->prev = l;
+        r->next = l->next;
+        if (l->next)
+            l->next->prev = r;
+        else
+            bt->tail = r;
+        l->next = r;
+        btIndexLeaf(bt, r, 0, r->n);
+        if (pos >= half) {
+            l = r;
+            pos -= half;
+        }
+    }
+    btLeafMove(l, pos + 1, l, pos, l->n - pos);
+    l->key[pos] = k;
+    l->obj[pos] = o;
+    l->n++;
+    if (bt->index)
+        slIndexSet(bt->index, o, l);
+    it->leaf = l;
+    it->pos = pos;
+
+    sp->right = r;
+    if (r) {
+        sp->key = r->key[0];
+        sp->obj = r->obj[0];
+        sp->count = r->n;
+    }
+}
+
+/* Insert k/o below node of height h. A split of node is reported through
+ * sp for the caller to link, it gets the position of the new element. */
+static void btInsertAt(btree *bt, void *node, int h, uint64_t k, int64_t o, btSplit *sp, btIter *it) {
+    btInner *x = node, *r = NULL;
+    btSplit csp;
+    int i, half = BTREE_INNERCAP / 2;
+
+    if (h == 0) {
+        btInsertLeaf(bt, node, k, o, sp, it);
+        return;
+    }
+    i = btRoute(x, k, o);
+    btInsertAt(bt, x->child[i], h - 1, k, o, &csp, it);
+    x->count[i]++;
+    sp->right = NULL;
+    if (csp.right == NULL)
+        return;
+
+    x->count[i] -= csp.count;
+    i++;
+    if (x->n == BTREE_INNERCAP) {
+        r = btNewInner(bt);
+        btInnerMove(r, 0, x, half, x->n - half);
+        r->n = x->n - half;
+        x->n = half;
+        if (i > half) {
+            x = r;
+            i -= half;
+        }
+    }
+    btInnerMove(x, i + 1, x, i, x->n - i);
+    x->key[i] = csp.key;
+    x->obj[i] = csp.obj;
+    x->count[i] = csp.count;
+    x->child[i] = csp.right;
+    x->n++;
+
+    sp->right = r;
+    if (r) {
+        sp->key = r->key[0];
+        sp->obj = r->obj[0];
+        sp->count = btInnerSum(r, 0, r->n);
+    }
+}
+
+static void btInsertKey(btree *bt, uint64_t k, int64_t o, btIter *it) {
+    btSplit sp;
+    btInner *x;
+
+    btInsertAt(bt, bt->root, bt->height, k, o, &sp, it);
+    bt->length++;
+    if (sp.right == NULL)
+        return;
+    /* the root split, grow a level */
+    x = btNewInner(bt);
+    x->n = 2;
+    x->key[0] = 0;
+    x->obj[0] = INT64_MIN;
+    x->count[0] = bt->length - sp.count;
+    x->child[0] = bt->root;
+    x->key[1] = sp.key;
+    x->obj[1] = sp.obj;
+    x->count[1] = sp.count;
+    x->child[1] = sp.right;
+    bt->root = x;
+    bt->height++;
+}
+
+/* Children a and a+1 of x are leaves and one of them ran low: merge them
+ * when they fit in one leaf, otherwise share the elements evenly. */
+static void btFixLeaves(btree *bt, btInner *x, int a) {
+    int b = a + 1, total, m, d;
+    btLeaf *l = x->child[a], *r = x->child[b];
+
+    total = l->n + r->n;
+    if (total <= BTREE_LEAFCAP) {
+        btLeafMove(l, l->n, r, 0, r->n);
+        btIndexLeaf(bt, l, l->n, total);
+        l->n = total;
+        l->next = r->next;
+        if (r->next)
+            r->next->prev = l;
+        else
+            bt->tail = l;
+        x->count[a] += x->count[b];
+        btInnerMove(x, b, x, b + 1, x->n - b - 1);
+        x->n--;
+        slPoolFree(&bt->leaves, r, 1);
+        return;
+    }
+
+    m = total / 2;
+    if (l->n < m) {
+        d = m - l->n;
+        btLeafMove(l, l->n, r, 0, d);
+        btIndexLeaf(bt, l, l->n, m);
+        btLeafMove(r, 0, r, d, r->n - d);
+    } else {
+        d = l->n - m;
+        btLeafMove(r, d, r, 0, r->n);
+        btLeafMove(r, 0, l, m, d);
+        btIndexLeaf(bt, r, 0, d);
+    }
+    r->n = total - m;
+    l->n = m;
+    x->count[a] = l->n;
+    x->count[b] = r->n;
+    x->key[b] = r->key[0];
+    x->obj[b] = r->obj[0];
+}
+
+/* Same for two inner children. The separator of b in x bounds the first
+ * child of b, it is stored there so entries carry their bound as they move. */
+static void btFixInners(btree *bt, btInner *x, int a) {
+    int b = a + 1, total, m, d;
+    btInner *l = x->child[a], *r = x->child[b];
+    unsigned long moved;
+
+    r->key[0] = x->key[b];
+    r->obj[0] = x->obj[b];
+    total = l->n + r->n;
+    if (total <= BTREE_INNERCAP) {
+        btInnerMove(l, l->n, r, 0, r->n);
+        l->n = total;
+        x->count[a] += x->count[b];
+        btInnerMove(x, b, x, b + 1, x->n - b - 1);
+        x->n--;
+        slPoolFree(&bt->inners, r, 1);
+        return;
+    }
+
+    m = total / 2;
+    if (l->n < m) {
+        d = m - l->n;
+        moved = btInnerSum(r, 0, d);
+        btInnerMove(l, l->n, r, 0, d);
+        btInnerMove(r, 0, r, d, r->n - d);
+        x->count[a] += moved;
+        x->count[b] -= moved;
+    } else {
+        d = l->n - m;
+        moved = btInnerSum(l, m, l->n);
+        btInnerMove(r, d, r, 0, r->n);
+        btInnerMove(r, 0, l, m, d);
+        x->count[a] -= moved;
+        x->count[b] += moved;
+    }
+    r->n = total - m;
+    l->n = m;
+    x->key[b] = r->key[0];
+    x->obj[b] = r->obj[0];
+}
+
+/* Remove the target below node of height h, returns 0 if absent. Children
+ * left underfull are fixed with a sibling on the way back up. */
+static int btDeleteAt(btree *bt, void *node, int h, btTarget *t) {
+    btInner *x = node;
+    int i;
+
+    if (h == 0) {
+        btLeaf *l = node;
+        if (t->byrank) {
+            i = (int)t->rank - 1;
+        } else {
+            i = btLeafLower(l, t->key, t->obj);
+            if (i == l->n || l->key[i] != t->key || l->obj[i] != t->obj)
+                return 0;
+        }
+        t->key = l->key[i];
+        t->obj = l->obj[i];
+        btLeafMove(l, i, l, i + 1, l->n - i - 1);
+        l->n--;
+        if (bt->index)
+            slIndexRemove(bt->index, t->obj);
+        return 1;
+    }
+
+    if (t->byrank) {
+        for (i = 0; t->rank > x->count[i]; i++)
+            t->rank -= x->count[i];
+    } else {
+        i = btRoute(x, t->key, t->obj);
+    }
+    if (!btDeleteAt(bt, x->child[i], h - 1, t))
+        return 0;
+    x->count[i]--;
+    if (x->n > 1 && btNodeSize(x->child[i], h - 1) < (h == 1 ? BTREE_LEAFMIN : BTREE_INNERMIN)) {
+        if (i + 1 == x->n)
+            i--;
+        if (h == 1)
+            btFixLeaves(bt, x, i);
+        else
+            btFixInners(bt, x, i);
+    }
+    return 1;
+}
+
+static int btDeleteTarget(btree *bt, btTarget *t) {
+    btInner *x;
+
+    if (!btDeleteAt(bt, bt->root, bt->height, t))
+        return 0;
+    bt->length--;
+    /* drop roots left with a single child */
+    while (bt->height > 0 && ((btInner *)bt->root)->n == 1) {
+        x = bt->root;
+        bt->root = x->child[0];
+        bt->height--;
+        slPoolFree(&bt->inners, x, 1);
+    }
+    return 1;
+}
+
+/* Check whether the element at it may take key k without moving. Only the
+ * neighbours in the leaf are known, so at the leaf edges the key may only
+ * move away from the neighbouring leaf. */
+static int btFitsInPlace(const btIter *it, uint64_t k) {
+    const btLeaf *l = it->leaf;
+    int pos = it->pos;
+    int64_t o = l->obj[pos];
+    uint64_t old = l->key[pos];
+
+    if (pos > 0 ? !slKeyLess(l->key[pos - 1], l->obj[pos - 1], k, o) : (l->prev && k < old))
+        return 0;
+    if (pos < l->n - 1 ? !slKeyLess(k, o, l->key[pos + 1], l->obj[pos + 1]) : (l->next && k > old))
+        return 0;
+    return 1;
+}
+
+/* Give the element at it the key k, it follows the element. Returns
+ * SL_ENOMEM, with the element untouched, if it must move and the nodes
+ * for its new position cannot be had. */
+static int btMove(btree *bt, btIter *it, uint64_t k) {
+    btTarget t;
+
+    if (btFitsInPlace(it, k)) {
+        it->leaf->key[it->pos] = k;
+        return 1;
+    }
+    if (!btReserve(bt))
+        return SL_ENOMEM;
+    t.byrank = 0;
+    t.key = it->leaf->key[it->pos];
+    t.obj = it->leaf->obj[it->pos];
+    btDeleteTarget(bt, &t);
+    btInsertKey(bt, k, t.obj, it);
+    return 1;
+}
+
+/* With maxlength set and the tree full, whether k/o may still enter:
+ * 0 if it would land past the tail */
+static int btHasRoom(btree *bt, uint64_t k, int64_t o) {
+    btLeaf *tail = bt->tail;
+
+    if (bt->maxlength == 0 || bt->length < bt->maxlength)
+        return 1;
+    return slKeyLess(k, o, tail->key[tail->n - 1], tail->obj[tail->n - 1]);
+}
+
+/* Evict the tail of a full capped tree, once btHasRoom let k/o in */
+static void btMakeRoom(btree *bt, slDeleteCb cb, void *ud) {
+    btTarget t;
+
+    if (bt->maxlength == 0 || bt->length < bt->maxlength)
+        return;
+    t.byrank = 1;
+    t.rank = bt->length;
+    btDeleteTarget(bt, &t);
+    if (cb)
+        cb(ud, t.obj);
+}
+
+/* Find obj through the index, which must be enabled */
+int btGetByObj(btree *bt, int64_t obj, btIter *it) {
+    btLeaf *l;
+    int i;
+
+    if (bt->index == NULL || (l = slIndexGet(bt->index, obj)) == NULL)
+        return 0;
+    for (i = 0; l->obj[i] != obj; i++)
+        ;
+    it->leaf = l;
+    it->pos = i;
+    return 1;
+}
+
+/* Returns 0 if the tree is capped and full and the element ranks after
+ * the tail, SL_ENOMEM if the nodes for it cannot be had. With the index
+ * enabled an existing obj is replaced. */
+int btInsert(btree *bt, double score, int64_t obj, slDeleteCb cb, void *ud) {
+    uint64_t k = btScoreKey(bt, score);
+    btIter it;
+
+    if (btGetByObj(bt, obj, &it))
+        return btMove(bt, &it, k);
+    if (!btHasRoom(bt, k, obj))
+        return 0;
+    if (!btReserve(bt))
+        return SL_ENOMEM;
+    btMakeRoom(bt, cb, ud);
+    btInsertKey(bt, k, obj, &it);
+    return 1;
+}
+
+int btDelete(btree *bt, double score, int64_t obj) {
+    btTarget t;
+
+    t.byrank = 0;
+    t.key = btScoreKey(bt, score);
+    t.obj = obj;
+    if (!btDeleteTarget(bt, &t))
+        return 0;
+    btMaybeShrink(bt);
+    return 1;
+}
+
+/* Walk down to k/o summing the elements left of the path. Returns the
+ * number of elements before k/o (or up to it with upper), with it set
+ * to the leaf position reached. */
+static unsigned long btDescend(btree *bt, uint64_t k, int64_t o, int upper, btIter *it) {
+    void *node = bt->root;
+    unsigned long rank = 0;
+    int h, i;
+
+    for (h = bt->height; h > 0; h--) {
+        btInner *x = node;
+        i = btRoute(x, k, o);
+        rank += btInnerSum(x, 0, i);
+        node = x->child[i];
+    }
+    it->leaf = node;
+    it->pos = upper ? btLeafUpper(node, k, o) : btLeafLower(node, k, o);
+    return rank + it->pos;
+}
+
+/* 1-based rank of score/obj, 0 if absent. it may be NULL, otherwise it
+ * gets the position of the element. */
+unsigned long btGetRank(btree *bt, double score, int64_t obj, btIter *it) {
+    uint64_t k = btScoreKey(bt, score);
+    btIter found;
+    unsigned long before = btDescend(bt, k, obj, 0, &found);
+
+    if (found.pos == found.leaf->n || found.leaf->key[found.pos] != k || found.leaf->obj[found.pos] != obj)
+        return 0;
+    if (it)
+        *it = found;
+    return before + 1;
+}
+
+/* Position of the element at 1-based rank, 0 if out of range */
+int btGetByRank(btree *bt, unsigned long rank, btIter *it) {
+    void *node = bt->root;
+    int h, i;
+
+    if (rank == 0 || rank > bt->length)
+        return 0;
+    for (h = bt->height; h > 0; h--) {
+        btInner *x = node;
+        for (i = 0; rank > x->count[i]; i++)
+            rank -= x->count[i];
+        node = x->child[i];
+    }
+    it->leaf = node;
+    it->pos = (int)rank - 1;
+    return 1;
+}
+
+/* Count elements ordered before score (or equal to it when inclusive) */
+unsigned long btCountBefore(btree *bt, double score, int inclusive) {
+    btIter it;
+    return btDescend(bt, btScoreKey(bt, score), inclusive ? INT64_MAX : INT64_MIN, inclusive, &it);
+}
+
+/* Count elements in score range [min, max] (inclusive) */
+unsigned long btCountInRange(btree *bt, double min, double max) {
+    unsigned long before = btCountBefore(bt, min, 0), last = btCountBefore(bt, max, 1);
+    return last > before ? last - before : 0;
+}
+
+/* Update the score of an element. Returns 0 if not found (SL_ENOMEM if
+ * it could not move), otherwise it gets the new position of the element. */
+int btUpdateScore(btree *bt, double curscore, int64_t obj, double newscore, btIter *it) {
+    uint64_t cur = btScoreKey(bt, curscore);
+
+    if (bt->index) {
+        if (!btGetByObj(bt, obj, it) || it->leaf->key[it->pos] != cur)
+            return 0;
+    } else if (!btGetRank(bt, curscore, obj, it)) {
+        return 0;
+    }
+    return btMove(bt, it, btScoreKey(bt, newscore));
+}
+
+/* Insert many elements, stored gets the number stored. On SL_ENOMEM the
+ * entries before the failing one are in. */
+int btInsertBatch(btree *bt, const skiplistEntry *entries, unsigned long n, unsigned long *stored) {
+    unsigned long i;
+    int r;
+
+    *stored = 0;
+    for (i = 0; i < n; i++) {
+        r = btInsert(bt, entries[i].score, entries[i].obj, NULL, NULL);
+        if (r == SL_ENOMEM)
+            return SL_ENOMEM;
+        *stored += r;
+    }
+    return 1;
+}
+
+/* Delete many elements, returns the number removed */
+unsigned long btDeleteBatch(btree *bt, const skiplistEntry *entries, unsigned long n) {
+    unsigned long i, removed = 0;
+    btTarget t;
+
+    for (i = 0; i < n; i++) {
+        t.byrank = 0;
+        t.key = btScoreKey(bt, entries[i].score);
+        t.obj = entries[i].obj;
+        removed += btDeleteTarget(bt, &t);
+    }
+    btMaybeShrink(bt);
+    return removed;
+}
+
+/* Remove count elements from 1-based rank start on, reporting each
+ * through cb (which may be NULL) */
+static unsigned long btDeleteRun(btree *bt, unsigned long start, unsigned long count, slDeleteCb cb, void *ud) {
+    unsigned long i;
+    btTarget t;
+
+    for (i = 0; i < count; i++) {
+        t.byrank = 1;
+        t.rank = start;
+        btDeleteTarget(bt, &t);
+        if (cb)
+            cb(ud, t.obj);
+    }
+    btMaybeShrink(bt);
+    return count;
+}
+
+/* Delete all elements with rank between start and end (inclusive)
+ * Note: ranks are 1-based */
+unsigned long btDeleteByRank(btree *bt, unsigned long start, unsigned long end, slDeleteCb cb, void *ud) {
+    if (start == 0)
+        start = 1;
+    if (end > bt->length)
+        end = bt->length;
+    if (end < start)
+        return 0;
+    return btDeleteRun(bt, start, end - start + 1, cb, ud);
+}
+
+/* Delete all elements with score in [min, max] (inclusive) */
+unsigned long btDeleteRangeByScore(btree *bt, double min, double max, slDeleteCb cb, void *ud) {
+    unsigned long before = btCountBefore(bt, min, 0), last = btCountBefore(bt, max, 1);
+
+    if (last <= before)
+        return 0;
+    return btDeleteRun(bt, before + 1, last - before, cb, ud);
+}
+
+/* Start a linear build into an empty tree. Elements are appended in list
+ * order into leaves that are left partly free, btBuildEnd puts the inner
+ * levels on top. */
+void btBuildBegin(btree *bt, btBuilder *b) {
+    btLeaf *l = bt->tail;
+
+    b->bt = bt;
+    b->haslast = l->n > 0;
+    if (b->haslast) {
+        b->lastkey = l->key[l->n - 1];
+        b->lastobj = l->obj[l->n - 1];
+    }
+}
+
+/* Remember k/o as the element the next append must follow */
+static void btBuildMark(btBuilder *b, uint64_t k, int64_t o) {
+    b->haslast = 1;
+    b->lastkey = k;
+    b->lastobj = o;
+}
+
+/* Append the next element, returns 0 if it does not sort strictly after
+ * the previous one (or its obj is already indexed), SL_ENOMEM if it
+ * cannot be allocated. Elements beyond maxlength are dropped, they still
+ * have to be in order. */
+int btBuildAppend(btBuilder *b, double score, int64_t obj) {
+    btree *bt = b->bt;
+    btLeaf *l = bt->tail, *next;
+    uint64_t k = btScoreKey(bt, score);
+
+    if (b->haslast && !slKeyLess(b->lastkey, b->lastobj, k, obj))
+        return 0;
+    if (bt->index && slIndexGet(bt->index, obj))
+        return 0;
+    /* the input is ordered, whatever exceeds the cap ranks after the tail */
+    if (bt->maxlength && bt->length >= bt->maxlength) {
+        btBuildMark(b, k, obj);
+        return 1;
+    }
+
+    if (bt->index && !slIndexReserve(bt->index, bt->index->count + 1))
+        return SL_ENOMEM;
+    if (l->n == BTREE_LEAFFILL) {
+        next = btNewLeaf(bt);
+        if (next == NULL)
+            return SL_ENOMEM;
+        next->prev = l;
+        l->next = next;
+        bt->tail = l = next;
+    }
+    l->key[l->n] = k;
+    l->obj[l->n] = obj;
+    l->n++;
+    if (bt->index)
+        slIndexSet(bt->index, obj, l);
+    bt->length++;
+    btBuildMark(b, k, obj);
+    return 1;
+}
+
+/* Close the build: group the leaves, then each level of inner nodes, into
+ * evenly filled parents until one root is left. Returns SL_ENOMEM if the
+ * inner nodes cannot be had, the tree must be cleared then. */
+int btBuildEnd(btBuilder *b) {
+    btree *bt = b->bt;
+    btLeaf *l;
+    void **nodes;
+    unsigned long *counts, m = 0, groups, g, i, j, size, inners = 0;
+    int h = 0;
+
+    if (bt->head == bt->tail)
+        return 1;
+    for (l = bt->head; l; l = l->next)
+        m++;
+    for (size = m; size > 1; size = (size + BTREE_INNERCAP - 1) / BTREE_INNERCAP)
+        inners += (size + BTREE_INNERCAP - 1) / BTREE_INNERCAP;
+    size = m;
+    nodes = slMemAlloc(&bt->alloc, m * sizeof(*nodes));
+    counts = slMemAlloc(&bt->alloc, m * sizeof(*counts));
+    if (nodes == NULL || counts == NULL || !slPoolReserve(&bt->inners, 1, inners)) {
+        slMemFree(&bt->alloc, nodes, size * sizeof(*nodes));
+        slMemFree(&bt->alloc, counts, size * sizeof(*counts));
+        return SL_ENOMEM;
+    }
+    for (i = 0, l = bt->head; l; l = l->next, i++) {
+        nodes[i] = l;
+        counts[i] = l->n;
+    }
+
+    while (m > 1) {
+        groups = (m + BTREE_INNERCAP - 1) / BTREE_INNERCAP;
+        for (g = 0, i = 0; g < groups; g++) {
+            btInner *x = btNewInner(bt);
+            unsigned long sum = 0, n = m / groups + (g < m % groups);
+            for (j = 0; j < n; j++, i++) {
+                if (h == 0) {
+                    x->key[j] = ((btLeaf *)nodes[i])->key[0];
+                    x->obj[j] = ((btLeaf *)nodes[i])->obj[0];
+                } else {
+                    x->key[j] = ((btInner *)nodes[i])->key[0];
+                    x->obj[j] = ((btInner *)nodes[i])->obj[0];
+                }
+                x->count[j] = counts[i];
+                x->child[j] = nodes[i];
+                sum += counts[i];
+            }
+            x->n = (int)n;
+            nodes[g] = x;
+            counts[g] = sum;
+        }
+        m = groups;
+        h++;
+    }
+    bt->root = nodes[0];
+    bt->height = h;
+    slMemFree(&bt->alloc, nodes, size * sizeof(*nodes));
+    slMemFree(&bt->alloc, counts, size * sizeof(*counts));
+    return 1;
+}
@@ -0,0 +1,130 @@
+#ifndef BTREE_HH
+#define BTREE_HH
+
+#include <stdint.h>
+#include "slpool.h"
+#include "slkey.h"
+#include "skiplist.h"
+
+/*
+ * 与 skiplist 同语义的顺序统计 B+ 树: 叶子连续存放编码后的 key 与 obj,
+ * 内部节点记录每个子树的元素数, 按排名与按 score 查找都是一次下降,
+ * 按排名区间读取是叶子内的顺序访问。
+ */
+#ifndef BTREE_LEAFCAP
+#define BTREE_LEAFCAP 64
+#endif
+#ifndef BTREE_INNERCAP
+#define BTREE_INNERCAP 64
+#endif
+
+typedef struct btLeaf {
+    struct btLeaf *prev, *next;
+    int n;
+    uint64_t key[BTREE_LEAFCAP];    // score 的保序编码, 见 slkey.h
+    int64_t obj[BTREE_LEAFCAP];
+} btLeaf;
+
+// 子节点 i (i > 0) 的元素都不排在 key[i]/obj[i] 之前, 且都排在子节点 i-1
+// 的元素之后; key[0]/obj[0] 是整个节点的下界, 查找时不用
+typedef struct btInner {
+    int n;                          // 子节点数
+    uint64_t key[BTREE_INNERCAP];
+    int64_t obj[BTREE_INNERCAP];
+    unsigned long count[BTREE_INNERCAP]; // 子树元素数
+    void *child[BTREE_INNERCAP];
+} btInner;
+
+struct slIndex;
+
+typedef struct btree {
+    void *root;
+    int height;            // 内部节点层数, 0 表示 root 是叶子
+    btLeaf *head, *tail;   // 首尾叶子, 空树时都是 root
+    unsigned long length;
+    char cmp;
+    struct slIndex *index; // obj -> 所在叶子, NULL 表示未开启
+    char autoshrink;       // 删除较多时自动把空闲 slab 还给系统
+    unsigned long maxlength; // 长度上限, 0 表示不限
+    slAllocator alloc;
+    slPool leaves, inners;
+} btree;
+
+// 指向一个元素, 树被修改后失效
+typedef struct btIter {
+    btLeaf *leaf;
+    int pos;
+} btIter;
+
+typedef struct btBuilder {
+    btree *bt;
+    int haslast;           // 已追加过元素, 超出 maxlength 被丢弃的也算
+    uint64_t lastkey;      // 最后追加的元素, 下一个须排在它之后
+    int64_t lastobj;
+} btBuilder;
+
+/* <0, 0, >0 of two plain scores in list order */
+static inline int btCompareScores(const btree *bt, double score1, double score2) {
+    if (score1 < score2) {
+        return bt->cmp ? 1 : -1;
+    }
+    if (score1 > score2) {
+        return bt->cmp ? -1 : 1;
+    }
+    return 0;
+}
+
+static inline uint64_t btScoreKey(const btree *bt, double score) {
+    return slEncodeDouble(score, slKeyFlip(bt->cmp));
+}
+
+static inline double btIterScore(const btree *bt, const btIter *it) {
+    return slDecodeDouble(it->leaf->key[it->pos], slKeyFlip(bt->cmp));
+}
+
+static inline int64_t btIterObj(const btIter *it) {
+    return it->leaf->obj[it->pos];
+}
+
+/* Step to the next element in list order, leaf becomes NULL past the end */
+static inline void btIterNext(btIter *it) {
+    if (++it->pos >= it->leaf->n) {
+        it->leaf = it->leaf->next;
+        it->pos = 0;
+    }
+}
+
+static inline void btIterPrev(btIter *it) {
+    if (--it->pos < 0) {
+        it->leaf = it->leaf->prev;
+        if (it->leaf)
+            it->pos = it->leaf->n - 1;
+    }
+}
+
+btree *btCreate(slAllocFn allocf, void *ud);
+void btFree(btree *bt);
+void btClear(btree *bt);
+size_t btMemory(btree *bt);
+int btEnableIndex(btree *bt);
+size_t btShrink(btree *bt);
+
+int btInsert(btree *bt, double score, int64_t obj, slDeleteCb cb, void *ud);
+int btDelete(btree *bt, double score, int64_t obj);
+int btUpdateScore(btree *bt, double curscore, int64_t obj, double newscore, btIter *it);
+int btInsertBatch(btree *bt, const skiplistEntry *entries, unsigned long n, unsigned long *stored);
+unsigned long btDeleteBatch(btree *bt, const skiplistEntry *entries, unsigned long n);
+unsigned long btDeleteByRank(btree *bt, unsigned long start, unsigned long end, slDeleteCb cb, void *ud);
+unsigned long btDeleteRangeByScore(btree *bt, double min, double max, slDeleteCb cb, void *ud);
+
+unsigned long btGetRank(btree *bt, double score, int64_t obj, btIter *it);
+int btGetByRank(btree *bt, unsigned long rank, btIter *it);
+int btGetByObj(btree *bt, int64_t obj, btIter *it);
+unsigned long btCountBefore(btree *bt, double score, int inclusive);
+unsigned long btCountInRange(btree *bt, double min, double max);
+
+void btBuildBegin(btree *bt, btBuilder *b);
+int btBuildAppend(btBuilder *b, double score, int64_t obj);
+int btBuildEnd(btBuilder *b);
+
+#endif //BTREE_HH
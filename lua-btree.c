@@ -0,0 +1,990 @@
+/*
+ * The B+tree engine behind the skiplist.c API: new(cmp, {engine = "btree"})
+ * ends up here and the methods behave like their skiplist counterparts.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "lauxlib.h"
+#include "lua.h"
+#include "btree.h"
+#include "slindex.h"
+#include "sldump.h"
+#include "slsearch.h"
+#include "slshared.h"
+
+/* same records as lua-skiplist.c, snapshots move between the engines */
+#define DUMP_KIND 1
+#define DUMP_RECSIZE 16
+
+static inline btree *
+_to_btree(lua_State *L) {
+    btree **bt = lua_touserdata(L, 1);
+    if (bt == NULL) {
+        luaL_error(L, "must be skiplist object");
+    }
+    return *bt;
+}
+
+static inline int
+_find_byobj(lua_State *L, btree *bt, lua_Integer obj, btIter *it) {
+    if (bt->index == NULL) {
+        luaL_error(L, "skiplist index not enabled, score is required");
+    }
+    return btGetByObj(bt, obj, it);
+}
+
+/* Score of obj given at idx, or looked up through the index when nil.
+ * Returns 0 if the obj is not indexed. */
+static int
+_opt_score(lua_State *L, btree *bt, lua_Integer obj, int idx, double *score) {
+    btIter it;
+    if (!lua_isnoneornil(L, idx)) {
+        *score = luaL_checknumber(L, idx);
+        return 1;
+    }
+    if (!_find_byobj(L, bt, obj, &it)) {
+        return 0;
+    }
+    *score = btIterScore(bt, &it);
+    return 1;
+}
+
+/* Raise when the tree reports that the allocator refused, returns any
+ * other status as is */
+static int
+_check_alloc(lua_State *L, int r) {
+    if (r == SL_ENOMEM) {
+        luaL_error(L, "not enough memory");
+    }
+    return r;
+}
+
+struct evict_ctx {
+    int evicted;
+    int64_t obj;
+};
+
+static void
+_evict_cb(void *ud, int64_t obj) {
+    struct evict_ctx *ctx = (struct evict_ctx *)ud;
+    ctx->evicted = 1;
+    ctx->obj = obj;
+}
+
+static int
+_insert(lua_State *L) {
+    btree *bt = _to_btree(L);
+    lua_Integer obj = luaL_checkinteger(L, 2);
+    double score = luaL_checknumber(L, 3);
+    struct evict_ctx ctx = { 0, 0 };
+    lua_pushboolean(L, _check_alloc(L, btInsert(bt, score, obj, _evict_cb, &ctx)));
+    if (!ctx.evicted) {
+        return 1;
+    }
+    lua_pushinteger(L, ctx.obj);
+    return 2;
+}
+
+static int
+_delete(lua_State *L) {
+    btree *bt = _to_btree(L);
+    lua_Integer obj = luaL_checkinteger(L, 2);
+    double score;
+    lua_pushboolean(L, _opt_score(L, bt, obj, 3, &score) && btDelete(bt, score, obj));
+    return 1;
+}
+
+static int
+_update(lua_State *L) {
+    btree *bt = _to_btree(L);
+    lua_Integer obj = luaL_checkinteger(L, 2);
+    double curscore, newscore = luaL_checknumber(L, 4);
+    btIter it;
+    lua_pushboolean(L, _opt_score(L, bt, obj, 3, &curscore) && _check_alloc(L, btUpdateScore(bt, curscore, obj, newscore, &it)));
+    return 1;
+}
+
+static int
+_incrby(lua_State *L) {
+    btree *bt = _to_btree(L);
+    lua_Integer obj = luaL_checkinteger(L, 2);
+    double curscore, delta = luaL_checknumber(L, 4);
+    btIter it;
+    if (!_opt_score(L, bt, obj, 3, &curscore) || !_check_alloc(L, btUpdateScore(bt, curscore, obj, curscore + delta, &it))) {
+        return 0;
+    }
+    lua_pushnumber(L, btIterScore(bt, &it));
+    return 1;
+}
+
+/* Read objs at index 2 and scores at index 3 into a temporary userdata.
+ * Without scores they are looked up through the index and missing objs
+ * are left out, or kept with a zero score that cannot match when keep is
+ * set. */
+static skiplistEntry *
+_check_entries(lua_State *L, btree *bt, unsigned long *count, int keep) {
+    luaL_checktype(L, 2, LUA_TTABLE);
+    size_t len = lua_rawlen(L, 2), i;
+    int hasscore = !lua_isnoneornil(L, 3);
+    if (hasscore) {
+        luaL_checktype(L, 3, LUA_TTABLE);
+        if (lua_rawlen(L, 3) != len) {
+            luaL_error(L, "objs and scores must have the same length");
+        }
+    }
+
+    skiplistEntry *entries = lua_newuserdata(L, len * sizeof(skiplistEntry));
+    unsigned long n = 0;
+    for (i = 1; i <= len; i++) {
+        int isnum;
+        lua_rawgeti(L, 2, i);
+        lua_Integer obj = lua_tointegerx(L, -1, &isnum);
+        lua_pop(L, 1);
+        if (!isnum) {
+            luaL_error(L, "objs[%d] must be an integer", (int)i);
+        }
+        entries[n].obj = obj;
+        if (hasscore) {
+            lua_rawgeti(L, 3, i);
+            entries[n].score = lua_tonumberx(L, -1, &isnum);
+            lua_pop(L, 1);
+            if (!isnum) {
+                luaL_error(L, "scores[%d] must be a number", (int)i);
+            }
+        } else {
+            btIter it;
+            int found = _find_byobj(L, bt, obj, &it);
+            if (!found && !keep) {
+                continue;
+            }
+            entries[n].score = found ? btIterScore(bt, &it) : 0;
+        }
+        n++;
+    }
+    *count = n;
+    return entries;
+}
+
+static int
+_insert_batch(lua_State *L) {
+    btree *bt = _to_btree(L);
+    unsigned long n;
+    luaL_checktype(L, 3, LUA_TTABLE);
+    skiplistEntry *entries = _check_entries(L, bt, &n, 0);
+    unsigned long stored;
+    _check_alloc(L, btInsertBatch(bt, entries, n, &stored));
+    lua_pushinteger(L, stored);
+    return 1;
+}
+
+static int
+_ranks_of(lua_State *L) {
+    btree *bt = _to_btree(L);
+    unsigned long n, i;
+    skiplistEntry *entries = _check_entries(L, bt, &n, 1);
+
+    lua_createtable(L, n, 0);
+    for (i = 0; i < n; i++) {
+        unsigned long rank = btGetRank(bt, entries[i].score, entries[i].obj, NULL);
+        if (rank) {
+            lua_pushinteger(L, rank);
+        } else {
+            lua_pushboolean(L, 0);
+        }
+        lua_rawseti(L, -2, i + 1);
+    }
+    return 1;
+}
+
+static int
+_delete_batch(lua_State *L) {
+    btree *bt = _to_btree(L);
+    unsigned long n;
+    skiplistEntry *entries = _check_entries(L, bt, &n, 0);
+    lua_pushinteger(L, btDeleteBatch(bt, entries, n));
+    return 1;
+}
+
+/* deterministic is accepted for the skiplist signature, the tree has no
+ * random levels */
+static int
+_from_sorted(lua_State *L) {
+    btree *bt = _to_btree(L);
+    luaL_checktype(L, 2, LUA_TTABLE);
+    luaL_checktype(L, 3, LUA_TTABLE);
+    size_t len = lua_rawlen(L, 2), i;
+    if (lua_rawlen(L, 3) != len) {
+        luaL_error(L, "objs and scores must have the same length");
+    }
+    if (bt->length != 0) {
+        luaL_error(L, "from_sorted needs an empty skiplist");
+    }
+
+    btBuilder b;
+    btBuildBegin(bt, &b);
+    for (i = 1; i <= len; i++) {
+        int isobj, isscore;
+        lua_rawgeti(L, 2, i);
+        lua_rawgeti(L, 3, i);
+        lua_Integer obj = lua_tointegerx(L, -2, &isobj);
+        double score = lua_tonumberx(L, -1, &isscore);
+        lua_pop(L, 2);
+        int r = isobj && isscore ? btBuildAppend(&b, score, obj) : 0;
+        if (r != 1) {
+            btClear(bt);
+            _check_alloc(L, r);
+            luaL_error(L, "invalid or unsorted entry at %d", (int)i);
+        }
+    }
+    if (btBuildEnd(&b) == SL_ENOMEM) {
+        btClear(bt);
+        luaL_error(L, "not enough memory");
+    }
+    lua_settop(L, 1);
+    return 1;
+}
+
+static void
+_delete_rank_cb(void *ud, int64_t obj) {
+    lua_State *L = (lua_State *)ud;
+    lua_pushvalue(L, 4);
+    lua_pushinteger(L, obj);
+    lua_call(L, 1, 0);
+}
+
+static int
+_delete_by_rank(lua_State *L) {
+    btree *bt = _to_btree(L);
+    unsigned long start = luaL_checkinteger(L, 2);
+    unsigned long end = luaL_checkinteger(L, 3);
+    luaL_checktype(L, 4, LUA_TFUNCTION);
+    if (start > end) {
+        unsigned long tmp = start;
+        start = end;
+        end = tmp;
+    }
+
+    lua_pushinteger(L, btDeleteByRank(bt, start, end, _delete_rank_cb, L));
+    return 1;
+}
+
+struct collect_ctx {
+    lua_State *L;
+    lua_Integer n;
+};
+
+static void
+_collect_cb(void *ud, int64_t obj) {
+    struct collect_ctx *ctx = (struct collect_ctx *)ud;
+    lua_pushinteger(ctx->L, obj);
+    lua_rawseti(ctx->L, -2, ++ctx->n);
+}
+
+static int
+_delete_byscore(lua_State *L) {
+    btree *bt = _to_btree(L);
+    double s1 = luaL_checknumber(L, 2);
+    double s2 = luaL_checknumber(L, 3);
+    int collect = lua_toboolean(L, 4);
+
+    if (!collect) {
+        lua_pushinteger(L, btDeleteRangeByScore(bt, s1, s2, NULL, NULL));
+        return 1;
+    }
+    /* presized so rawseti never allocates while leaves are being changed */
+    struct collect_ctx ctx = { L, 0 };
+    lua_createtable(L, (int)btCountInRange(bt, s1, s2), 0);
+    btDeleteRangeByScore(bt, s1, s2, _collect_cb, &ctx);
+    lua_pushinteger(L, ctx.n);
+    lua_insert(L, -2);
+    return 2;
+}
+
+static int
+_get_count(lua_State *L) {
+    btree *bt = _to_btree(L);
+    lua_pushinteger(L, bt->length);
+    return 1;
+}
+
+static int
+_rank_byobj(lua_State *L) {
+    btree *bt = _to_btree(L);
+    lua_Integer obj = luaL_checkinteger(L, 2);
+    double score;
+    if (!_opt_score(L, bt, obj, 3, &score)) {
+        return 0;
+    }
+
+    unsigned long rank = btGetRank(bt, score, obj, NULL);
+    if (rank == 0) {
+        return 0;
+    }
+    lua_pushinteger(L, rank);
+    return 1;
+}
+
+static int
+_score(lua_State *L) {
+    btree *bt = _to_btree(L);
+    lua_Integer obj = luaL_checkinteger(L, 2);
+    btIter it;
+
+    if (!_find_byobj(L, bt, obj, &it)) {
+        return 0;
+    }
+    lua_pushnumber(L, btIterScore(bt, &it));
+    return 1;
+}
+
+/* Ranks of the entries with score in [s1, s2]; start > end when none */
+static void
+_score_ranks(btree *bt, double s1, double s2, unsigned long *start, unsigned long *end) {
+    *start = btCountBefore(bt, s1, 0) + 1;
+    *end = btCountBefore(bt, s2, 1);
+}
+
+static int
+_ranks_byscore(lua_State *L) {
+    btree *bt = _to_btree(L);
+    double s1 = luaL_checknumber(L, 2);
+    double s2 = luaL_checknumber(L, 3);
+    unsigned long start, end;
+
+    _score_ranks(bt, s1, s2, &start, &end);
+    if (end < start) {
+        return 0;
+    }
+    lua_pushinteger(L, start);
+    lua_pushinteger(L, end);
+    return 2;
+}
+
+static int
+_count_byscore(lua_State *L) {
+    btree *bt = _to_btree(L);
+    double s1 = luaL_checknumber(L, 2);
+    double s2 = luaL_checknumber(L, 3);
+    lua_pushinteger(L, btCountInRange(bt, s1, s2));
+    return 1;
+}
+
+static int
+_obj_byrank(lua_State *L) {
+    btree *bt = _to_btree(L);
+    unsigned long rank = luaL_checkinteger(L, 2);
+    btIter it;
+
+    if (btGetByRank(bt, rank, &it)) {
+        lua_pushinteger(L, btIterObj(&it));
+        return 1;
+    }
+    return 0;
+}
+
+/* Push count objs walking from it, the leaves are read in order */
+static void
+_push_objs(lua_State *L, btIter *it, unsigned long count) {
+    unsigned long n = 0;
+
+    lua_createtable(L, count, 0);
+    while (it->leaf && n < count) {
+        n++;
+        lua_pushinteger(L, btIterObj(it));
+        lua_rawseti(L, -2, n);
+        btIterNext(it);
+    }
+}
+
+static int
+_objs_byrank(lua_State *L) {
+    btree *bt = _to_btree(L);
+    unsigned long r1 = luaL_checkinteger(L, 2);
+    unsigned long r2 = luaL_checkinteger(L, 3);
+    btIter it;
+
+    if (r1 > r2) {
+        luaL_error(L, "invalid rank range: r1(%lu) > r2(%lu)", r1, r2);
+    }
+    if (!btGetByRank(bt, r1, &it)) {
+        it.leaf = NULL;
+    }
+    _push_objs(L, &it, r2 - r1 < bt->length ? r2 - r1 + 1 : bt->length);
+    return 1;
+}
+
+static int
+_objs_byscore(lua_State *L) {
+    btree *bt = _to_btree(L);
+    double s1 = luaL_checknumber(L, 2);
+    double s2 = luaL_checknumber(L, 3);
+    unsigned long start, end;
+    btIter it;
+
+    _score_ranks(bt, s1, s2, &start, &end);
+    if (end < start || !btGetByRank(bt, start, &it)) {
+        lua_newtable(L);
+        return 1;
+    }
+    _push_objs(L, &it, end - start + 1);
+    return 1;
+}
+
+/* Push count entries starting at it as an objs array, plus a parallel
+ * scores array when withscores is set. reverse walks towards the head */
+static int
+_push_nodes(lua_State *L, btree *bt, btIter *it, unsigned long count, int withscores, int reverse) {
+    unsigned long n = 0, size = count < bt->length ? count : bt->length;
+
+    lua_createtable(L, size, 0);
+    if (withscores) {
+        lua_createtable(L, size, 0);
+    }
+    while (it->leaf && n < count) {
+        n++;
+        lua_pushinteger(L, btIterObj(it));
+        lua_rawseti(L, withscores ? -3 : -2, n);
+        if (withscores) {
+            lua_pushnumber(L, btIterScore(bt, it));
+            lua_rawseti(L, -2, n);
+        }
+        if (reverse) {
+            btIterPrev(it);
+        } else {
+            btIterNext(it);
+        }
+    }
+    return withscores ? 2 : 1;
+}
+
+static int
+_push_range(lua_State *L, btree *bt, unsigned long rank, unsigned long count, int withscores, int reverse) {
+    btIter it;
+    if (count == 0 || !btGetByRank(bt, rank, &it)) {
+        it.leaf = NULL;
+    }
+    return _push_nodes(L, bt, &it, count, withscores, reverse);
+}
+
+/* Rank of quantile q in list order, nearest rank rounding down */
+static unsigned long
+_quantile_rank(unsigned long length, lua_Number q) {
+    if (q <= 0) {
+        return 1;
+    }
+    if (q >= 1) {
+        return length;
+    }
+    return 1 + (unsigned long)(q * (length - 1));
+}
+
+static int
+_quantile(lua_State *L) {
+    btree *bt = _to_btree(L);
+    lua_Number q = luaL_checknumber(L, 2);
+    luaL_argcheck(L, q == q, 2, "quantile is NaN");
+    btIter it;
+    if (bt->length == 0) {
+        return 0;
+    }
+    btGetByRank(bt, _quantile_rank(bt->length, q), &it);
+    lua_pushnumber(L, btIterScore(bt, &it));
+    lua_pushinteger(L, btIterObj(&it));
+    return 2;
+}
+
+static int
+_quantiles(lua_State *L) {
+    btree *bt = _to_btree(L);
+    luaL_checktype(L, 2, LUA_TTABLE);
+    size_t n = lua_rawlen(L, 2), i;
+    lua_Number last = 0;
+    btIter it;
+
+    lua_createtable(L, n, 0);
+    for (i = 0; i < n; i++) {
+        lua_rawgeti(L, 2, i + 1);
+        lua_Number q = luaL_checknumber(L, -1);
+        lua_pop(L, 1);
+        luaL_argcheck(L, q == q, 2, "quantile is NaN");
+        if (i > 0 && q < last) {
+            luaL_error(L, "quantiles must be ascending");
+        }
+        last = q;
+        if (bt->length) {
+            btGetByRank(bt, _quantile_rank(bt->length, q), &it);
+            lua_pushnumber(L, btIterScore(bt, &it));
+            lua_rawseti(L, -2, i + 1);
+        }
+    }
+    return 1;
+}
+
+static int
+_histogram(lua_State *L) {
+    btree *bt = _to_btree(L);
+    luaL_checktype(L, 2, LUA_TTABLE);
+    size_t n = lua_rawlen(L, 2), i;
+    double *bounds = lua_newuserdata(L, n * sizeof(*bounds));
+    for (i = 0; i < n; i++) {
+        lua_rawgeti(L, 2, i + 1);
+        bounds[i] = luaL_checknumber(L, -1);
+        lua_pop(L, 1);
+        luaL_argcheck(L, bounds[i] == bounds[i], 2, "bound is NaN");
+        if (i > 0 && btCompareScores(bt, bounds[i - 1], bounds[i]) > 0) {
+            luaL_error(L, "bounds must follow the list order");
+        }
+    }
+
+    unsigned long prev = 0, count;
+    lua_createtable(L, n + 1, 0);
+    for (i = 0; i < n; i++) {
+        count = btCountBefore(bt, bounds[i], 0);
+        lua_pushinteger(L, count - prev);
+        lua_rawseti(L, -2, i + 1);
+        prev = count;
+    }
+    lua_pushinteger(L, bt->length - prev);
+    lua_rawseti(L, -2, n + 1);
+    return 1;
+}
+
+static int
+_around(lua_State *L) {
+    btree *bt = _to_btree(L);
+    lua_Integer obj = luaL_checkinteger(L, 2);
+    double score;
+    if (!_opt_score(L, bt, obj, 3, &score)) {
+        return 0;
+    }
+    lua_Integer above = luaL_optinteger(L, 4, 0);
+    lua_Integer below = luaL_optinteger(L, 5, 0);
+    int withscores = lua_toboolean(L, 6);
+    luaL_argcheck(L, above >= 0, 4, "must not be negative");
+    luaL_argcheck(L, below >= 0, 5, "must not be negative");
+
+    btIter it;
+    unsigned long rank = btGetRank(bt, score, obj, &it), count = 1 + below;
+    if (rank == 0) {
+        return 0;
+    }
+    while (above-- > 0 && (it.pos > 0 || it.leaf->prev)) {
+        btIterPrev(&it);
+        count++;
+    }
+    lua_pushinteger(L, rank);
+    return 1 + _push_nodes(L, bt, &it, count, withscores, 0);
+}
+
+static int
+_range_byrank(lua_State *L) {
+    btree *bt = _to_btree(L);
+    unsigned long r1 = luaL_checkinteger(L, 2);
+    unsigned long r2 = luaL_checkinteger(L, 3);
+    int withscores = lua_toboolean(L, 4);
+
+    if (r1 > r2) {
+        luaL_error(L, "invalid rank range: r1(%lu) > r2(%lu)", r1, r2);
+    }
+    if (r1 < 1) {
+        r1 = 1;
+    }
+    if (r2 > bt->length) {
+        r2 = bt->length;
+    }
+    return _push_range(L, bt, r1, r2 >= r1 ? r2 - r1 + 1 : 0, withscores, 0);
+}
+
+static int
+_range_byscore(lua_State *L) {
+    btree *bt = _to_btree(L);
+    double s1 = luaL_checknumber(L, 2);
+    double s2 = luaL_checknumber(L, 3);
+    int withscores = lua_toboolean(L, 4);
+    unsigned long start, end;
+
+    _score_ranks(bt, s1, s2, &start, &end);
+    return _push_range(L, bt, start, end >= start ? end - start + 1 : 0, withscores, 0);
+}
+
+/* Ranks are counted from the tail: rank 1 is the last element */
+static int
+_revrange_byrank(lua_State *L) {
+    btree *bt = _to_btree(L);
+    unsigned long r1 = luaL_checkinteger(L, 2);
+    unsigned long r2 = luaL_checkinteger(L, 3);
+    int withscores = lua_toboolean(L, 4);
+
+    if (r1 > r2) {
+        luaL_error(L, "invalid rank range: r1(%lu) > r2(%lu)", r1, r2);
+    }
+    if (r1 < 1) {
+        r1 = 1;
+    }
+    if (r2 > bt->length) {
+        r2 = bt->length;
+    }
+    if (r2 < r1) {
+        return _push_range(L, bt, 0, 0, withscores, 1);
+    }
+    return _push_range(L, bt, bt->length - r1 + 1, r2 - r1 + 1, withscores, 1);
+}
+
+static int
+_revrange_byscore(lua_State *L) {
+    btree *bt = _to_btree(L);
+    double s1 = luaL_checknumber(L, 2);
+    double s2 = luaL_checknumber(L, 3);
+    int withscores = lua_toboolean(L, 4);
+    lua_Integer offset = luaL_optinteger(L, 5, 0);
+    lua_Integer count = luaL_optinteger(L, 6, -1);
+    unsigned long start, end;
+
+    _score_ranks(bt, s2, s1, &start, &end);
+    if (offset < 0) {
+        luaL_error(L, "invalid offset: %I", offset);
+    }
+    if (end < start || (unsigned long)offset > end - start) {
+        return _push_range(L, bt, 0, 0, withscores, 1);
+    }
+    end -= offset;
+    if (count >= 0 && (unsigned long)count < end - start + 1) {
+        start = end - count + 1;
+    }
+    return _push_range(L, bt, end, end - start + 1, withscores, 1);
+}
+
+static inline void
+_dump_record(char *p, btree *bt, btIter *it) {
+    slDumpPutU64(p, (uint64_t)btIterObj(it));
+    slDumpPutDouble(p + 8, btIterScore(bt, it));
+}
+
+static const char *
+_load_records(btBuilder *b, const char *p, size_t n) {
+    size_t i;
+    for (i = 0; i < n; i++, p += DUMP_RECSIZE) {
+        int r = btBuildAppend(b, slDumpGetDouble(p + 8), (int64_t)slDumpGetU64(p));
+        if (r == SL_ENOMEM) {
+            return "not enough memory";
+        }
+        if (!r) {
+            return "unsorted or duplicated snapshot record";
+        }
+    }
+    return NULL;
+}
+
+static uint64_t
+_check_header(lua_State *L, btree *bt, const char *head) {
+    int cmp = 0;
+    uint64_t length = 0;
+    if (!slDumpGetHeader(head, DUMP_KIND, &cmp, &length)) {
+        luaL_error(L, "invalid skiplist snapshot");
+    }
+    if (cmp != bt->cmp) {
+        luaL_error(L, "snapshot cmp(%d) does not match skiplist cmp(%d)", cmp, bt->cmp);
+    }
+    return length;
+}
+
+static int
+_dump(lua_State *L) {
+    btree *bt = _to_btree(L);
+    size_t size = SLDUMP_HEADSIZE + bt->length * DUMP_RECSIZE;
+    luaL_Buffer b;
+    char *p = luaL_buffinitsize(L, &b, size);
+    btIter it;
+
+    slDumpPutHeader(p, DUMP_KIND, bt->cmp, bt->length);
+    p += SLDUMP_HEADSIZE;
+    if (!btGetByRank(bt, 1, &it)) {
+        it.leaf = NULL;
+    }
+    for (; it.leaf; btIterNext(&it), p += DUMP_RECSIZE) {
+        _dump_record(p, bt, &it);
+    }
+    luaL_pushresultsize(&b, size);
+    return 1;
+}
+
+static int
+_load(lua_State *L) {
+    btree *bt = _to_btree(L);
+    size_t size;
+    const char *blob = luaL_checklstring(L, 2, &size);
+    if (size < SLDUMP_HEADSIZE) {
+        luaL_error(L, "invalid skiplist snapshot");
+    }
+    uint64_t length = _check_header(L, bt, blob);
+    if ((size - SLDUMP_HEADSIZE) / DUMP_RECSIZE != length || (size - SLDUMP_HEADSIZE) % DUMP_RECSIZE != 0) {
+        luaL_error(L, "truncated skiplist snapshot");
+    }
+
+    btBuilder b;
+    btClear(bt);
+    btBuildBegin(bt, &b);
+    const char *err = _load_records(&b, blob + SLDUMP_HEADSIZE, length);
+    if (err == NULL && btBuildEnd(&b) == SL_ENOMEM) {
+        err = "not enough memory";
+    }
+    if (err) {
+        btClear(bt);
+        luaL_error(L, "%s", err);
+    }
+    lua_pushinteger(L, bt->length);
+    return 1;
+}
+
+static int
+_dump_file(lua_State *L) {
+    btree *bt = _to_btree(L);
+    const char *path = luaL_checkstring(L, 2);
+    char *buf = lua_newuserdata(L, SLDUMP_CHUNK * DUMP_RECSIZE);
+    FILE *f = fopen(path, "wb");
+    btIter it;
+    if (f == NULL) {
+        return luaL_fileresult(L, 0, path);
+    }
+
+    char head[SLDUMP_HEADSIZE];
+    slDumpPutHeader(head, DUMP_KIND, bt->cmp, bt->length);
+    fwrite(head, SLDUMP_HEADSIZE, 1, f);
+    if (!btGetByRank(bt, 1, &it)) {
+        it.leaf = NULL;
+    }
+    while (it.leaf) {
+        size_t n = 0;
+        for (; it.leaf && n < SLDUMP_CHUNK; btIterNext(&it), n++) {
+            _dump_record(buf + n * DUMP_RECSIZE, bt, &it);
+        }
+        fwrite(buf, DUMP_RECSIZE, n, f);
+    }
+    int ok = !ferror(f);
+    if (fclose(f) != 0) {
+        ok = 0;
+    }
+    return luaL_fileresult(L, ok, path);
+}
+
+static int
+_load_file(lua_State *L) {
+    btree *bt = _to_btree(L);
+    const char *path = luaL_checkstring(L, 2);
+    char *buf = lua_newuserdata(L, SLDUMP_CHUNK * DUMP_RECSIZE);
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        return luaL_fileresult(L, 0, path);
+    }
+
+    int cmp;
+    uint64_t length;
+    char head[SLDUMP_HEADSIZE];
+    if (fread(head, SLDUMP_HEADSIZE, 1, f) != 1 || !slDumpGetHeader(head, DUMP_KIND, &cmp, &length) || cmp != bt->cmp) {
+        fclose(f);
+        lua_pushnil(L);
+        lua_pushfstring(L, "%s: invalid skiplist snapshot or cmp mismatch", path);
+        return 2;
+    }
+
+    btBuilder b;
+    const char *err = NULL;
+    btClear(bt);
+    btBuildBegin(bt, &b);
+    while (length > 0 && err == NULL) {
+        size_t n = length < SLDUMP_CHUNK ? length : SLDUMP_CHUNK;
+        if (fread(buf, DUMP_RECSIZE, n, f) != n) {
+            err = "truncated skiplist snapshot";
+            break;
+        }
+        err = _load_records(&b, buf, n);
+        length -= n;
+    }
+    if (err == NULL && btBuildEnd(&b) == SL_ENOMEM) {
+        err = "not enough memory";
+    }
+    fclose(f);
+    if (err) {
+        btClear(bt);
+        lua_pushnil(L);
+        lua_pushfstring(L, "%s: %s", path, err);
+        return 2;
+    }
+    lua_pushinteger(L, bt->length);
+    return 1;
+}
+
+static int
+_shrink(lua_State *L) {
+    btree *bt = _to_btree(L);
+    lua_pushinteger(L, btShrink(bt));
+    return 1;
+}
+
+/* Same three sizes as the skiplist, plus the search kernel picked for
+ * this CPU: "avx2", "sse4.2" or "scalar" */
+static int
+_memory(lua_State *L) {
+    btree *bt = _to_btree(L);
+    lua_pushinteger(L, btMemory(bt));
+    lua_pushinteger(L, bt->leaves.bytes + bt->inners.bytes);
+    lua_pushinteger(L, bt->index ? slIndexMemory(bt->index) : 0);
+    lua_pushstring(L, slKeySearchImpl());
+    return 4;
+}
+
+/* Copy the tree into the shared board name, see lua-slshared.c. Raises
+ * like the skiplist version on a score/obj held twice. */
+static int
+_publish(lua_State *L) {
+    btree *bt = _to_btree(L);
+    const char *name = luaL_checkstring(L, 2);
+    slRetired *t = slSharedPrepare(name);
+    btree *snap;
+    btLeaf *l;
+    btBuilder b;
+    int i, r = 1;
+
+    if (t == NULL) {
+        luaL_error(L, "not enough memory");
+    }
+    snap = btCreate(NULL, NULL);
+    if (snap == NULL) {
+        slSharedCancel(t);
+        luaL_error(L, "not enough memory");
+    }
+    snap->cmp = bt->cmp;
+    if (bt->index) {
+        r = btEnableIndex(snap);
+    }
+    btBuildBegin(snap, &b);
+    for (l = bt->head; l && r == 1; l = l->next) {
+        for (i = 0; i < l->n && r == 1; i++) {
+            r = btBuildAppend(&b, slDecodeDouble(l->key[i], slKeyFlip(bt->cmp)), l->obj[i]);
+        }
+    }
+    if (r == 1) {
+        r = btBuildEnd(&b);
+    }
+    if (r != 1) {
+        btFree(snap);
+        slSharedCancel(t);
+        _check_alloc(L, r);
+        luaL_error(L, "duplicated entry, cannot publish");
+    }
+    lua_pushinteger(L, snap->length);
+    slSharedPublish(t, snap);
+    return 1;
+}
+
+/* Same arguments as the skiplist new(), seed is accepted and unused */
+static int
+_new(lua_State *L) {
+    char cmp = luaL_optinteger(L, 1, 0);
+    int index = 0, autoshrink = 0;
+    lua_Integer maxlength = 0;
+    if (lua_istable(L, 2)) {
+        lua_getfield(L, 2, "index");
+        index = lua_toboolean(L, -1);
+        lua_pop(L, 1);
+        lua_getfield(L, 2, "autoshrink");
+        autoshrink = lua_toboolean(L, -1);
+        lua_pop(L, 1);
+        lua_getfield(L, 2, "max_length");
+        maxlength = luaL_optinteger(L, -1, 0);
+        lua_pop(L, 1);
+        luaL_argcheck(L, maxlength >= 0, 2, "max_length must not be negative");
+    }
+
+    /* the userdata comes before the tree so that nothing raising later
+     * can leak it, __gc skips the NULL left if the tree is not made */
+    btree **bt = (btree **)lua_newuserdata(L, sizeof(btree *));
+    *bt = NULL;
+    lua_pushvalue(L, lua_upvalueindex(1));
+    lua_setmetatable(L, -2);
+
+    void *ud;
+    lua_Alloc allocf = lua_getallocf(L, &ud);
+    btree *pbt = btCreate(allocf, ud);
+    if (pbt == NULL) {
+        luaL_error(L, "not enough memory");
+    }
+    *bt = pbt;
+    pbt->cmp = cmp;
+    pbt->autoshrink = autoshrink;
+    pbt->maxlength = maxlength;
+    if (index) {
+        _check_alloc(L, btEnableIndex(pbt));
+    }
+    return 1;
+}
+
+static int
+_release(lua_State *L) {
+    btree *bt = _to_btree(L);
+    if (bt) {
+        btFree(bt);
+    }
+    return 0;
+}
+
+/* Returns the constructor, skiplist.c hands new() calls asking for the
+ * btree engine to it */
+LUAMOD_API int
+luaopen_skiplist_btree(lua_State *L) {
+    luaL_checkversion(L);
+
+    luaL_Reg l[] = {
+        { "insert", _insert },
+        { "delete", _delete },
+        { "update", _update },
+        { "incrby", _incrby },
+        { "delete_byrank", _delete_by_rank },
+        { "delete_byscore", _delete_byscore },
+        { "insert_batch", _insert_batch },
+        { "delete_batch", _delete_batch },
+        { "from_sorted", _from_sorted },
+
+        { "get_count", _get_count },
+        { "rank_byobj", _rank_byobj },
+        { "rank", _rank_byobj },
+        { "ranks_of", _ranks_of },
+        { "score", _score },
+        { "ranks_byscore", _ranks_byscore },
+        { "count_byscore", _count_byscore },
+        { "obj_byrank", _obj_byrank },
+        { "objs_byrank", _objs_byrank },
+        { "objs_byscore", _objs_byscore },
+        { "around", _around },
+        { "quantile", _quantile },
+        { "quantiles", _quantiles },
+        { "histogram", _histogram },
+        { "range_byrank", _range_byrank },
+        { "range_byscore", _range_byscore },
+        { "revrange_byrank", _revrange_byrank },
+        { "revrange_byscore", _revrange_byscore },
+
+        { "dump", _dump },
+        { "load", _load },
+        { "dump_file", _dump_file },
+        { "load_file", _load_file },
+
+        { "shrink", _shrink },
+        { "memory", _memory },
+        { "publish", _publish },
+
+        { NULL, NULL }
+    };
+
+    lua_createtable(L, 0, 2);
+
+    luaL_newlib(L, l);
+    lua_setfield(L, -2, "__index");
+    lua_pushcfunction(L, _release);
+    lua_setfield(L, -2, "__gc");
+
+    lua_pushcclosure(L, _new, 1);
+    return 1;
+}
@@ -5,10 +5,17 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "lauxlib.h"
 #include "lua.h"
 #include "skiplist.h"
+#include "slindex.h"
+#include "sldump.h"
+#include "slshared.h"
+
+#define DUMP_KIND 1
+#define DUMP_RECSIZE 16
 
 static inline skiplist *
 _to_skiplist(lua_State *L) {
@@ -19,24 +26,241 @@ _to_skiplist(lua_State *L) {
     return *sl;
 }
 
+static inline skiplistNode *
+_node_byobj(lua_State *L, skiplist *sl, lua_Integer obj) {
+    if (sl->index == NULL) {
+        luaL_error(L, "skiplist index not enabled, score is required");
+    }
+    return slGetNodeByObj(sl, obj);
+}
+
+/* Raise when the list reports that the allocator refused, returns any
+ * other status as is */
+static int
+_check_alloc(lua_State *L, int r) {
+    if (r == SL_ENOMEM) {
+        luaL_error(L, "not enough memory");
+    }
+    return r;
+}
+
+struct evict_ctx {
+    int evicted;
+    int64_t obj;
+};
+
+static void
+_evict_cb(void *ud, int64_t obj) {
+    struct evict_ctx *ctx = (struct evict_ctx *)ud;
+    ctx->evicted = 1;
+    ctx->obj = obj;
+}
+
+/* Returns false if a capped list is full and the entry ranks after the
+ * tail, plus the evicted obj when the tail made room for it */
 static int
 _insert(lua_State *L) {
     skiplist *sl = _to_skiplist(L);
     lua_Integer obj = luaL_checkinteger(L, 2);
     double score = luaL_checknumber(L, 3);
-    slInsert(sl, score, obj);
-    return 0;
+    struct evict_ctx ctx = { 0, 0 };
+    lua_pushboolean(L, _check_alloc(L, slInsert(sl, score, obj, _evict_cb, &ctx)));
+    if (!ctx.evicted) {
+        return 1;
+    }
+    lua_pushinteger(L, ctx.obj);
+    return 2;
 }
 
 static int
 _delete(lua_State *L) {
     skiplist *sl = _to_skiplist(L);
     lua_Integer obj = luaL_checkinteger(L, 2);
-    double score = luaL_checknumber(L, 3);
+    double score;
+    if (lua_isnoneornil(L, 3)) {
+        skiplistNode *node = _node_byobj(L, sl, obj);
+        if (node == NULL) {
+            lua_pushboolean(L, 0);
+            return 1;
+        }
+        score = slNodeScore(sl, node);
+    } else {
+        score = luaL_checknumber(L, 3);
+    }
     lua_pushboolean(L, slDelete(sl, score, obj));
     return 1;
 }
 
+static int
+_update(lua_State *L) {
+    skiplist *sl = _to_skiplist(L);
+    lua_Integer obj = luaL_checkinteger(L, 2);
+    double curscore, newscore = luaL_checknumber(L, 4);
+    if (lua_isnoneornil(L, 3)) {
+        skiplistNode *node = _node_byobj(L, sl, obj);
+        if (node == NULL) {
+            lua_pushboolean(L, 0);
+            return 1;
+        }
+        curscore = slNodeScore(sl, node);
+    } else {
+        curscore = luaL_checknumber(L, 3);
+    }
+    lua_pushboolean(L, slUpdateScore(sl, curscore, obj, newscore) != NULL);
+    return 1;
+}
+
+static int
+_incrby(lua_State *L) {
+    skiplist *sl = _to_skiplist(L);
+    lua_Integer obj = luaL_checkinteger(L, 2);
+    double curscore, delta = luaL_checknumber(L, 4);
+    if (lua_isnoneornil(L, 3)) {
+        skiplistNode *node = _node_byobj(L, sl, obj);
+        if (node == NULL) {
+            return 0;
+        }
+        curscore = slNodeScore(sl, node);
+    } else {
+        curscore = luaL_checknumber(L, 3);
+    }
+    skiplistNode *node = slUpdateScore(sl, curscore, obj, curscore + delta);
+    if (node == NULL) {
+        return 0;
+    }
+    lua_pushnumber(L, slNodeScore(sl, node));
+    return 1;
+}
+
+/* Read objs at index 2 and scores at index 3 into a temporary userdata.
+ * Without scores they are looked up through the index and missing objs
+ * are left out, or kept with a zero score that cannot match when keep is
+ * set. */
+static skiplistEntry *
+_check_entries(lua_State *L, skiplist *sl, unsigned long *count, int keep) {
+    luaL_checktype(L, 2, LUA_TTABLE);
+    size_t len = lua_rawlen(L, 2), i;
+    int hasscore = !lua_isnoneornil(L, 3);
+    if (hasscore) {
+        luaL_checktype(L, 3, LUA_TTABLE);
+        if (lua_rawlen(L, 3) != len) {
+            luaL_error(L, "objs and scores must have the same length");
+        }
+    }
+
+    skiplistEntry *entries = lua_newuserdata(L, len * sizeof(skiplistEntry));
+    unsigned long n = 0;
+    for (i = 1; i <= len; i++) {
+        int isnum;
+        lua_rawgeti(L, 2, i);
+        lua_Integer obj = lua_tointegerx(L, -1, &isnum);
+        lua_pop(L, 1);
+        if (!isnum) {
+            luaL_error(L, "objs[%d] must be an integer", (int)i);
+        }
+        entries[n].obj = obj;
+        if (hasscore) {
+            lua_rawgeti(L, 3, i);
+            entries[n].score = lua_tonumberx(L, -1, &isnum);
+            lua_pop(L, 1);
+            if (!isnum) {
+                luaL_error(L, "scores[%d] must be a number", (int)i);
+            }
+        } else {
+            skiplistNode *node = _node_byobj(L, sl, obj);
+            if (node == NULL && !keep) {
+                continue;
+            }
+            entries[n].score = node ? slNodeScore(sl, node) : 0;
+        }
+        n++;
+    }
+    *count = n;
+    return entries;
+}
+
+static int
+_insert_batch(lua_State *L) {
+    skiplist *sl = _to_skiplist(L);
+    unsigned long n;
+    luaL_checktype(L, 3, LUA_TTABLE);
+    skiplistEntry *entries = _check_entries(L, sl, &n, 0);
+    unsigned long stored;
+    _check_alloc(L, slInsertBatch(sl, entries, n, &stored));
+    lua_pushinteger(L, stored);
+    return 1;
+}
+
+/* Ranks of many objs in one merged pass, returned in the order asked,
+ * false for objs that are not in the list */
+static int
+_ranks_of(lua_State *L) {
+    skiplist *sl = _to_skiplist(L);
+    unsigned long n, i;
+    skiplistEntry *entries = _check_entries(L, sl, &n, 1);
+    skiplistEntry **order = lua_newuserdata(L, n * sizeof(*order));
+    unsigned long *ranks = lua_newuserdata(L, n * sizeof(*ranks));
+    slGetRanks(sl, entries, n, order, ranks);
+
+    lua_createtable(L, n, 0);
+    for (i = 0; i < n; i++) {
+        if (ranks[i]) {
+            lua_pushinteger(L, ranks[i]);
+        } else {
+            lua_pushboolean(L, 0);
+        }
+        lua_rawseti(L, -2, i + 1);
+    }
+    return 1;
+}
+
+static int
+_delete_batch(lua_State *L) {
+    skiplist *sl = _to_skiplist(L);
+    unsigned long n;
+    skiplistEntry *entries = _check_entries(L, sl, &n, 0);
+    lua_pushinteger(L, slDeleteBatch(sl, entries, n));
+    return 1;
+}
+
+/* Fill an empty list from objs/scores already in list order in one
+ * linear pass, returns the list itself. */
+static int
+_from_sorted(lua_State *L) {
+    skiplist *sl = _to_skiplist(L);
+    luaL_checktype(L, 2, LUA_TTABLE);
+    luaL_checktype(L, 3, LUA_TTABLE);
+    int deterministic = lua_toboolean(L, 4);
+    size_t len = lua_rawlen(L, 2), i;
+    if (lua_rawlen(L, 3) != len) {
+        luaL_error(L, "objs and scores must have the same length");
+    }
+    if (sl->length != 0) {
+        luaL_error(L, "from_sorted needs an empty skiplist");
+    }
+
+    skiplistBuilder b;
+    slBuildBegin(sl, &b, deterministic);
+    for (i = 1; i <= len; i++) {
+        int isobj, isscore;
+        lua_rawgeti(L, 2, i);
+        lua_rawgeti(L, 3, i);
+        lua_Integer obj = lua_tointegerx(L, -2, &isobj);
+        double score = lua_tonumberx(L, -1, &isscore);
+        lua_pop(L, 2);
+        int r = isobj && isscore ? slBuildAppend(&b, score, obj) : 0;
+        if (r != 1) {
+            slBuildEnd(&b);
+            slClear(sl);
+            _check_alloc(L, r);
+            luaL_error(L, "invalid or unsorted entry at %d", (int)i);
+        }
+    }
+    slBuildEnd(&b);
+    lua_settop(L, 1);
+    return 1;
+}
+
 static void
 _delete_rank_cb(void *ud, int64_t obj) {
     lua_State *L = (lua_State *)ud;
@@ -48,11 +272,11 @@ _delete_rank_cb(void *ud, int64_t obj) {
 static int
 _delete_by_rank(lua_State *L) {
     skiplist *sl = _to_skiplist(L);
-    unsigned int start = luaL_checkinteger(L, 2);
-    unsigned int end = luaL_checkinteger(L, 3);
+    unsigned long start = luaL_checkinteger(L, 2);
+    unsigned long end = luaL_checkinteger(L, 3);
     luaL_checktype(L, 4, LUA_TFUNCTION);
     if (start > end) {
-        unsigned int tmp = start;
+        unsigned long tmp = start;
         start = end;
         end = tmp;
     }
@@ -61,6 +285,40 @@ _delete_by_rank(lua_State *L) {
     return 1;
 }
 
+struct collect_ctx {
+    lua_State *L;
+    lua_Integer n;
+};
+
+static void
+_collect_cb(void *ud, int64_t obj) {
+    struct collect_ctx *ctx = (struct collect_ctx *)ud;
+    lua_pushinteger(ctx->L, obj);
+    lua_rawseti(ctx->L, -2, ++ctx->n);
+}
+
+/* Remove every entry with score in [s1, s2], returns the number removed
+ * and, when collect is set, an array of the removed objs */
+static int
+_delete_byscore(lua_State *L) {
+    skiplist *sl = _to_skiplist(L);
+    double s1 = luaL_checknumber(L, 2);
+    double s2 = luaL_checknumber(L, 3);
+    int collect = lua_toboolean(L, 4);
+
+    if (!collect) {
+        lua_pushinteger(L, slDeleteRangeByScore(sl, s1, s2, NULL, NULL));
+        return 1;
+    }
+    /* presized so rawseti never allocates while nodes are being unlinked */
+    struct collect_ctx ctx = { L, 0 };
+    lua_createtable(L, (int)slCountInRange(sl, s1, s2), 0);
+    slDeleteRangeByScore(sl, s1, s2, _collect_cb, &ctx);
+    lua_pushinteger(L, ctx.n);
+    lua_insert(L, -2);
+    return 2;
+}
+
 static int
 _get_count(lua_State *L) {
     skiplist *sl = _to_skiplist(L);
@@ -72,7 +330,16 @@ static int
 _rank_byobj(lua_State *L) {
     skiplist *sl = _to_skiplist(L);
     lua_Integer obj = luaL_checkinteger(L, 2);
-    double score = luaL_checknumber(L, 3);
+    double score;
+    if (lua_isnoneornil(L, 3)) {
+        skiplistNode *node = _node_byobj(L, sl, obj);
+        if (node == NULL) {
+            return 0;
+        }
+        score = slNodeScore(sl, node);
+    } else {
+        score = luaL_checknumber(L, 3);
+    }
 
     unsigned long rank = slGetRank(sl, score, obj);
     if (rank == 0) {
@@ -83,25 +350,45 @@ _rank_byobj(lua_State *L) {
     return 1;
 }
 
+static int
+_score(lua_State *L) {
+    skiplist *sl = _to_skiplist(L);
+    lua_Integer obj = luaL_checkinteger(L, 2);
+
+    skiplistNode *node = _node_byobj(L, sl, obj);
+    if (node == NULL) {
+        return 0;
+    }
+    lua_pushnumber(L, slNodeScore(sl, node));
+    return 1;
+}
+
 static int
 _ranks_byscore(lua_State *L) {
     skiplist *sl = _to_skiplist(L);
     double s1 = luaL_checknumber(L, 2);
     double s2 = luaL_checknumber(L, 3);
 
-    skiplistNode *node = slFirstInRange(sl, s1, s2);
-    if (node && slCompareScores(sl, node->score, s2) <= 0) {
-        unsigned long start = slGetRank(sl, node->score, node->obj);
-        lua_pushinteger(L, start);
-        int n = 0;
-        while (node && slCompareScores(sl, node->score, s2) <= 0) {
-            n++;
-            node = node->level[0].forward;
-        }
-        lua_pushinteger(L, start + n - 1);
-        return 2;
+    if (!slIsInRange(sl, s1, s2)) {
+        return 0;
     }
-    return 0;
+    unsigned long start = slCountBefore(sl, s1, 0) + 1;
+    unsigned long end = slCountBefore(sl, s2, 1);
+    if (end < start) {
+        return 0;
+    }
+    lua_pushinteger(L, start);
+    lua_pushinteger(L, end);
+    return 2;
+}
+
+static int
+_count_byscore(lua_State *L) {
+    skiplist *sl = _to_skiplist(L);
+    double s1 = luaL_checknumber(L, 2);
+    double s2 = luaL_checknumber(L, 3);
+    lua_pushinteger(L, slCountInRange(sl, s1, s2));
+    return 1;
 }
 
 static int
@@ -129,13 +416,13 @@ _objs_byrank(lua_State *L) {
 
     unsigned long rangelen = r2 - r1 + 1;
     skiplistNode *node = slGetNodeByRank(sl, r1);
-    lua_createtable(L, rangelen, 0);
-    int n = 0;
+    lua_createtable(L, rangelen < sl->length ? rangelen : sl->length, 0);
+    unsigned long n = 0;
     while (node && n < rangelen) {
         n++;
         lua_pushinteger(L, node->obj);
         lua_rawseti(L, -2, n);
-        node = node->level[0].forward;
+        node = slNext(sl, node);
     }
     return 1;
 }
@@ -148,27 +435,538 @@ _objs_byscore(lua_State *L) {
     double s2 = luaL_checknumber(L, 3);
 
     skiplistNode *node = slFirstInRange(sl, s1, s2);
+    uint64_t hi = slScoreKey(sl, s2);
     lua_newtable(L);
-    int n = 0;
-    while (node && slCompareScores(sl, node->score, s2) <= 0) {
+    unsigned long n = 0;
+    while (node && node->key <= hi) {
         n++;
         lua_pushinteger(L, node->obj);
         lua_rawseti(L, -2, n);
-        node = node->level[0].forward;
+        node = slNext(sl, node);
+    }
+    return 1;
+}
+
+/* Push count entries starting at node as an objs array, plus a parallel
+ * scores array when withscores is set. reverse walks the backward links */
+static int
+_push_nodes(lua_State *L, skiplist *sl, skiplistNode *node, unsigned long count, int withscores, int reverse) {
+    unsigned long n = 0, size = count < sl->length ? count : sl->length;
+
+    lua_createtable(L, size, 0);
+    if (withscores) {
+        lua_createtable(L, size, 0);
+    }
+    while (node && n < count) {
+        n++;
+        lua_pushinteger(L, node->obj);
+        lua_rawseti(L, withscores ? -3 : -2, n);
+        if (withscores) {
+            lua_pushnumber(L, slNodeScore(sl, node));
+            lua_rawseti(L, -2, n);
+        }
+        node = reverse ? slPrev(sl, node) : slNext(sl, node);
+    }
+    return withscores ? 2 : 1;
+}
+
+static int
+_push_range(lua_State *L, skiplist *sl, unsigned long rank, unsigned long count, int withscores, int reverse) {
+    return _push_nodes(L, sl, count > 0 ? slGetNodeByRank(sl, rank) : NULL, count, withscores, reverse);
+}
+
+/* Rank of quantile q in list order, nearest rank rounding down */
+static unsigned long
+_quantile_rank(unsigned long length, lua_Number q) {
+    if (q <= 0) {
+        return 1;
+    }
+    if (q >= 1) {
+        return length;
+    }
+    return 1 + (unsigned long)(q * (length - 1));
+}
+
+/* Score and obj at quantile q (0..1) of the list order */
+static int
+_quantile(lua_State *L) {
+    skiplist *sl = _to_skiplist(L);
+    lua_Number q = luaL_checknumber(L, 2);
+    luaL_argcheck(L, q == q, 2, "quantile is NaN");
+    if (sl->length == 0) {
+        return 0;
+    }
+    skiplistNode *node = slGetNodeByRank(sl, _quantile_rank(sl->length, q));
+    lua_pushnumber(L, slNodeScore(sl, node));
+    lua_pushinteger(L, node->obj);
+    return 2;
+}
+
+/* Scores at many ascending quantiles, resolved in one pass */
+static int
+_quantiles(lua_State *L) {
+    skiplist *sl = _to_skiplist(L);
+    luaL_checktype(L, 2, LUA_TTABLE);
+    size_t n = lua_rawlen(L, 2), i;
+    unsigned long *ranks = lua_newuserdata(L, n * sizeof(*ranks));
+    skiplistNode **nodes = lua_newuserdata(L, n * sizeof(*nodes));
+    lua_Number last = 0;
+    for (i = 0; i < n; i++) {
+        lua_rawgeti(L, 2, i + 1);
+        lua_Number q = luaL_checknumber(L, -1);
+        lua_pop(L, 1);
+        luaL_argcheck(L, q == q, 2, "quantile is NaN");
+        if (i > 0 && q < last) {
+            luaL_error(L, "quantiles must be ascending");
+        }
+        last = q;
+        ranks[i] = sl->length ? _quantile_rank(sl->length, q) : 0;
+    }
+    slGetNodesByRank(sl, ranks, n, nodes);
+
+    lua_createtable(L, n, 0);
+    for (i = 0; i < n && sl->length; i++) {
+        lua_pushnumber(L, slNodeScore(sl, nodes[i]));
+        lua_rawseti(L, -2, i + 1);
+    }
+    return 1;
+}
+
+/* Counts per bucket for bounds in list order: before bounds[1], then
+ * [bounds[i], bounds[i+1]) and finally from the last bound on */
+static int
+_histogram(lua_State *L) {
+    skiplist *sl = _to_skiplist(L);
+    luaL_checktype(L, 2, LUA_TTABLE);
+    size_t n = lua_rawlen(L, 2), i;
+    double *bounds = lua_newuserdata(L, n * sizeof(*bounds));
+    unsigned long *counts = lua_newuserdata(L, n * sizeof(*counts));
+    for (i = 0; i < n; i++) {
+        lua_rawgeti(L, 2, i + 1);
+        bounds[i] = luaL_checknumber(L, -1);
+        lua_pop(L, 1);
+        luaL_argcheck(L, bounds[i] == bounds[i], 2, "bound is NaN");
+        if (i > 0 && slCompareScores(sl, bounds[i - 1], bounds[i]) > 0) {
+            luaL_error(L, "bounds must follow the list order");
+        }
+    }
+    slCountBeforeBatch(sl, bounds, n, counts);
+
+    unsigned long prev = 0;
+    lua_createtable(L, n + 1, 0);
+    for (i = 0; i < n; i++) {
+        lua_pushinteger(L, counts[i] - prev);
+        lua_rawseti(L, -2, i + 1);
+        prev = counts[i];
     }
+    lua_pushinteger(L, sl->length - prev);
+    lua_rawseti(L, -2, n + 1);
     return 1;
 }
 
+/* Rank of obj and the window of up to above/below entries around it, found
+ * with one descent and then walked through the links */
+static int
+_around(lua_State *L) {
+    skiplist *sl = _to_skiplist(L);
+    lua_Integer obj = luaL_checkinteger(L, 2);
+    double score;
+    if (lua_isnoneornil(L, 3)) {
+        skiplistNode *node = _node_byobj(L, sl, obj);
+        if (node == NULL) {
+            return 0;
+        }
+        score = slNodeScore(sl, node);
+    } else {
+        score = luaL_checknumber(L, 3);
+    }
+    lua_Integer above = luaL_optinteger(L, 4, 0);
+    lua_Integer below = luaL_optinteger(L, 5, 0);
+    int withscores = lua_toboolean(L, 6);
+    luaL_argcheck(L, above >= 0, 4, "must not be negative");
+    luaL_argcheck(L, below >= 0, 5, "must not be negative");
+
+    unsigned long rank, count = 1 + below;
+    skiplistNode *node = slGetNodeRank(sl, score, obj, &rank);
+    if (node == NULL) {
+        return 0;
+    }
+    while (above-- > 0 && slPrev(sl, node)) {
+        node = slPrev(sl, node);
+        count++;
+    }
+    lua_pushinteger(L, rank);
+    return 1 + _push_nodes(L, sl, node, count, withscores, 0);
+}
+
+static int
+_range_byrank(lua_State *L) {
+    skiplist *sl = _to_skiplist(L);
+    unsigned long r1 = luaL_checkinteger(L, 2);
+    unsigned long r2 = luaL_checkinteger(L, 3);
+    int withscores = lua_toboolean(L, 4);
+
+    if (r1 > r2) {
+        luaL_error(L, "invalid rank range: r1(%lu) > r2(%lu)", r1, r2);
+    }
+    if (r1 < 1) {
+        r1 = 1;
+    }
+    if (r2 > sl->length) {
+        r2 = sl->length;
+    }
+    return _push_range(L, sl, r1, r2 >= r1 ? r2 - r1 + 1 : 0, withscores, 0);
+}
+
+static int
+_range_byscore(lua_State *L) {
+    skiplist *sl = _to_skiplist(L);
+    double s1 = luaL_checknumber(L, 2);
+    double s2 = luaL_checknumber(L, 3);
+    int withscores = lua_toboolean(L, 4);
+    unsigned long start = 1, end = 0;
+
+    if (slIsInRange(sl, s1, s2)) {
+        start = slCountBefore(sl, s1, 0) + 1;
+        end = slCountBefore(sl, s2, 1);
+    }
+    return _push_range(L, sl, start, end >= start ? end - start + 1 : 0, withscores, 0);
+}
+
+/* Ranks are counted from the tail: rank 1 is the last node */
+static int
+_revrange_byrank(lua_State *L) {
+    skiplist *sl = _to_skiplist(L);
+    unsigned long r1 = luaL_checkinteger(L, 2);
+    unsigned long r2 = luaL_checkinteger(L, 3);
+    int withscores = lua_toboolean(L, 4);
+
+    if (r1 > r2) {
+        luaL_error(L, "invalid rank range: r1(%lu) > r2(%lu)", r1, r2);
+    }
+    if (r1 < 1) {
+        r1 = 1;
+    }
+    if (r2 > sl->length) {
+        r2 = sl->length;
+    }
+    if (r2 < r1) {
+        return _push_range(L, sl, 0, 0, withscores, 1);
+    }
+    return _push_range(L, sl, sl->length - r1 + 1, r2 - r1 + 1, withscores, 1);
+}
+
+/* Bounds are given tail first: entries run from s1 back to s2, skipping
+ * offset entries and returning at most count (negative: all) */
+static int
+_revrange_byscore(lua_State *L) {
+    skiplist *sl = _to_skiplist(L);
+    double s1 = luaL_checknumber(L, 2);
+    double s2 = luaL_checknumber(L, 3);
+    int withscores = lua_toboolean(L, 4);
+    lua_Integer offset = luaL_optinteger(L, 5, 0);
+    lua_Integer count = luaL_optinteger(L, 6, -1);
+    unsigned long start = 1, end = 0;
+
+    if (slIsInRange(sl, s2, s1)) {
+        start = slCountBefore(sl, s2, 0) + 1;
+        end = slCountBefore(sl, s1, 1);
+    }
+    if (offset < 0) {
+        luaL_error(L, "invalid offset: %I", offset);
+    }
+    if (end < start || (unsigned long)offset > end - start) {
+        return _push_range(L, sl, 0, 0, withscores, 1);
+    }
+    end -= offset;
+    if (count >= 0 && (unsigned long)count < end - start + 1) {
+        start = end - count + 1;
+    }
+    return _push_range(L, sl, end, end - start + 1, withscores, 1);
+}
+
+static inline void
+_dump_record(char *p, skiplist *sl, skiplistNode *node) {
+    slDumpPutU64(p, (uint64_t)node->obj);
+    slDumpPutDouble(p + 8, slNodeScore(sl, node));
+}
+
+/* Append n packed records to a running build.
+ * Returns NULL or an error message. */
+static const char *
+_load_records(skiplistBuilder *b, const char *p, size_t n) {
+    size_t i;
+    for (i = 0; i < n; i++, p += DUMP_RECSIZE) {
+        int r = slBuildAppend(b, slDumpGetDouble(p + 8), (int64_t)slDumpGetU64(p));
+        if (r == SL_ENOMEM) {
+            return "not enough memory";
+        }
+        if (!r) {
+            return "unsorted or duplicated snapshot record";
+        }
+    }
+    return NULL;
+}
+
+/* Check a snapshot header against the list, returns the record count */
+static uint64_t
+_check_header(lua_State *L, skiplist *sl, const char *head) {
+    int cmp = 0;
+    uint64_t length = 0;
+    if (!slDumpGetHeader(head, DUMP_KIND, &cmp, &length)) {
+        luaL_error(L, "invalid skiplist snapshot");
+    }
+    if (cmp != sl->cmp) {
+        luaL_error(L, "snapshot cmp(%d) does not match skiplist cmp(%d)", cmp, sl->cmp);
+    }
+    return length;
+}
+
+static int
+_dump(lua_State *L) {
+    skiplist *sl = _to_skiplist(L);
+    size_t size = SLDUMP_HEADSIZE + sl->length * DUMP_RECSIZE;
+    luaL_Buffer b;
+    char *p = luaL_buffinitsize(L, &b, size);
+
+    slDumpPutHeader(p, DUMP_KIND, sl->cmp, sl->length);
+    p += SLDUMP_HEADSIZE;
+    skiplistNode *node = slNext(sl, sl->header);
+    for (; node; node = slNext(sl, node), p += DUMP_RECSIZE) {
+        _dump_record(p, sl, node);
+    }
+    luaL_pushresultsize(&b, size);
+    return 1;
+}
+
+/* Replace the content of the list with a snapshot made by dump() */
+static int
+_load(lua_State *L) {
+    skiplist *sl = _to_skiplist(L);
+    size_t size;
+    const char *blob = luaL_checklstring(L, 2, &size);
+    if (size < SLDUMP_HEADSIZE) {
+        luaL_error(L, "invalid skiplist snapshot");
+    }
+    uint64_t length = _check_header(L, sl, blob);
+    if ((size - SLDUMP_HEADSIZE) / DUMP_RECSIZE != length || (size - SLDUMP_HEADSIZE) % DUMP_RECSIZE != 0) {
+        luaL_error(L, "truncated skiplist snapshot");
+    }
+
+    skiplistBuilder b;
+    slClear(sl);
+    slBuildBegin(sl, &b, 0);
+    const char *err = _load_records(&b, blob + SLDUMP_HEADSIZE, length);
+    slBuildEnd(&b);
+    if (err) {
+        slClear(sl);
+        luaL_error(L, "%s", err);
+    }
+    lua_pushinteger(L, sl->length);
+    return 1;
+}
+
+/* Same as dump() but streamed into a file, returns true or nil, err */
+static int
+_dump_file(lua_State *L) {
+    skiplist *sl = _to_skiplist(L);
+    const char *path = luaL_checkstring(L, 2);
+    char *buf = lua_newuserdata(L, SLDUMP_CHUNK * DUMP_RECSIZE);
+    FILE *f = fopen(path, "wb");
+    if (f == NULL) {
+        return luaL_fileresult(L, 0, path);
+    }
+
+    char head[SLDUMP_HEADSIZE];
+    slDumpPutHeader(head, DUMP_KIND, sl->cmp, sl->length);
+    fwrite(head, SLDUMP_HEADSIZE, 1, f);
+    skiplistNode *node = slNext(sl, sl->header);
+    while (node) {
+        size_t n = 0;
+        for (; node && n < SLDUMP_CHUNK; node = slNext(sl, node), n++) {
+            _dump_record(buf + n * DUMP_RECSIZE, sl, node);
+        }
+        fwrite(buf, DUMP_RECSIZE, n, f);
+    }
+    int ok = !ferror(f);
+    if (fclose(f) != 0) {
+        ok = 0;
+    }
+    return luaL_fileresult(L, ok, path);
+}
+
+/* Same as load() but streamed from a file, returns the count or nil, err */
+static int
+_load_file(lua_State *L) {
+    skiplist *sl = _to_skiplist(L);
+    const char *path = luaL_checkstring(L, 2);
+    char *buf = lua_newuserdata(L, SLDUMP_CHUNK * DUMP_RECSIZE);
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        return luaL_fileresult(L, 0, path);
+    }
+
+    int cmp;
+    uint64_t length;
+    char head[SLDUMP_HEADSIZE];
+    if (fread(head, SLDUMP_HEADSIZE, 1, f) != 1 || !slDumpGetHeader(head, DUMP_KIND, &cmp, &length) || cmp != sl->cmp) {
+        fclose(f);
+        lua_pushnil(L);
+        lua_pushfstring(L, "%s: invalid skiplist snapshot or cmp mismatch", path);
+        return 2;
+    }
+
+    skiplistBuilder b;
+    const char *err = NULL;
+    slClear(sl);
+    slBuildBegin(sl, &b, 0);
+    while (length > 0 && err == NULL) {
+        size_t n = length < SLDUMP_CHUNK ? length : SLDUMP_CHUNK;
+        if (fread(buf, DUMP_RECSIZE, n, f) != n) {
+            err = "truncated skiplist snapshot";
+            break;
+        }
+        err = _load_records(&b, buf, n);
+        length -= n;
+    }
+    slBuildEnd(&b);
+    fclose(f);
+    if (err) {
+        slClear(sl);
+        lua_pushnil(L);
+        lua_pushfstring(L, "%s: %s", path, err);
+        return 2;
+    }
+    lua_pushinteger(L, sl->length);
+    return 1;
+}
+
+static int
+_shrink(lua_State *L) {
+    skiplist *sl = _to_skiplist(L);
+    lua_pushinteger(L, slShrink(sl));
+    return 1;
+}
+
+static int
+_memory(lua_State *L) {
+    skiplist *sl = _to_skiplist(L);
+    lua_pushinteger(L, slMemory(sl));
+    lua_pushinteger(L, sl->pool.bytes);
+    lua_pushinteger(L, sl->index ? slIndexMemory(sl->index) : 0);
+    return 3;
+}
+
+/* Copy the list into the shared board name for readers in other
+ * services, see lua-slshared.c. Returns the number of entries published.
+ * Raises, leaving the board as it was, if a list without index holds the
+ * same score/obj twice: the snapshot keeps elements distinct. */
+static int
+_publish(lua_State *L) {
+    skiplist *sl = _to_skiplist(L);
+    const char *name = luaL_checkstring(L, 2);
+    slRetired *t = slSharedPrepare(name);
+    btree *snap;
+    skiplistNode *x;
+    btBuilder b;
+    int r = 1;
+
+    if (t == NULL) {
+        luaL_error(L, "not enough memory");
+    }
+    snap = btCreate(NULL, NULL);
+    if (snap == NULL) {
+        slSharedCancel(t);
+        luaL_error(L, "not enough memory");
+    }
+    snap->cmp = sl->cmp;
+    if (sl->index) {
+        r = btEnableIndex(snap);
+    }
+    btBuildBegin(snap, &b);
+    for (x = slNext(sl, sl->header); x && r == 1; x = slNext(sl, x)) {
+        r = btBuildAppend(&b, slNodeScore(sl, x), x->obj);
+    }
+    if (r == 1) {
+        r = btBuildEnd(&b);
+    }
+    if (r != 1) {
+        btFree(snap);
+        slSharedCancel(t);
+        _check_alloc(L, r);
+        luaL_error(L, "duplicated entry, cannot publish");
+    }
+    lua_pushinteger(L, snap->length);
+    slSharedPublish(t, snap);
+    return 1;
+}
+
+LUAMOD_API int luaopen_skiplist_btree(lua_State *L);
+
+/* opts.engine picks the structure: "skiplist" (default) or "btree", the
+ * latter is built by the btree constructor kept as upvalue 2 */
 static int
 _new(lua_State *L) {
+    if (lua_istable(L, 2)) {
+        lua_getfield(L, 2, "engine");
+        const char *engine = luaL_optstring(L, -1, "skiplist");
+        if (strcmp(engine, "btree") == 0) {
+            lua_pop(L, 1);
+            lua_pushvalue(L, lua_upvalueindex(2));
+            lua_insert(L, 1);
+            lua_call(L, lua_gettop(L) - 1, 1);
+            return 1;
+        }
+        if (strcmp(engine, "skiplist") != 0) {
+            luaL_error(L, "unknown engine: %s", engine);
+        }
+        lua_pop(L, 1);
+    }
     char cmp = luaL_optinteger(L, 1, 0);
-    skiplist *psl = slCreate();
-    psl->cmp = cmp;
+    int index = 0, autoshrink = 0, hasseed = 0;
+    lua_Integer maxlength = 0, seed = 0;
+    if (lua_istable(L, 2)) {
+        lua_getfield(L, 2, "index");
+        index = lua_toboolean(L, -1);
+        lua_pop(L, 1);
+        lua_getfield(L, 2, "autoshrink");
+        autoshrink = lua_toboolean(L, -1);
+        lua_pop(L, 1);
+        lua_getfield(L, 2, "max_length");
+        maxlength = luaL_optinteger(L, -1, 0);
+        lua_pop(L, 1);
+        luaL_argcheck(L, maxlength >= 0, 2, "max_length must not be negative");
+        lua_getfield(L, 2, "seed");
+        if (!lua_isnil(L, -1)) {
+            seed = luaL_checkinteger(L, -1);
+            hasseed = 1;
+        }
+        lua_pop(L, 1);
+    }
 
+    /* the userdata comes before the list so that nothing raising later
+     * can leak it, __gc skips the NULL left if the list is not made */
     skiplist **sl = (skiplist **)lua_newuserdata(L, sizeof(skiplist *));
-    *sl = psl;
+    *sl = NULL;
     lua_pushvalue(L, lua_upvalueindex(1));
     lua_setmetatable(L, -2);
+
+    void *ud;
+    lua_Alloc allocf = lua_getallocf(L, &ud);
+    skiplist *psl = slCreate(allocf, ud);
+    if (psl == NULL) {
+        luaL_error(L, "not enough memory");
+    }
+    *sl = psl;
+    psl->cmp = cmp;
+    psl->autoshrink = autoshrink;
+    psl->maxlength = maxlength;
+    if (index) {
+        _check_alloc(L, slEnableIndex(psl));
+    }
+    if (hasseed) {
+        slSetSeed(psl, seed);
+    }
     return 1;
 }
 
@@ -176,7 +974,9 @@ static int
 _release(lua_State *L) {
     skiplist *sl = _to_skiplist(L);
     //printf("collect sl:%p\n", sl);
-    slFree(sl);
+    if (sl) {
+        slFree(sl);
+    }
     return 0;
 }
 
@@ -187,14 +987,41 @@ luaopen_skiplist_c(lua_State *L) {
     luaL_Reg l[] = {
         { "insert", _insert },
         { "delete", _delete },
+        { "update", _update },
+        { "incrby", _incrby },
         { "delete_byrank", _delete_by_rank },
+        { "delete_byscore", _delete_byscore },
+        { "insert_batch", _insert_batch },
+        { "delete_batch", _delete_batch },
+        { "from_sorted", _from_sorted },
 
         { "get_count", _get_count },
         { "rank_byobj", _rank_byobj },
+        { "rank", _rank_byobj },
+        { "ranks_of", _ranks_of },
+        { "score", _score },
         { "ranks_byscore", _ranks_byscore },
+        { "count_byscore", _count_byscore },
         { "obj_byrank", _obj_byrank },
         { "objs_byrank", _objs_byrank },
         { "objs_byscore", _objs_byscore },
+        { "around", _around },
+        { "quantile", _quantile },
+        { "quantiles", _quantiles },
+        { "histogram", _histogram },
+        { "range_byrank", _range_byrank },
+        { "range_byscore", _range_byscore },
+        { "revrange_byrank", _revrange_byrank },
+        { "revrange_byscore", _revrange_byscore },
+
+        { "dump", _dump },
+        { "load", _load },
+        { "dump_file", _dump_file },
+        { "load_file", _load_file },
+
+        { "shrink", _shrink },
+        { "memory", _memory },
+        { "publish", _publish },
 
         { NULL, NULL }
     };
@@ -206,6 +1033,7 @@ luaopen_skiplist_c(lua_State *L) {
     lua_pushcfunction(L, _release);
     lua_setfield(L, -2, "__gc");
 
-    lua_pushcclosure(L, _new, 1);
+    luaopen_skiplist_btree(L);
+    lua_pushcclosure(L, _new, 2);
     return 1;
 }
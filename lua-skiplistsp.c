@@ -5,10 +5,28 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "lauxlib.h"
 #include "lua.h"
 #include "skiplistsp.h"
+#include "slindex.h"
+#include "sldump.h"
+
+/* kind is the component count, except that one component would read as
+ * the double version's kind */
+#define DUMP_KIND(sl) ((sl)->nkey == 1 ? 0x41 : (sl)->nkey)
+#define DUMP_RECSIZE(sl) (8 + 8 * (sl)->nkey)
+
+/* One bit per component direction */
+static inline int
+DUMP_CMP(struct skiplist_sp *sl) {
+    int cmp = 0, j;
+    for (j = 0; j < sl->nkey; j++) {
+        cmp |= sl->cmp[j] << j;
+    }
+    return cmp;
+}
 
 static inline struct skiplist_sp *
 _to_skiplist(lua_State *L) {
@@ -19,28 +37,296 @@ _to_skiplist(lua_State *L) {
     return *sl;
 }
 
+static inline struct skiplistNode_sp *
+_node_byobj(lua_State *L, struct skiplist_sp *sl, lua_Integer obj) {
+    if (sl->index == NULL) {
+        luaL_error(L, "skiplist index not enabled, score is required");
+    }
+    return sp_slGetNodeByObj(sl, obj);
+}
+
+/* Keys are passed as nkey consecutive integer arguments */
+static inline void
+_check_key(lua_State *L, struct skiplist_sp *sl, int idx, int64_t *key) {
+    int j;
+    for (j = 0; j < sl->nkey; j++) {
+        key[j] = luaL_checkinteger(L, idx + j);
+    }
+}
+
+/* Key at idx, looked up through the index when it is nil.
+ * Returns 0 if obj is not in the list. */
+static int
+_opt_key(lua_State *L, struct skiplist_sp *sl, lua_Integer obj, int idx, int64_t *key) {
+    if (!lua_isnoneornil(L, idx)) {
+        _check_key(L, sl, idx, key);
+        return 1;
+    }
+    struct skiplistNode_sp *node = _node_byobj(L, sl, obj);
+    if (node == NULL) {
+        return 0;
+    }
+    sp_slNodeScores(sl, node, key);
+    return 1;
+}
+
+static inline void
+_push_scores(lua_State *L, struct skiplist_sp *sl, struct skiplistNode_sp *node) {
+    int j;
+    for (j = 0; j < sl->nkey; j++) {
+        lua_pushinteger(L, sp_slNodeScore(sl, node, j));
+    }
+}
+
+/* Read the component arrays at idx.. into n keys laid out back to back */
+static int64_t *
+_check_keys(lua_State *L, struct skiplist_sp *sl, int idx, size_t n) {
+    int64_t *keys = lua_newuserdata(L, n * sl->nkey * sizeof(*keys));
+    size_t i;
+    int j;
+    for (j = 0; j < sl->nkey; j++) {
+        luaL_checktype(L, idx + j, LUA_TTABLE);
+        if (lua_rawlen(L, idx + j) != n) {
+            luaL_error(L, "score arrays must have the same length");
+        }
+        for (i = 0; i < n; i++) {
+            lua_rawgeti(L, idx + j, i + 1);
+            keys[i * sl->nkey + j] = luaL_checkinteger(L, -1);
+            lua_pop(L, 1);
+        }
+    }
+    return keys;
+}
+
+/* Raise when the list reports that the allocator refused, returns any
+ * other status as is */
+static int
+_check_alloc(lua_State *L, int r) {
+    if (r == SL_ENOMEM) {
+        luaL_error(L, "not enough memory");
+    }
+    return r;
+}
+
+struct evict_ctx {
+    int evicted;
+    int64_t obj;
+};
+
+static void
+_evict_cb(void *ud, int64_t obj) {
+    struct evict_ctx *ctx = (struct evict_ctx *)ud;
+    ctx->evicted = 1;
+    ctx->obj = obj;
+}
+
+/* Returns false if a capped list is full and the entry ranks after the
+ * tail, plus the evicted obj when the tail made room for it */
 static int
 _insert(lua_State *L) {
     struct skiplist_sp *sl = _to_skiplist(L);
     lua_Integer obj = luaL_checkinteger(L, 2);
-    int64_t score[2];
-    score[0] = luaL_checkinteger(L, 3);
-    score[1] = luaL_checkinteger(L, 4);
-    sp_slInsert(sl, score, obj);
-    return 0;
+    int64_t score[SKIPLIST_SP_MAXKEY];
+    _check_key(L, sl, 3, score);
+    struct evict_ctx ctx = { 0, 0 };
+    lua_pushboolean(L, _check_alloc(L, sp_slInsert(sl, score, obj, _evict_cb, &ctx)));
+    if (!ctx.evicted) {
+        return 1;
+    }
+    lua_pushinteger(L, ctx.obj);
+    return 2;
 }
 
 static int
 _delete(lua_State *L) {
     struct skiplist_sp *sl = _to_skiplist(L);
     lua_Integer obj = luaL_checkinteger(L, 2);
-    int64_t score[2];
-    score[0] = luaL_checkinteger(L, 3);
-    score[1] = luaL_checkinteger(L, 4);
+    int64_t score[SKIPLIST_SP_MAXKEY];
+    if (!_opt_key(L, sl, obj, 3, score)) {
+        lua_pushboolean(L, 0);
+        return 1;
+    }
     lua_pushboolean(L, sp_slDelete(sl, score, obj));
     return 1;
 }
 
+static int
+_update(lua_State *L) {
+    struct skiplist_sp *sl = _to_skiplist(L);
+    lua_Integer obj = luaL_checkinteger(L, 2);
+    int64_t curscore[SKIPLIST_SP_MAXKEY], newscore[SKIPLIST_SP_MAXKEY];
+    _check_key(L, sl, 3 + sl->nkey, newscore);
+    if (!_opt_key(L, sl, obj, 3, curscore)) {
+        lua_pushboolean(L, 0);
+        return 1;
+    }
+    lua_pushboolean(L, sp_slUpdateScore(sl, curscore, obj, newscore) != NULL);
+    return 1;
+}
+
+static int
+_incrby(lua_State *L) {
+    struct skiplist_sp *sl = _to_skiplist(L);
+    lua_Integer obj = luaL_checkinteger(L, 2);
+    int64_t curscore[SKIPLIST_SP_MAXKEY], newscore[SKIPLIST_SP_MAXKEY];
+    int j;
+    if (!_opt_key(L, sl, obj, 3, curscore)) {
+        return 0;
+    }
+    for (j = 0; j < sl->nkey; j++) {
+        newscore[j] = curscore[j] + luaL_optinteger(L, 3 + sl->nkey + j, 0);
+    }
+    struct skiplistNode_sp *node = sp_slUpdateScore(sl, curscore, obj, newscore);
+    if (node == NULL) {
+        return 0;
+    }
+    _push_scores(L, sl, node);
+    return sl->nkey;
+}
+
+/* Read objs at index 2 and the score component arrays from index 3 on into
+ * a temporary userdata. Without scores they are looked up through the index
+ * and missing objs are left out, or kept with a zero score that cannot
+ * match when keep is set. */
+static struct skiplistEntry_sp *
+_check_entries(lua_State *L, struct skiplist_sp *sl, unsigned long *count, int keep) {
+    luaL_checktype(L, 2, LUA_TTABLE);
+    size_t len = lua_rawlen(L, 2), i;
+    int hasscore = !lua_isnoneornil(L, 3);
+    int j;
+    if (hasscore) {
+        for (j = 0; j < sl->nkey; j++) {
+            luaL_checktype(L, 3 + j, LUA_TTABLE);
+            if (lua_rawlen(L, 3 + j) != len) {
+                luaL_error(L, "objs and scores must have the same length");
+            }
+        }
+    }
+
+    struct skiplistEntry_sp *entries = lua_newuserdata(L, len * sizeof(struct skiplistEntry_sp));
+    unsigned long n = 0;
+    for (i = 1; i <= len; i++) {
+        int isnum;
+        lua_rawgeti(L, 2, i);
+        lua_Integer obj = lua_tointegerx(L, -1, &isnum);
+        lua_pop(L, 1);
+        if (!isnum) {
+            luaL_error(L, "objs[%d] must be an integer", (int)i);
+        }
+        memset(&entries[n], 0, sizeof(entries[n]));
+        entries[n].obj = obj;
+        if (hasscore) {
+            for (j = 0; j < sl->nkey; j++) {
+                lua_rawgeti(L, 3 + j, i);
+                entries[n].score[j] = lua_tointegerx(L, -1, &isnum);
+                lua_pop(L, 1);
+                if (!isnum) {
+                    luaL_error(L, "scores%d[%d] must be an integer", j, (int)i);
+                }
+            }
+        } else {
+            struct skiplistNode_sp *node = _node_byobj(L, sl, obj);
+            if (node == NULL && !keep) {
+                continue;
+            }
+            if (node) {
+                sp_slNodeScores(sl, node, entries[n].score);
+            }
+        }
+        n++;
+    }
+    *count = n;
+    return entries;
+}
+
+static int
+_insert_batch(lua_State *L) {
+    struct skiplist_sp *sl = _to_skiplist(L);
+    unsigned long n;
+    luaL_checktype(L, 3, LUA_TTABLE);
+    struct skiplistEntry_sp *entries = _check_entries(L, sl, &n, 0);
+    unsigned long stored;
+    _check_alloc(L, sp_slInsertBatch(sl, entries, n, &stored));
+    lua_pushinteger(L, stored);
+    return 1;
+}
+
+/* Ranks of many objs in one merged pass, returned in the order asked,
+ * false for objs that are not in the list */
+static int
+_ranks_of(lua_State *L) {
+    struct skiplist_sp *sl = _to_skiplist(L);
+    unsigned long n, i;
+    struct skiplistEntry_sp *entries = _check_entries(L, sl, &n, 1);
+    struct skiplistEntry_sp **order = lua_newuserdata(L, n * sizeof(*order));
+    unsigned long *ranks = lua_newuserdata(L, n * sizeof(*ranks));
+    sp_slGetRanks(sl, entries, n, order, ranks);
+
+    lua_createtable(L, n, 0);
+    for (i = 0; i < n; i++) {
+        if (ranks[i]) {
+            lua_pushinteger(L, ranks[i]);
+        } else {
+            lua_pushboolean(L, 0);
+        }
+        lua_rawseti(L, -2, i + 1);
+    }
+    return 1;
+}
+
+static int
+_delete_batch(lua_State *L) {
+    struct skiplist_sp *sl = _to_skiplist(L);
+    unsigned long n;
+    struct skiplistEntry_sp *entries = _check_entries(L, sl, &n, 0);
+    lua_pushinteger(L, sp_slDeleteBatch(sl, entries, n));
+    return 1;
+}
+
+static int
+_from_sorted(lua_State *L) {
+    struct skiplist_sp *sl = _to_skiplist(L);
+    luaL_checktype(L, 2, LUA_TTABLE);
+    int deterministic = lua_toboolean(L, 3 + sl->nkey);
+    size_t len = lua_rawlen(L, 2), i;
+    int j;
+    for (j = 0; j < sl->nkey; j++) {
+        luaL_checktype(L, 3 + j, LUA_TTABLE);
+        if (lua_rawlen(L, 3 + j) != len) {
+            luaL_error(L, "objs and scores must have the same length");
+        }
+    }
+    if (sl->length != 0) {
+        luaL_error(L, "from_sorted needs an empty skiplist");
+    }
+
+    struct skiplistBuilder_sp b;
+    sp_slBuildBegin(sl, &b, deterministic);
+    for (i = 1; i <= len; i++) {
+        int isobj, isnum = 1, is;
+        int64_t score[SKIPLIST_SP_MAXKEY];
+        lua_rawgeti(L, 2, i);
+        lua_Integer obj = lua_tointegerx(L, -1, &isobj);
+        lua_pop(L, 1);
+        for (j = 0; j < sl->nkey; j++) {
+            lua_rawgeti(L, 3 + j, i);
+            score[j] = lua_tointegerx(L, -1, &is);
+            lua_pop(L, 1);
+            isnum = isnum && is;
+        }
+        int r = isobj && isnum ? sp_slBuildAppend(&b, score, obj) : 0;
+        if (r != 1) {
+            sp_slBuildEnd(&b);
+            sp_slClear(sl);
+            _check_alloc(L, r);
+            luaL_error(L, "invalid or unsorted entry at %d", (int)i);
+        }
+    }
+    sp_slBuildEnd(&b);
+    lua_settop(L, 1);
+    return 1;
+}
+
 static void
 _delete_rank_cb(void *ud, int64_t obj) {
     lua_State *L = (lua_State *)ud;
@@ -52,11 +338,11 @@ _delete_rank_cb(void *ud, int64_t obj) {
 static int
 _delete_byrank(lua_State *L) {
     struct skiplist_sp *sl = _to_skiplist(L);
-    unsigned int start = luaL_checkinteger(L, 2);
-    unsigned int end = luaL_checkinteger(L, 3);
+    unsigned long start = luaL_checkinteger(L, 2);
+    unsigned long end = luaL_checkinteger(L, 3);
     luaL_checktype(L, 4, LUA_TFUNCTION);
     if (start > end) {
-        unsigned int tmp = start;
+        unsigned long tmp = start;
         start = end;
         end = tmp;
     }
@@ -65,6 +351,41 @@ _delete_byrank(lua_State *L) {
     return 1;
 }
 
+struct collect_ctx {
+    lua_State *L;
+    lua_Integer n;
+};
+
+static void
+_collect_cb(void *ud, int64_t obj) {
+    struct collect_ctx *ctx = (struct collect_ctx *)ud;
+    lua_pushinteger(ctx->L, obj);
+    lua_rawseti(ctx->L, -2, ++ctx->n);
+}
+
+/* Remove every entry with score in [s1, s2], returns the number removed
+ * and, when collect is set, an array of the removed objs */
+static int
+_delete_byscore(lua_State *L) {
+    struct skiplist_sp *sl = _to_skiplist(L);
+    int64_t s1[SKIPLIST_SP_MAXKEY], s2[SKIPLIST_SP_MAXKEY];
+    _check_key(L, sl, 2, s1);
+    _check_key(L, sl, 2 + sl->nkey, s2);
+    int collect = lua_toboolean(L, 2 + 2 * sl->nkey);
+
+    if (!collect) {
+        lua_pushinteger(L, sp_slDeleteRangeByScore(sl, s1, s2, NULL, NULL));
+        return 1;
+    }
+    /* presized so rawseti never allocates while nodes are being unlinked */
+    struct collect_ctx ctx = { L, 0 };
+    lua_createtable(L, (int)sp_slCountInRange(sl, s1, s2), 0);
+    sp_slDeleteRangeByScore(sl, s1, s2, _collect_cb, &ctx);
+    lua_pushinteger(L, ctx.n);
+    lua_insert(L, -2);
+    return 2;
+}
+
 static int
 _get_count(lua_State *L) {
     struct skiplist_sp *sl = _to_skiplist(L);
@@ -76,9 +397,10 @@ static int
 _rank_byobj(lua_State *L) {
     struct skiplist_sp *sl = _to_skiplist(L);
     lua_Integer obj = luaL_checkinteger(L, 2);
-    int64_t score[2];
-    score[0] = luaL_checkinteger(L, 3);
-    score[1] = luaL_checkinteger(L, 4);
+    int64_t score[SKIPLIST_SP_MAXKEY];
+    if (!_opt_key(L, sl, obj, 3, score)) {
+        return 0;
+    }
 
     unsigned long rank = sp_slGetRank(sl, score, obj);
     if (rank == 0) {
@@ -89,6 +411,19 @@ _rank_byobj(lua_State *L) {
     return 1;
 }
 
+static int
+_score(lua_State *L) {
+    struct skiplist_sp *sl = _to_skiplist(L);
+    lua_Integer obj = luaL_checkinteger(L, 2);
+
+    struct skiplistNode_sp *node = _node_byobj(L, sl, obj);
+    if (node == NULL) {
+        return 0;
+    }
+    _push_scores(L, sl, node);
+    return sl->nkey;
+}
+
 static int
 _objs_byrank(lua_State *L) {
     struct skiplist_sp *sl = _to_skiplist(L);
@@ -101,13 +436,13 @@ _objs_byrank(lua_State *L) {
 
     unsigned long rangelen = r2 - r1 + 1;
     struct skiplistNode_sp *node = sp_slGetNodeByRank(sl, r1);
-    lua_createtable(L, rangelen, 0);
-    int n = 0;
+    lua_createtable(L, rangelen < sl->length ? rangelen : sl->length, 0);
+    unsigned long n = 0;
     while (node && n < rangelen) {
         n++;
         lua_pushinteger(L, node->obj);
         lua_rawseti(L, -2, n);
-        node = node->level[0].forward;
+        node = sp_slNext(sl, node);
     }
     return 1;
 }
@@ -128,20 +463,20 @@ _obj_byrank(lua_State *L) {
 static int
 _objs_byscore(lua_State *L) {
     struct skiplist_sp *sl = _to_skiplist(L);
-    int64_t s1[2], s2[2];
-    s1[0] = luaL_checkinteger(L, 2);
-    s1[1] = luaL_checkinteger(L, 3);
-    s2[0] = luaL_checkinteger(L, 4);
-    s2[1] = luaL_checkinteger(L, 5);
+    int64_t s1[SKIPLIST_SP_MAXKEY], s2[SKIPLIST_SP_MAXKEY];
+    _check_key(L, sl, 2, s1);
+    _check_key(L, sl, 2 + sl->nkey, s2);
 
     struct skiplistNode_sp *node = sp_slFirstInRange(sl, s1, s2);
+    uint64_t hi[SKIPLIST_SP_MAXKEY];
+    sp_slScoreKey(sl, s2, hi);
     lua_newtable(L);
-    int n = 0;
-    while (node && sp_compareScores(sl, node->score, s2) <= 0) {
+    unsigned long n = 0;
+    while (node && sp_slKeyCmp(sl, sp_slKey(sl, node), hi) <= 0) {
         n++;
         lua_pushinteger(L, node->obj);
         lua_rawseti(L, -2, n);
-        node = node->level[0].forward;
+        node = sp_slNext(sl, node);
     }
     return 1;
 }
@@ -149,37 +484,524 @@ _objs_byscore(lua_State *L) {
 static int
 _ranks_byscore(lua_State *L) {
     struct skiplist_sp *sl = _to_skiplist(L);
-    int64_t s1[2], s2[2];
-    s1[0] = luaL_checkinteger(L, 2);
-    s1[1] = luaL_checkinteger(L, 3);
-    s2[0] = luaL_checkinteger(L, 4);
-    s2[1] = luaL_checkinteger(L, 5);
+    int64_t s1[SKIPLIST_SP_MAXKEY], s2[SKIPLIST_SP_MAXKEY];
+    _check_key(L, sl, 2, s1);
+    _check_key(L, sl, 2 + sl->nkey, s2);
 
-    struct skiplistNode_sp *node = sp_slFirstInRange(sl, s1, s2);
-    if (node && sp_compareScores(sl, node->score, s2) <= 0) {
-        unsigned long start = sp_slGetRank(sl, node->score, node->obj);
-        lua_pushinteger(L, start);
-        int n = 0;
-        while (node && sp_compareScores(sl, node->score, s2) <= 0) {
-            n++;
-            node = node->level[0].forward;
-        }
-        lua_pushinteger(L, start + n - 1);
+    if (!sp_slIsInRange(sl, s1, s2)) {
+        return 0;
+    }
+    unsigned long start = sp_slCountBefore(sl, s1, 0) + 1;
+    unsigned long end = sp_slCountBefore(sl, s2, 1);
+    if (end < start) {
+        return 0;
+    }
+    lua_pushinteger(L, start);
+    lua_pushinteger(L, end);
+    return 2;
+}
+
+static int
+_count_byscore(lua_State *L) {
+    struct skiplist_sp *sl = _to_skiplist(L);
+    int64_t s1[SKIPLIST_SP_MAXKEY], s2[SKIPLIST_SP_MAXKEY];
+    _check_key(L, sl, 2, s1);
+    _check_key(L, sl, 2 + sl->nkey, s2);
+    lua_pushinteger(L, sp_slCountInRange(sl, s1, s2));
+    return 1;
+}
+
+/* Push count entries starting at node as an objs array, plus one array
+ * per score component when withscores is set.
+ * reverse walks the backward links */
+static int
+_push_nodes(lua_State *L, struct skiplist_sp *sl, struct skiplistNode_sp *node, unsigned long count, int withscores, int reverse) {
+    int ncols = withscores ? 1 + sl->nkey : 1, j;
+    unsigned long n = 0, size = count < sl->length ? count : sl->length;
+
+    for (j = 0; j < ncols; j++) {
+        lua_createtable(L, size, 0);
+    }
+    while (node && n < count) {
+        n++;
+        lua_pushinteger(L, node->obj);
+        lua_rawseti(L, -1 - ncols, n);
+        for (j = 1; j < ncols; j++) {
+            lua_pushinteger(L, sp_slNodeScore(sl, node, j - 1));
+            lua_rawseti(L, -1 - ncols + j, n);
+        }
+        node = reverse ? sp_slPrev(sl, node) : sp_slNext(sl, node);
+    }
+    return ncols;
+}
+
+static int
+_push_range(lua_State *L, struct skiplist_sp *sl, unsigned long rank, unsigned long count, int withscores, int reverse) {
+    return _push_nodes(L, sl, count > 0 ? sp_slGetNodeByRank(sl, rank) : NULL, count, withscores, reverse);
+}
+
+/* Rank of quantile q in list order, nearest rank rounding down */
+static unsigned long
+_quantile_rank(unsigned long length, lua_Number q) {
+    if (q <= 0) {
+        return 1;
+    }
+    if (q >= 1) {
+        return length;
+    }
+    return 1 + (unsigned long)(q * (length - 1));
+}
+
+/* Score components and obj at quantile q (0..1) of the list order */
+static int
+_quantile(lua_State *L) {
+    struct skiplist_sp *sl = _to_skiplist(L);
+    lua_Number q = luaL_checknumber(L, 2);
+    luaL_argcheck(L, q == q, 2, "quantile is NaN");
+    if (sl->length == 0) {
+        return 0;
+    }
+    struct skiplistNode_sp *node = sp_slGetNodeByRank(sl, _quantile_rank(sl->length, q));
+    _push_scores(L, sl, node);
+    lua_pushinteger(L, node->obj);
+    return sl->nkey + 1;
+}
+
+/* Score components at many ascending quantiles, resolved in one pass */
+static int
+_quantiles(lua_State *L) {
+    struct skiplist_sp *sl = _to_skiplist(L);
+    luaL_checktype(L, 2, LUA_TTABLE);
+    size_t n = lua_rawlen(L, 2), i;
+    unsigned long *ranks = lua_newuserdata(L, n * sizeof(*ranks));
+    struct skiplistNode_sp **nodes = lua_newuserdata(L, n * sizeof(*nodes));
+    lua_Number last = 0;
+    for (i = 0; i < n; i++) {
+        lua_rawgeti(L, 2, i + 1);
+        lua_Number q = luaL_checknumber(L, -1);
+        lua_pop(L, 1);
+        luaL_argcheck(L, q == q, 2, "quantile is NaN");
+        if (i > 0 && q < last) {
+            luaL_error(L, "quantiles must be ascending");
+        }
+        last = q;
+        ranks[i] = sl->length ? _quantile_rank(sl->length, q) : 0;
+    }
+    sp_slGetNodesByRank(sl, ranks, n, nodes);
+
+    int j;
+    for (j = 0; j < sl->nkey; j++) {
+        lua_createtable(L, n, 0);
+        for (i = 0; i < n && sl->length; i++) {
+            lua_pushinteger(L, sp_slNodeScore(sl, nodes[i], j));
+            lua_rawseti(L, -2, i + 1);
+        }
+    }
+    return sl->nkey;
+}
+
+/* Counts per bucket for bounds (one array per component) in list order:
+ * before the first bound, between consecutive bounds, then the rest */
+static int
+_histogram(lua_State *L) {
+    struct skiplist_sp *sl = _to_skiplist(L);
+    luaL_checktype(L, 2, LUA_TTABLE);
+    size_t n = lua_rawlen(L, 2), i;
+    int64_t *bounds = _check_keys(L, sl, 2, n);
+    unsigned long *counts = lua_newuserdata(L, n * sizeof(*counts));
+    for (i = 1; i < n; i++) {
+        if (sp_compareScores(sl, bounds + (i - 1) * sl->nkey, bounds + i * sl->nkey) > 0) {
+            luaL_error(L, "bounds must follow the list order");
+        }
+    }
+    sp_slCountBeforeBatch(sl, bounds, n, counts);
+
+    unsigned long prev = 0;
+    lua_createtable(L, n + 1, 0);
+    for (i = 0; i < n; i++) {
+        lua_pushinteger(L, counts[i] - prev);
+        lua_rawseti(L, -2, i + 1);
+        prev = counts[i];
+    }
+    lua_pushinteger(L, sl->length - prev);
+    lua_rawseti(L, -2, n + 1);
+    return 1;
+}
+
+/* Rank of obj and the window of up to above/below entries around it, found
+ * with one descent and then walked through the links */
+static int
+_around(lua_State *L) {
+    struct skiplist_sp *sl = _to_skiplist(L);
+    lua_Integer obj = luaL_checkinteger(L, 2);
+    int64_t score[SKIPLIST_SP_MAXKEY];
+    int idx = 3 + sl->nkey;
+    if (!_opt_key(L, sl, obj, 3, score)) {
+        return 0;
+    }
+    lua_Integer above = luaL_optinteger(L, idx, 0);
+    lua_Integer below = luaL_optinteger(L, idx + 1, 0);
+    int withscores = lua_toboolean(L, idx + 2);
+    luaL_argcheck(L, above >= 0, idx, "must not be negative");
+    luaL_argcheck(L, below >= 0, idx + 1, "must not be negative");
+
+    unsigned long rank, count = 1 + below;
+    struct skiplistNode_sp *node = sp_slGetNodeRank(sl, score, obj, &rank);
+    if (node == NULL) {
+        return 0;
+    }
+    while (above-- > 0 && sp_slPrev(sl, node)) {
+        node = sp_slPrev(sl, node);
+        count++;
+    }
+    lua_pushinteger(L, rank);
+    return 1 + _push_nodes(L, sl, node, count, withscores, 0);
+}
+
+static int
+_range_byrank(lua_State *L) {
+    struct skiplist_sp *sl = _to_skiplist(L);
+    unsigned long r1 = luaL_checkinteger(L, 2);
+    unsigned long r2 = luaL_checkinteger(L, 3);
+    int withscores = lua_toboolean(L, 4);
+
+    if (r1 > r2) {
+        luaL_error(L, "invalid rank range: r1(%lu) > r2(%lu)", r1, r2);
+    }
+    if (r1 < 1) {
+        r1 = 1;
+    }
+    if (r2 > sl->length) {
+        r2 = sl->length;
+    }
+    return _push_range(L, sl, r1, r2 >= r1 ? r2 - r1 + 1 : 0, withscores, 0);
+}
+
+static int
+_range_byscore(lua_State *L) {
+    struct skiplist_sp *sl = _to_skiplist(L);
+    int64_t s1[SKIPLIST_SP_MAXKEY], s2[SKIPLIST_SP_MAXKEY];
+    _check_key(L, sl, 2, s1);
+    _check_key(L, sl, 2 + sl->nkey, s2);
+    int withscores = lua_toboolean(L, 2 + 2 * sl->nkey);
+    unsigned long start = 1, end = 0;
+
+    if (sp_slIsInRange(sl, s1, s2)) {
+        start = sp_slCountBefore(sl, s1, 0) + 1;
+        end = sp_slCountBefore(sl, s2, 1);
+    }
+    return _push_range(L, sl, start, end >= start ? end - start + 1 : 0, withscores, 0);
+}
+
+/* Ranks are counted from the tail: rank 1 is the last node */
+static int
+_revrange_byrank(lua_State *L) {
+    struct skiplist_sp *sl = _to_skiplist(L);
+    unsigned long r1 = luaL_checkinteger(L, 2);
+    unsigned long r2 = luaL_checkinteger(L, 3);
+    int withscores = lua_toboolean(L, 4);
+
+    if (r1 > r2) {
+        luaL_error(L, "invalid rank range: r1(%lu) > r2(%lu)", r1, r2);
+    }
+    if (r1 < 1) {
+        r1 = 1;
+    }
+    if (r2 > sl->length) {
+        r2 = sl->length;
+    }
+    if (r2 < r1) {
+        return _push_range(L, sl, 0, 0, withscores, 1);
+    }
+    return _push_range(L, sl, sl->length - r1 + 1, r2 - r1 + 1, withscores, 1);
+}
+
+/* Bounds are given tail first: entries run from s1 back to s2, skipping
+ * offset entries and returning at most count (negative: all) */
+static int
+_revrange_byscore(lua_State *L) {
+    struct skiplist_sp *sl = _to_skiplist(L);
+    int64_t s1[SKIPLIST_SP_MAXKEY], s2[SKIPLIST_SP_MAXKEY];
+    _check_key(L, sl, 2, s1);
+    _check_key(L, sl, 2 + sl->nkey, s2);
+    int idx = 2 + 2 * sl->nkey;
+    int withscores = lua_toboolean(L, idx);
+    lua_Integer offset = luaL_optinteger(L, idx + 1, 0);
+    lua_Integer count = luaL_optinteger(L, idx + 2, -1);
+    unsigned long start = 1, end = 0;
+
+    if (sp_slIsInRange(sl, s2, s1)) {
+        start = sp_slCountBefore(sl, s2, 0) + 1;
+        end = sp_slCountBefore(sl, s1, 1);
+    }
+    if (offset < 0) {
+        luaL_error(L, "invalid offset: %I", offset);
+    }
+    if (end < start || (unsigned long)offset > end - start) {
+        return _push_range(L, sl, 0, 0, withscores, 1);
+    }
+    end -= offset;
+    if (count >= 0 && (unsigned long)count < end - start + 1) {
+        start = end - count + 1;
+    }
+    return _push_range(L, sl, end, end - start + 1, withscores, 1);
+}
+
+static inline void
+_dump_record(char *p, struct skiplist_sp *sl, struct skiplistNode_sp *node) {
+    int j;
+    slDumpPutU64(p, (uint64_t)node->obj);
+    for (j = 0; j < sl->nkey; j++) {
+        slDumpPutU64(p + 8 + 8 * j, (uint64_t)sp_slNodeScore(sl, node, j));
+    }
+}
+
+/* Append n packed records to a running build.
+ * Returns NULL or an error message. */
+static const char *
+_load_records(struct skiplistBuilder_sp *b, const char *p, size_t n) {
+    struct skiplist_sp *sl = b->sl;
+    size_t i;
+    int j;
+    for (i = 0; i < n; i++, p += DUMP_RECSIZE(sl)) {
+        int64_t score[SKIPLIST_SP_MAXKEY];
+        for (j = 0; j < sl->nkey; j++) {
+            score[j] = (int64_t)slDumpGetU64(p + 8 + 8 * j);
+        }
+        int r = sp_slBuildAppend(b, score, (int64_t)slDumpGetU64(p));
+        if (r == SL_ENOMEM) {
+            return "not enough memory";
+        }
+        if (!r) {
+            return "unsorted or duplicated snapshot record";
+        }
+    }
+    return NULL;
+}
+
+/* Check a snapshot header against the list, returns the record count */
+static uint64_t
+_check_header(lua_State *L, struct skiplist_sp *sl, const char *head) {
+    int cmp = 0;
+    uint64_t length = 0;
+    if (!slDumpGetHeader(head, DUMP_KIND(sl), &cmp, &length)) {
+        luaL_error(L, "invalid skiplist snapshot");
+    }
+    if (cmp != DUMP_CMP(sl)) {
+        luaL_error(L, "snapshot cmp(%d) does not match skiplist cmp(%d)", cmp, DUMP_CMP(sl));
+    }
+    return length;
+}
+
+static int
+_dump(lua_State *L) {
+    struct skiplist_sp *sl = _to_skiplist(L);
+    size_t size = SLDUMP_HEADSIZE + sl->length * DUMP_RECSIZE(sl);
+    luaL_Buffer b;
+    char *p = luaL_buffinitsize(L, &b, size);
+
+    slDumpPutHeader(p, DUMP_KIND(sl), DUMP_CMP(sl), sl->length);
+    p += SLDUMP_HEADSIZE;
+    struct skiplistNode_sp *node = sp_slNext(sl, sl->header);
+    for (; node; node = sp_slNext(sl, node), p += DUMP_RECSIZE(sl)) {
+        _dump_record(p, sl, node);
+    }
+    luaL_pushresultsize(&b, size);
+    return 1;
+}
+
+/* Replace the content of the list with a snapshot made by dump() */
+static int
+_load(lua_State *L) {
+    struct skiplist_sp *sl = _to_skiplist(L);
+    size_t size;
+    const char *blob = luaL_checklstring(L, 2, &size);
+    if (size < SLDUMP_HEADSIZE) {
+        luaL_error(L, "invalid skiplist snapshot");
+    }
+    uint64_t length = _check_header(L, sl, blob);
+    if ((size - SLDUMP_HEADSIZE) / DUMP_RECSIZE(sl) != length || (size - SLDUMP_HEADSIZE) % DUMP_RECSIZE(sl) != 0) {
+        luaL_error(L, "truncated skiplist snapshot");
+    }
+
+    struct skiplistBuilder_sp b;
+    sp_slClear(sl);
+    sp_slBuildBegin(sl, &b, 0);
+    const char *err = _load_records(&b, blob + SLDUMP_HEADSIZE, length);
+    sp_slBuildEnd(&b);
+    if (err) {
+        sp_slClear(sl);
+        luaL_error(L, "%s", err);
+    }
+    lua_pushinteger(L, sl->length);
+    return 1;
+}
+
+/* Same as dump() but streamed into a file, returns true or nil, err */
+static int
+_dump_file(lua_State *L) {
+    struct skiplist_sp *sl = _to_skiplist(L);
+    const char *path = luaL_checkstring(L, 2);
+    char *buf = lua_newuserdata(L, SLDUMP_CHUNK * DUMP_RECSIZE(sl));
+    FILE *f = fopen(path, "wb");
+    if (f == NULL) {
+        return luaL_fileresult(L, 0, path);
+    }
+
+    char head[SLDUMP_HEADSIZE];
+    slDumpPutHeader(head, DUMP_KIND(sl), DUMP_CMP(sl), sl->length);
+    fwrite(head, SLDUMP_HEADSIZE, 1, f);
+    struct skiplistNode_sp *node = sp_slNext(sl, sl->header);
+    while (node) {
+        size_t n = 0;
+        for (; node && n < SLDUMP_CHUNK; node = sp_slNext(sl, node), n++) {
+            _dump_record(buf + n * DUMP_RECSIZE(sl), sl, node);
+        }
+        fwrite(buf, DUMP_RECSIZE(sl), n, f);
+    }
+    int ok = !ferror(f);
+    if (fclose(f) != 0) {
+        ok = 0;
+    }
+    return luaL_fileresult(L, ok, path);
+}
+
+/* Same as load() but streamed from a file, returns the count or nil, err */
+static int
+_load_file(lua_State *L) {
+    struct skiplist_sp *sl = _to_skiplist(L);
+    const char *path = luaL_checkstring(L, 2);
+    char *buf = lua_newuserdata(L, SLDUMP_CHUNK * DUMP_RECSIZE(sl));
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        return luaL_fileresult(L, 0, path);
+    }
+
+    int cmp;
+    uint64_t length;
+    char head[SLDUMP_HEADSIZE];
+    if (fread(head, SLDUMP_HEADSIZE, 1, f) != 1 || !slDumpGetHeader(head, DUMP_KIND(sl), &cmp, &length) || cmp != DUMP_CMP(sl)) {
+        fclose(f);
+        lua_pushnil(L);
+        lua_pushfstring(L, "%s: invalid skiplist snapshot or cmp mismatch", path);
         return 2;
     }
-    return 0;
+
+    struct skiplistBuilder_sp b;
+    const char *err = NULL;
+    sp_slClear(sl);
+    sp_slBuildBegin(sl, &b, 0);
+    while (length > 0 && err == NULL) {
+        size_t n = length < SLDUMP_CHUNK ? length : SLDUMP_CHUNK;
+        if (fread(buf, DUMP_RECSIZE(sl), n, f) != n) {
+            err = "truncated skiplist snapshot";
+            break;
+        }
+        err = _load_records(&b, buf, n);
+        length -= n;
+    }
+    sp_slBuildEnd(&b);
+    fclose(f);
+    if (err) {
+        sp_slClear(sl);
+        lua_pushnil(L);
+        lua_pushfstring(L, "%s: %s", path, err);
+        return 2;
+    }
+    lua_pushinteger(L, sl->length);
+    return 1;
 }
 
+static int
+_shrink(lua_State *L) {
+    struct skiplist_sp *sl = _to_skiplist(L);
+    lua_pushinteger(L, sp_slShrink(sl));
+    return 1;
+}
+
+static int
+_memory(lua_State *L) {
+    struct skiplist_sp *sl = _to_skiplist(L);
+    lua_pushinteger(L, sp_slMemory(sl));
+    lua_pushinteger(L, sl->pool.bytes);
+    lua_pushinteger(L, sl->index ? slIndexMemory(sl->index) : 0);
+    return 3;
+}
+
+/* new(cmp...[, opts]): one direction per score component. Fewer than two
+ * directions still make the two component list of the old new(cmp0, cmp1),
+ * missing ones ascending; opts.nkey asks for another component count. */
 static int
 _new(lua_State *L) {
-    char cmp0 = luaL_optinteger(L, 1, 0);
-    char cmp1 = luaL_optinteger(L, 2, 0);
-    struct skiplist_sp *psl = sp_slCreate(cmp0, cmp1);
+    char cmp[SKIPLIST_SP_MAXKEY] = { 0 };
+    int ndir = 0, nkey;
+    while (lua_type(L, ndir + 1) == LUA_TNUMBER) {
+        if (ndir == SKIPLIST_SP_MAXKEY) {
+            luaL_error(L, "too many score components, at most %d", SKIPLIST_SP_MAXKEY);
+        }
+        cmp[ndir] = (char)lua_tointeger(L, ndir + 1);
+        ndir++;
+    }
+    int opts = ndir + 1;
+    if (!lua_istable(L, opts) && lua_istable(L, 3)) {
+        opts = 3; // new(nil, nil, opts)
+    }
+    nkey = ndir < 2 ? 2 : ndir;
+    if (lua_istable(L, opts)) {
+        lua_getfield(L, opts, "nkey");
+        lua_Integer n = luaL_optinteger(L, -1, nkey);
+        lua_pop(L, 1);
+        if (n < 1 || n > SKIPLIST_SP_MAXKEY) {
+            luaL_error(L, "nkey must be between 1 and %d", SKIPLIST_SP_MAXKEY);
+        }
+        nkey = (int)n;
+        if (nkey < ndir) {
+            luaL_error(L, "%d directions given for %d score components", ndir, nkey);
+        }
+    }
+    int index = 0, autoshrink = 0, hasseed = 0;
+    lua_Integer maxlength = 0, seed = 0;
+    if (lua_istable(L, opts)) {
+        lua_getfield(L, opts, "index");
+        index = lua_toboolean(L, -1);
+        lua_pop(L, 1);
+        lua_getfield(L, opts, "autoshrink");
+        autoshrink = lua_toboolean(L, -1);
+        lua_pop(L, 1);
+        lua_getfield(L, opts, "max_length");
+        maxlength = luaL_optinteger(L, -1, 0);
+        lua_pop(L, 1);
+        luaL_argcheck(L, maxlength >= 0, opts, "max_length must not be negative");
+        lua_getfield(L, opts, "seed");
+        if (!lua_isnil(L, -1)) {
+            seed = luaL_checkinteger(L, -1);
+            hasseed = 1;
+        }
+        lua_pop(L, 1);
+    }
 
+    /* the userdata comes before the list so that nothing raising later
+     * can leak it, __gc skips the NULL left if the list is not made */
     struct skiplist_sp **sl = (struct skiplist_sp **)lua_newuserdata(L, sizeof(struct skiplist_sp *));
-    *sl = psl;
+    *sl = NULL;
     lua_pushvalue(L, lua_upvalueindex(1));
     lua_setmetatable(L, -2);
+
+    void *ud;
+    lua_Alloc allocf = lua_getallocf(L, &ud);
+    struct skiplist_sp *psl = sp_slCreate(nkey, cmp, allocf, ud);
+    if (psl == NULL) {
+        luaL_error(L, "not enough memory");
+    }
+    *sl = psl;
+    psl->autoshrink = autoshrink;
+    psl->maxlength = maxlength;
+    if (index) {
+        _check_alloc(L, sp_slEnableIndex(psl));
+    }
+    if (hasseed) {
+        sp_slSetSeed(psl, seed);
+    }
     return 1;
 }
 
@@ -187,7 +1009,9 @@ static int
 _release(lua_State *L) {
     struct skiplist_sp *sl = _to_skiplist(L);
     //printf("collect sl:%p\n", sl);
-    sp_slFree(sl);
+    if (sl) {
+        sp_slFree(sl);
+    }
     return 0;
 }
 
@@ -198,14 +1022,40 @@ luaopen_skiplist_sp(lua_State *L) {
     luaL_Reg l[] = {
         { "insert", _insert },
         { "delete", _delete },
+        { "update", _update },
+        { "incrby", _incrby },
         { "delete_byrank", _delete_byrank },
+        { "delete_byscore", _delete_byscore },
+        { "insert_batch", _insert_batch },
+        { "delete_batch", _delete_batch },
+        { "from_sorted", _from_sorted },
 
         { "get_count", _get_count },
         { "rank_byobj", _rank_byobj },
+        { "rank", _rank_byobj },
+        { "ranks_of", _ranks_of },
+        { "score", _score },
         { "ranks_byscore", _ranks_byscore },
+        { "count_byscore", _count_byscore },
         { "obj_byrank", _obj_byrank },
         { "objs_byrank", _objs_byrank },
         { "objs_byscore", _objs_byscore },
+        { "around", _around },
+        { "quantile", _quantile },
+        { "quantiles", _quantiles },
+        { "histogram", _histogram },
+        { "range_byrank", _range_byrank },
+        { "range_byscore", _range_byscore },
+        { "revrange_byrank", _revrange_byrank },
+        { "revrange_byscore", _revrange_byscore },
+
+        { "dump", _dump },
+        { "load", _load },
+        { "dump_file", _dump_file },
+        { "load_file", _load_file },
+
+        { "shrink", _shrink },
+        { "memory", _memory },
 
         { NULL, NULL }
     };
@@ -0,0 +1,96 @@
+/*
+ * Read side of the shared boards: open(name) returns a handle with the
+ * read methods of the btree engine. Every call reads the latest snapshot
+ * published by list:publish(name), from any service in the process,
+ * without taking a lock.
+ */
+
+#include "lauxlib.h"
+#include "lua.h"
+#include "btree.h"
+#include "slshared.h"
+
+/* bt comes first, the btree methods see the handle as a btree object */
+struct board {
+    btree *bt;
+    slSharedReader *r;
+};
+
+/* Pins the latest snapshot and runs the btree method in upvalue 1 on it */
+static int
+_read(lua_State *L) {
+    struct board *h = lua_touserdata(L, 1);
+    if (h == NULL || !lua_getmetatable(L, 1) || !lua_rawequal(L, -1, lua_upvalueindex(2))) {
+        luaL_error(L, "must be shared board");
+    }
+    lua_pop(L, 1);
+    h->bt = slSharedRead(h->r);
+    return lua_tocfunction(L, lua_upvalueindex(1))(L);
+}
+
+static int
+_open(lua_State *L) {
+    const char *name = luaL_checkstring(L, 1);
+    struct board *h = (struct board *)lua_newuserdata(L, sizeof(struct board));
+    h->bt = NULL;
+    h->r = NULL;
+    lua_pushvalue(L, lua_upvalueindex(1));
+    lua_setmetatable(L, -2);
+    h->r = slSharedOpen(name);
+    if (h->r == NULL) {
+        luaL_error(L, "not enough memory");
+    }
+    return 1;
+}
+
+static int
+_release(lua_State *L) {
+    struct board *h = lua_touserdata(L, 1);
+    if (h->r) {
+        slSharedClose(h->r);
+        h->r = NULL;
+    }
+    return 0;
+}
+
+LUAMOD_API int luaopen_skiplist_btree(lua_State *L);
+
+LUAMOD_API int
+luaopen_skiplist_shared(lua_State *L) {
+    luaL_checkversion(L);
+
+    static const char *const methods[] = {
+        "get_count", "rank_byobj", "rank", "ranks_of", "score",
+        "ranks_byscore", "count_byscore", "obj_byrank", "objs_byrank",
+        "objs_byscore", "around", "quantile", "quantiles", "histogram",
+        "range_byrank", "range_byscore", "revrange_byrank", "revrange_byscore",
+        "dump", "dump_file", "memory",
+        NULL
+    };
+    int i, mt, index;
+
+    /* the btree methods, from the metatable the btree constructor keeps */
+    luaopen_skiplist_btree(L);
+    lua_getupvalue(L, -1, 1);
+    lua_getfield(L, -1, "__index");
+    index = lua_gettop(L);
+
+    lua_createtable(L, 0, 2);
+    mt = lua_gettop(L);
+    lua_createtable(L, 0, sizeof(methods) / sizeof(methods[0]) - 1);
+    for (i = 0; methods[i]; i++) {
+        lua_getfield(L, index, methods[i]);
+        lua_pushvalue(L, mt);
+        lua_pushcclosure(L, _read, 2);
+        lua_setfield(L, -2, methods[i]);
+    }
+    lua_setfield(L, mt, "__index");
+    lua_pushcfunction(L, _release);
+    lua_setfield(L, mt, "__gc");
+
+    lua_createtable(L, 0, 1);
+    lua_pushvalue(L, mt);
+    lua_pushcclosure(L, _open, 1);
+    lua_setfield(L, -2, "open");
+    return 1;
+}
@@ -9,313 +9,126 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include "skiplist.h"
-
-#define SKIPLIST_MAXLEVEL 32
-#define SKIPLIST_P 0.25
-
-int slCompareScores(skiplist *sl, double score1, double score2) {
-    if (score1 < score2) {
-        return sl->cmp ? 1 : -1;
-    }
-    if (score1 > score2) {
-        return sl->cmp ? -1 : 1;
-    }
-    return 0;
-}
-
-skiplistNode *slCreateNode(int level, double score, int64_t obj) {
-    skiplistNode *n = malloc(sizeof(*n) + level * sizeof(struct skiplistLevel));
-    n->score = score;
+#include "slindex.h"
+#include "slrand.h"
+
+static skiplistNode *slCreateNode(skiplist *sl, int level, uint64_t key, int64_t obj) {
+#if SKIPLIST_COMPACT
+    uint32_t ref;
+    skiplistNode *n = slPoolAllocRef(&sl->pool, level, &ref);
+    if (n == NULL)
+        return NULL;
+    n->self = ref;
+#else
+    skiplistNode *n = slPoolAlloc(&sl->pool, level);
+    if (n == NULL)
+        return NULL;
+    n->level[0].height = level;
+#endif
+    n->key = key;
     n->obj = obj;
     return n;
 }
 
-void slFreeNode(skiplistNode *node) {
-    free(node);
+void slFreeNode(skiplist *sl, skiplistNode *node, int level) {
+#if SKIPLIST_COMPACT
+    slPoolFreeRef(&sl->pool, node, level, node->self);
+#else
+    slPoolFree(&sl->pool, node, level);
+#endif
 }
 
-skiplist *slCreate(void) {
+/* allocf follows the lua_Alloc protocol, NULL falls back to realloc/free.
+ * Returns NULL if the allocator refuses. */
+skiplist *slCreate(slAllocFn allocf, void *ud) {
     int j;
     skiplist *sl;
+    slAllocator alloc;
 
-    sl = malloc(sizeof(*sl));
+    slAllocatorInit(&alloc, allocf, ud);
+    sl = slMemAlloc(&alloc, sizeof(*sl));
+    if (sl == NULL)
+        return NULL;
+    sl->alloc = alloc;
     sl->level = 1;
     sl->length = 0;
     sl->cmp = 0; // 默认升序
-    sl->header = slCreateNode(SKIPLIST_MAXLEVEL, 0, 0);
+    sl->autoshrink = 0;
+    sl->maxlength = 0;
+    sl->rand = slRandSeed((uint64_t)(uintptr_t)sl ^ (uint64_t)time(NULL));
+    slPoolInit(&sl->pool, &sl->alloc, sizeof(skiplistNode), sizeof(struct skiplistLevel));
+#if SKIPLIST_COMPACT
+    slPoolEnableRefs(&sl->pool);
+#endif
+    sl->header = slMemAlloc(&sl->alloc, sizeof(skiplistNode) + SKIPLIST_MAXLEVEL * sizeof(struct skiplistLevel));
+    if (sl->header == NULL) {
+        slMemFree(&alloc, sl, sizeof(*sl));
+        return NULL;
+    }
+    sl->header->key = 0;
+    sl->header->obj = 0;
     for (j = 0; j < SKIPLIST_MAXLEVEL; j++) {
-        sl->header->level[j].forward = NULL;
+        sl->header->level[j].forward = 0;
         sl->header->level[j].span = 0;
     }
-    sl->header->backward = NULL;
+#if SKIPLIST_COMPACT
+    sl->header->self = 0;
+#else
+    sl->header->level[0].height = SKIPLIST_MAXLEVEL;
+#endif
+    sl->header->backward = 0;
     sl->tail = NULL;
+    sl->index = NULL;
     return sl;
 }
 
 void slFree(skiplist *sl) {
-    skiplistNode *node = sl->header->level[0].forward, *next;
-    free(sl->header);
-    while (node) {
-        next = node->level[0].forward;
-        slFreeNode(node);
-        node = next;
-    }
-    free(sl);
-}
-
-static int slRandomLevel(void) {
-    int level = 1;
-    while ((random() & 0xffff) < (SKIPLIST_P * 0xffff))
-        level += 1;
-    return (level < SKIPLIST_MAXLEVEL) ? level : SKIPLIST_MAXLEVEL;
-}
-
-void slInsert(skiplist *sl, double score, int64_t obj) {
-    skiplistNode *update[SKIPLIST_MAXLEVEL], *x;
-    unsigned int rank[SKIPLIST_MAXLEVEL];
-    int i, level;
-
-    x = sl->header;
-    for (i = sl->level - 1; i >= 0; i--) {
-        /* store rank that is crossed to reach the insert position */
-        rank[i] = i == (sl->level - 1) ? 0 : rank[i + 1];
-        while (x->level[i].forward && (slCompareScores(sl, x->level[i].forward->score, score) < 0 || (slCompareScores(sl, x->level[i].forward->score, score) == 0 && (x->level[i].forward->obj - obj) < 0))) {
-            rank[i] += x->level[i].span;
-            x = x->level[i].forward;
-        }
-        update[i] = x;
-    }
-    /* we assume the key is not already inside, since we allow duplicated
-	 * scores, and the re-insertion of score and redis object should never
-	 * happen since the caller of slInsert() should test in the hash table
-	 * if the element is already inside or not. */
-    level = slRandomLevel();
-    if (level > sl->level) {
-        for (i = sl->level; i < level; i++) {
-            rank[i] = 0;
-            update[i] = sl->header;
-            update[i]->level[i].span = sl->length;
-        }
-        sl->level = level;
-    }
-    x = slCreateNode(level, score, obj);
-    for (i = 0; i < level; i++) {
-        x->level[i].forward = update[i]->level[i].forward;
-        update[i]->level[i].forward = x;
-
-        /* update span covered by update[i] as x is inserted here */
-        x->level[i].span = update[i]->level[i].span - (rank[0] - rank[i]);
-        update[i]->level[i].span = (rank[0] - rank[i]) + 1;
-    }
-
-    /* increment span for untouched levels */
-    for (i = level; i < sl->level; i++) {
-        update[i]->level[i].span++;
-    }
-
-    x->backward = (update[0] == sl->header) ? NULL : update[0];
-    if (x->level[0].forward)
-        x->level[0].forward->backward = x;
-    else
-        sl->tail = x;
-    sl->length++;
-}
-
-/* Internal function used by slDelete, slDeleteByScore */
-void slDeleteNode(skiplist *sl, skiplistNode *x, skiplistNode **update) {
-    int i;
-    for (i = 0; i < sl->level; i++) {
-        if (update[i]->level[i].forward == x) {
-            update[i]->level[i].span += x->level[i].span - 1;
-            update[i]->level[i].forward = x->level[i].forward;
-        } else {
-            update[i]->level[i].span -= 1;
-        }
-    }
-    if (x->level[0].forward) {
-        x->level[0].forward->backward = x->backward;
-    } else {
-        sl->tail = x->backward;
-    }
-    while (sl->level > 1 && sl->header->level[sl->level - 1].forward == NULL)
-        sl->level--;
-    sl->length--;
-}
-
-/* Delete an element with matching score/object from the skiplist. */
-int slDelete(skiplist *sl, double score, int64_t obj) {
-    skiplistNode *update[SKIPLIST_MAXLEVEL], *x;
-    int i;
-
-    x = sl->header;
-    for (i = sl->level - 1; i >= 0; i--) {
-        while (x->level[i].forward && 
-            (slCompareScores(sl, x->level[i].forward->score, score) < 0 || (slCompareScores(sl, x->level[i].forward->score, score) == 0 && (x->level[i].forward->obj - obj) < 0)))
-            x = x->level[i].forward;
-        update[i] = x;
-    }
-    /* We may have multiple elements with the same score, what we need
-	 * is to find the element with both the right score and object. */
-    x = x->level[0].forward;
-    if (x && score == x->score && (x->obj == obj)) {
-        slDeleteNode(sl, x, update);
-        slFreeNode(x);
-        return 1;
-    }
-    return 0; /* not found */
-}
-
-/* Delete all elements with rank between start and end (inclusive)
- * Note: ranks are 1-based */
-unsigned long slDeleteByRank(skiplist *sl, unsigned int start, unsigned int end, slDeleteCb cb, void *ud) {
-    skiplistNode *update[SKIPLIST_MAXLEVEL], *x;
-    unsigned long traversed = 0, removed = 0;
-    int i;
-
-    x = sl->header;
-    for (i = sl->level - 1; i >= 0; i--) {
-        while (x->level[i].forward && (traversed + x->level[i].span) < start) {
-            traversed += x->level[i].span;
-            x = x->level[i].forward;
-        }
-        update[i] = x;
-    }
-
-    traversed++;
-    x = x->level[0].forward;
-    while (x && traversed <= end) {
-        skiplistNode *next = x->level[0].forward;
-        slDeleteNode(sl, x, update);
-        cb(ud, x->obj);
-        slFreeNode(x);
-        removed++;
-        traversed++;
-        x = next;
-    }
-    return removed;
-}
-
-/* Get element rank by score and key
- * Returns: 0 if not found, 1-based rank otherwise 
- * (1-based due to header span) */
-unsigned long slGetRank(skiplist *sl, double score, int64_t o) {
-    skiplistNode *x;
-    unsigned long rank = 0;
-    int i;
-
-    x = sl->header;
-    for (i = sl->level - 1; i >= 0; i--) {
-        while (x->level[i].forward && (slCompareScores(sl, x->level[i].forward->score, score) < 0 || (slCompareScores(sl, x->level[i].forward->score, score) == 0 && (x->level[i].forward->obj - o) <= 0))) {
-            rank += x->level[i].span;
-            x = x->level[i].forward;
-        }
-
-        /* x might be equal to sl->header, so test if obj is non-NULL */
-        if (x->obj && (x->obj == o)) {
-            return rank;
-        }
-    }
-    return 0;
-}
-
-/* Get element by its 1-based rank */
-skiplistNode *slGetNodeByRank(skiplist *sl, unsigned long rank) {
-    if (rank == 0 || rank > sl->length) {
-        return NULL;
-    }
-
-    skiplistNode *x;
-    unsigned long traversed = 0;
-    int i;
-
-    x = sl->header;
-    for (i = sl->level - 1; i >= 0; i--) {
-        while (x->level[i].forward && (traversed + x->level[i].span) <= rank) {
-            traversed += x->level[i].span;
-            x = x->level[i].forward;
-        }
-        if (traversed == rank) {
-            return x;
-        }
-    }
-
-    return NULL;
-}
-
-/* Check if any element is in score range [min, max] (inclusive) */
-int slIsInRange(skiplist *sl, double min, double max) {
-    skiplistNode *x;
-
-    /* Test for ranges that will always be empty. */
-    if (slCompareScores(sl, min, max) > 0) {
-        return 0;
-    }
-    x = sl->tail;
-    if (x == NULL || slCompareScores(sl, x->score, min) < 0)
-        return 0;
-
-    x = sl->header->level[0].forward;
-    if (x == NULL || slCompareScores(sl, x->score, max) > 0)
-        return 0;
-    return 1;
-}
-
-/* Find the first node that is contained in the specified range.
- * Returns NULL when no element is contained in the range. */
-skiplistNode *slFirstInRange(skiplist *sl, double min, double max) {
-    skiplistNode *x;
-    int i;
-
-    /* If everything is out of range, return early. */
-    if (!slIsInRange(sl, min, max))
-        return NULL;
-
-    x = sl->header;
-    for (i = sl->level - 1; i >= 0; i--) {
-        /* Go forward while *OUT* of range. */
-        while (x->level[i].forward && slCompareScores(sl, x->level[i].forward->score, min) < 0)
-            x = x->level[i].forward;
-    }
-
-    /* This is an inner range, so the next node cannot be NULL. */
-    x = x->level[0].forward;
-    return x;
-}
-
-/* Find the last node that is contained in the specified range.
- * Returns NULL when no element is contained in the range. */
-skiplistNode *slLastInRange(skiplist *sl, double min, double max) {
-    skiplistNode *x;
-    int i;
-
-    /* If everything is out of range, return early. */
-    if (!slIsInRange(sl, min, max))
-        return NULL;
-
-    x = sl->header;
-    for (i = sl->level - 1; i >= 0; i--) {
-        /* Go forward while *IN* range. */
-        while (x->level[i].forward && slCompareScores(sl, x->level[i].forward->score, max) <= 0)
-            x = x->level[i].forward;
-    }
-
-    /* This is an inner range, so this node cannot be NULL. */
-    return x;
-}
-
-unsigned long slGetRankByScore(skiplist *sl, double score) {
-    skiplistNode *x;
-    unsigned long rank = 0;
-    int i;
-
-    x = sl->header;
-    for (i = sl->level - 1; i >= 0; i--) {
-        while (x->level[i].forward && slCompareScores(sl, x->level[i].forward->score, score) <= 0) {
-            rank += x->level[i].span;
-            x = x->level[i].forward;
-        }
-    }
-    return rank + 1;
-}
+    slAllocator alloc;
+
+    /* every node lives in the pool, no need to walk the list */
+    slMemFree(&sl->alloc, sl->header, sizeof(skiplistNode) + SKIPLIST_MAXLEVEL * sizeof(struct skiplistLevel));
+    slPoolRelease(&sl->pool);
+    if (sl->index)
+        slIndexFree(sl->index);
+    alloc = sl->alloc;
+    slMemFree(&alloc, sl, sizeof(*sl));
+}
+
+static int slEntryCmp(const void *a, const void *b) {
+    const skiplistEntry *x = a, *y = b;
+    if (x->score != y->score)
+        return x->score < y->score ? -1 : 1;
+    return x->obj < y->obj ? -1 : (x->obj > y->obj ? 1 : 0);
+}
+
+/* Descending lists negate the scores around an ascending sort */
+static void slFlipEntries(skiplist *sl, skiplistEntry *entries, unsigned long n) {
+    unsigned long i;
+
+    if (sl->cmp)
+        for (i = 0; i < n; i++)
+            entries[i].score = -entries[i].score;
+}
+
+#define SL_NAME(n) n
+#define SL_LIST skiplist
+#define SL_NODE skiplistNode
+#define SL_ENTRY skiplistEntry
+#define SL_BUILDER skiplistBuilder
+#define SL_KEY double
+#define SL_KEYS const double *
+#define SL_KEYAT(sl, ks, k) ((ks)[k])
+#define SL_IKEY uint64_t
+#define SL_DECLKEY(k) uint64_t k
+#define SL_ENCODE(sl, k, s) ((k) = slScoreKey(sl, s))
+#define SL_NODEKEY(sl, x) ((x)->key)
+#define SL_SETKEY(sl, x, k) ((x)->key = (k))
+#define SL_COPYKEY(sl, d, k) ((d) = (k))
+#define SL_LESS(sl, a, ao, b, bo) slKeyLess(a, ao, b, bo)
+#define SL_CMP(sl, a, b) slKeyCmp(a, b)
+#define SL_KEYWORD(k) (k)
+#define SL_ONEWORD(sl) 1
+#include "slimpl.h"
@@ -1,40 +1,146 @@
 #ifndef SKIPLIST_HH
 #define SKIPLIST_HH
 
+#include <stdint.h>
+#include "slpool.h"
+#include "slkey.h"
+
 typedef struct skiplistNode {
     int64_t obj;
-    double score;
+    uint64_t key;          // score 的保序编码, 用 slNodeScore 读取
+#if SKIPLIST_COMPACT
+    uint32_t backward;     // 前一个节点的 ref, 见 slpool.h
+    uint32_t self;         // 本节点的 ref
+    struct skiplistLevel {
+        uint32_t forward;
+        slSpan span;
+    } level[];
+#else
     struct skiplistNode *backward;
     struct skiplistLevel {
         struct skiplistNode *forward;
-        unsigned int span;
+#if SKIPLIST_LINKKEY
+        uint64_t fkey;      // forward 节点 key 的首字, forward 为 NULL 时无意义
+#endif
+        slSpan span;
+        unsigned int height; // 节点层数, 只在 level[0] 维护
     } level[];
+#endif
 } skiplistNode;
 
+struct slIndex;
+
 typedef struct skiplist {
     struct skiplistNode *header, *tail;
     unsigned long length;
     int level;
     char cmp;
+    struct slIndex *index; // obj -> node, NULL 表示未开启
+    char autoshrink;       // 删除较多时自动把空闲 slab 还给系统
+    unsigned long maxlength; // 长度上限, 0 表示不限
+    uint64_t rand;         // 层数随机数状态
+    slAllocator alloc;
+    slPool pool;
 } skiplist;
 
+typedef struct skiplistEntry {
+    double score;
+    int64_t obj;
+} skiplistEntry;
+
+#define SKIPLIST_MAXLEVEL 32
+
+typedef struct skiplistBuilder {
+    skiplist *sl;
+    skiplistNode *last[SKIPLIST_MAXLEVEL];
+    unsigned long lastrank[SKIPLIST_MAXLEVEL];
+    int deterministic;
+    int haslast;           // 已追加过元素, 超出 maxlength 被丢弃的也算
+    uint64_t lastkey;      // 最后追加的元素, 下一个须排在它之后
+    int64_t lastobj;
+} skiplistBuilder;
+
 typedef void (*slDeleteCb)(void *ud, int64_t obj);
-void slFreeNode(skiplistNode *node);
 
-skiplist *slCreate(void);
+/* <0, 0, >0 of two plain scores in list order */
+static inline int slCompareScores(const skiplist *sl, double score1, double score2) {
+    if (score1 < score2) {
+        return sl->cmp ? 1 : -1;
+    }
+    if (score1 > score2) {
+        return sl->cmp ? -1 : 1;
+    }
+    return 0;
+}
+
+void slFreeNode(skiplist *sl, skiplistNode *node, int level);
+
+static inline uint64_t slScoreKey(const skiplist *sl, double score) {
+    return slEncodeDouble(score, slKeyFlip(sl->cmp));
+}
+
+static inline double slNodeScore(const skiplist *sl, const skiplistNode *x) {
+    return slDecodeDouble(x->key, slKeyFlip(sl->cmp));
+}
+
+/* The node after x in list order, NULL past the tail. slNext(sl, sl->header)
+ * is the first node. */
+static inline skiplistNode *slNext(const skiplist *sl, const skiplistNode *x) {
+#if SKIPLIST_COMPACT
+    return slPoolPtr(&sl->pool, x->level[0].forward);
+#else
+    (void)sl;
+    return x->level[0].forward;
+#endif
+}
+
+/* The node before x, NULL for the first node */
+static inline skiplistNode *slPrev(const skiplist *sl, const skiplistNode *x) {
+#if SKIPLIST_COMPACT
+    return slPoolPtr(&sl->pool, x->backward);
+#else
+    (void)sl;
+    return x->backward;
+#endif
+}
+
+skiplist *slCreate(slAllocFn allocf, void *ud);
 void slFree(skiplist *sl);
+void slClear(skiplist *sl);
+size_t slMemory(skiplist *sl);
+int slEnableIndex(skiplist *sl);
+void slSetSeed(skiplist *sl, uint64_t seed);
+size_t slShrink(skiplist *sl);
 
-void slInsert(skiplist *sl, double score, int64_t obj);
+int slInsert(skiplist *sl, double score, int64_t obj, slDeleteCb cb, void *ud);
 int slDelete(skiplist *sl, double score, int64_t obj);
-unsigned long slDeleteByRank(skiplist *sl, unsigned int start, unsigned int end, slDeleteCb cb, void *ud);
+int64_t slDeleteTail(skiplist *sl);
+void slSortEntries(skiplist *sl, skiplistEntry *entries, unsigned long n);
+int slInsertBatch(skiplist *sl, skiplistEntry *entries, unsigned long n, unsigned long *stored);
+unsigned long slDeleteBatch(skiplist *sl, skiplistEntry *entries, unsigned long n);
+skiplistNode *slUpdateScore(skiplist *sl, double curscore, int64_t obj, double newscore);
+unsigned long slDeleteByRank(skiplist *sl, unsigned long start, unsigned long end, slDeleteCb cb, void *ud);
+unsigned long slDeleteRangeByScore(skiplist *sl, double min, double max, slDeleteCb cb, void *ud);
 
 unsigned long slGetRank(skiplist *sl, double score, int64_t o);
+void slGetRanks(skiplist *sl, skiplistEntry *entries, unsigned long n, skiplistEntry **order, unsigned long *ranks);
+skiplistNode *slGetNodeRank(skiplist *sl, double score, int64_t o, unsigned long *rank);
 skiplistNode *slGetNodeByRank(skiplist *sl, unsigned long rank);
+void slGetNodesByRank(skiplist *sl, const unsigned long *ranks, unsigned long n, skiplistNode **nodes);
+skiplistNode *slGetNodeByObj(skiplist *sl, int64_t obj);
 
+int slIsInRange(skiplist *sl, double min, double max);
 skiplistNode *slFirstInRange(skiplist *sl, double min, double max);
 skiplistNode *slLastInRange(skiplist *sl, double min, double max);
 
-int slCompareScores(skiplist *sl, double score1, double score2);
 unsigned long slGetRankByScore(skiplist *sl, double score);
+unsigned long slCountBefore(skiplist *sl, double score, int inclusive);
+unsigned long slCountInRange(skiplist *sl, double min, double max);
+void slCountBeforeBatch(skiplist *sl, const double *scores, unsigned long n, unsigned long *counts);
+
+void slBuildBegin(skiplist *sl, skiplistBuilder *b, int deterministic);
+int slBuildAppend(skiplistBuilder *b, double score, int64_t obj);
+void slBuildEnd(skiplistBuilder *b);
+int slBuildSorted(skiplist *sl, const skiplistEntry *entries, unsigned long n, int deterministic);
 
 #endif //SKIPLIST_HH
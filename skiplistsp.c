@@ -1,4 +1,6 @@
 #include "skiplistsp.h"
+#include "slindex.h"
+#include "slrand.h"
 #include <stdlib.h>
 #include <time.h>
 #include <math.h>
@@ -6,296 +8,244 @@
 #include <string.h>
 #include <stdint.h>  // For int64_t definition
 
-#define SKIPLIST_MAXLEVEL 32
-#define SKIPLIST_P 0.25
-
-int sp_compareScores(struct skiplist_sp *sl, int64_t score1[2], int64_t score2[2]) {
-    for (int i = 0; i < 2; i++) {
-        if (score1[i] < score2[i]) {
-            return sl->cmp[i] ? 1 : -1;
-        }
-        if (score1[i] > score2[i]) {
-            return sl->cmp[i] ? -1 : 1;
-        }
-    }
-    return 0;
-}
-
-struct skiplistNode_sp *sp_slCreateNode(int level, int64_t score[2], int64_t obj) {
-    struct skiplistNode_sp *n = malloc(sizeof(*n) + level * sizeof(struct skiplistLevel));
-    n->score[0] = score[0];
-    n->score[1] = score[1];
-    n->obj = obj;
-    return n;
+static inline size_t sp_slHeaderSize(struct skiplist_sp *sl) {
+    return sl->nkey * sizeof(uint64_t) + sizeof(struct skiplistNode_sp) + SKIPLIST_MAXLEVEL * sizeof(struct skiplistLevel);
 }
 
-void sp_slFreeNode(struct skiplistNode_sp *node) {
-    free(node);
+void sp_slFreeNode(struct skiplist_sp *sl, struct skiplistNode_sp *node, int level) {
+#if SKIPLIST_COMPACT
+    slPoolFreeRef(&sl->pool, sp_slKey(sl, node), level, node->self - sl->nkey);
+#else
+    slPoolFree(&sl->pool, sp_slKey(sl, node), level);
+#endif
 }
 
-struct skiplist_sp *sp_slCreate(char cmp0, char cmp1) {
+/* cmp gives the direction of each of the nkey components, non zero is
+ * descending. nkey must be within 1..SKIPLIST_SP_MAXKEY. Returns NULL if
+ * the allocator refuses. */
+struct skiplist_sp *sp_slCreate(int nkey, const char *cmp, slAllocFn allocf, void *ud) {
     int j;
     struct skiplist_sp *sl;
+    slAllocator alloc;
+    uint64_t *key;
 
-    sl = malloc(sizeof(*sl));
+    slAllocatorInit(&alloc, allocf, ud);
+    sl = slMemAlloc(&alloc, sizeof(*sl));
+    if (sl == NULL)
+        return NULL;
+    sl->alloc = alloc;
     sl->level = 1;
     sl->length = 0;
-    sl->cmp[0] = cmp0;
-    sl->cmp[1] = cmp1;
-    int64_t zeroScore[2] = {0, 0};
-    sl->header = sp_slCreateNode(SKIPLIST_MAXLEVEL, zeroScore, 0);
+    sl->nkey = nkey;
+    for (j = 0; j < SKIPLIST_SP_MAXKEY; j++)
+        sl->cmp[j] = j < nkey && cmp[j] ? 1 : 0;
+    sl->autoshrink = 0;
+    sl->maxlength = 0;
+    sl->rand = slRandSeed((uint64_t)(uintptr_t)sl ^ (uint64_t)time(NULL));
+    slPoolInit(&sl->pool, &sl->alloc, nkey * sizeof(uint64_t) + sizeof(struct skiplistNode_sp), sizeof(struct skiplistLevel));
+#if SKIPLIST_COMPACT
+    slPoolEnableRefs(&sl->pool);
+#endif
+    key = slMemAlloc(&sl->alloc, sp_slHeaderSize(sl));
+    if (key == NULL) {
+        slMemFree(&alloc, sl, sizeof(*sl));
+        return NULL;
+    }
+    memset(key, 0, nkey * sizeof(*key));
+    sl->header = (struct skiplistNode_sp *)(key + nkey);
+    sl->header->obj = 0;
     for (j = 0; j < SKIPLIST_MAXLEVEL; j++) {
-        sl->header->level[j].forward = NULL;
+        sl->header->level[j].forward = 0;
         sl->header->level[j].span = 0;
     }
-    sl->header->backward = NULL;
+#if SKIPLIST_COMPACT
+    sl->header->self = 0;
+#else
+    sl->header->level[0].height = SKIPLIST_MAXLEVEL;
+#endif
+    sl->header->backward = 0;
     sl->tail = NULL;
+    sl->index = NULL;
     return sl;
 }
 
 void sp_slFree(struct skiplist_sp *sl) {
-    struct skiplistNode_sp *node = sl->header->level[0].forward, *next;
-    free(sl->header);
-    while (node) {
-        next = node->level[0].forward;
-        sp_slFreeNode(node);
-        node = next;
-    }
-    free(sl);
-}
-
-static int sp_slRandomLevel(void) {
-    int level = 1;
-    while ((random() & 0xffff) < (SKIPLIST_P * 0xffff))
-        level += 1;
-    return (level < SKIPLIST_MAXLEVEL) ? level : SKIPLIST_MAXLEVEL;
-}
-
-void sp_slInsert(struct skiplist_sp *sl, int64_t score[2], int64_t obj) {
-    struct skiplistNode_sp *update[SKIPLIST_MAXLEVEL], *x;
-    unsigned int rank[SKIPLIST_MAXLEVEL];
-    int i, level;
-
-    x = sl->header;
-    for (i = sl->level - 1; i >= 0; i--) {
-        rank[i] = i == (sl->level - 1) ? 0 : rank[i + 1];
-        while (x->level[i].forward && 
-               (sp_compareScores(sl, x->level[i].forward->score, score) < 0 || 
-                (sp_compareScores(sl, x->level[i].forward->score, score) == 0 && 
-                 (x->level[i].forward->obj - obj) < 0))) {
-            rank[i] += x->level[i].span;
-            x = x->level[i].forward;
-        }
-        update[i] = x;
-    }
-    level = sp_slRandomLevel();
-    if (level > sl->level) {
-        for (i = sl->level; i < level; i++) {
-            rank[i] = 0;
-            update[i] = sl->header;
-            update[i]->level[i].span = sl->length;
-        }
-        sl->level = level;
-    }
-    x = sp_slCreateNode(level, score, obj);
-    for (i = 0; i < level; i++) {
-        x->level[i].forward = update[i]->level[i].forward;
-        update[i]->level[i].forward = x;
-        x->level[i].span = update[i]->level[i].span - (rank[0] - rank[i]);
-        update[i]->level[i].span = (rank[0] - rank[i]) + 1;
-    }
-    for (i = level; i < sl->level; i++) {
-        update[i]->level[i].span++;
-    }
-    x->backward = (update[0] == sl->header) ? NULL : update[0];
-    if (x->level[0].forward)
-        x->level[0].forward->backward = x;
-    else
-        sl->tail = x;
-    sl->length++;
-}
-
-void sp_slDeleteNode(struct skiplist_sp *sl, struct skiplistNode_sp *x, struct skiplistNode_sp **update) {
-    int i;
-    for (i = 0; i < sl->level; i++) {
-        if (update[i]->level[i].forward == x) {
-            update[i]->level[i].span += x->level[i].span - 1;
-            update[i]->level[i].forward = x->level[i].forward;
-        } else {
-            update[i]->level[i].span -= 1;
-        }
-    }
-    if (x->level[0].forward) {
-        x->level[0].forward->backward = x->backward;
-    } else {
-        sl->tail = x->backward;
-    }
-    while (sl->level > 1 && sl->header->level[sl->level - 1].forward == NULL)
-        sl->level--;
-    sl->length--;
-}
-
-int sp_slDelete(struct skiplist_sp *sl, int64_t score[2], int64_t obj) {
-    struct skiplistNode_sp *update[SKIPLIST_MAXLEVEL], *x;
-    int i;
-
-    x = sl->header;
-    for (i = sl->level - 1; i >= 0; i--) {
-    while (x->level[i].forward && 
-           (sp_compareScores(sl, x->level[i].forward->score, score) < 0 || 
-           (sp_compareScores(sl, x->level[i].forward->score, score) == 0 && 
-           (x->level[i].forward->obj - obj) < 0))) {
-            x = x->level[i].forward;
-        }
-        update[i] = x;
-    }
-    x = x->level[0].forward;
-    if (x && sp_compareScores(sl, score, x->score) == 0 && (x->obj == obj)) {
-        sp_slDeleteNode(sl, x, update);
-        sp_slFreeNode(x);
-        return 1;
-    }
-    return 0;
+    slAllocator alloc;
+
+    slMemFree(&sl->alloc, sp_slKey(sl, sl->header), sp_slHeaderSize(sl));
+    slPoolRelease(&sl->pool);
+    if (sl->index)
+        slIndexFree(sl->index);
+    alloc = sl->alloc;
+    slMemFree(&alloc, sl, sizeof(*sl));
 }
 
-unsigned long sp_slDeleteByRank(struct skiplist_sp *sl, unsigned int start, unsigned int end, slDeleteCb cb, void *ud) {
-    struct skiplistNode_sp *update[SKIPLIST_MAXLEVEL], *x;
-    unsigned long traversed = 0, removed = 0;
-    int i;
+/* The core is instantiated once per common arity and once generic, the
+ * public functions pick the instance by sl->nkey */
+#define SP_NAME(n) sp1_##n
+#define SP_ARITY 1
+#include "slimplsp.h"
+#undef SP_NAME
+#undef SP_ARITY
+#define SP_NAME(n) sp2_##n
+#define SP_ARITY 2
+#include "slimplsp.h"
+#undef SP_NAME
+#undef SP_ARITY
+#define SP_NAME(n) sp3_##n
+#define SP_ARITY 3
+#include "slimplsp.h"
+#undef SP_NAME
+#undef SP_ARITY
+#define SP_NAME(n) sp4_##n
+#define SP_ARITY 4
+#include "slimplsp.h"
+#undef SP_NAME
+#undef SP_ARITY
+#define SP_NAME(n) spn_##n
+#define SP_ARITY 0
+#include "slimplsp.h"
+#undef SP_NAME
+#undef SP_ARITY
 
-    x = sl->header;
-    for (i = sl->level - 1; i >= 0; i--) {
-        while (x->level[i].forward && (traversed + x->level[i].span) < start) {
-            traversed += x->level[i].span;
-            x = x->level[i].forward;
-        }
-        update[i] = x;
+#define SP_DISPATCH(sl, call) \
+    switch ((sl)->nkey) { \
+    case 1: return sp1_##call; \
+    case 2: return sp2_##call; \
+    case 3: return sp3_##call; \
+    case 4: return sp4_##call; \
+    default: return spn_##call; \
     }
 
-    traversed++;
-    x = x->level[0].forward;
-    while (x && traversed <= end) {
-        struct skiplistNode_sp *next = x->level[0].forward;
-        sp_slDeleteNode(sl, x, update);
-        cb(ud, x->obj);
-        sp_slFreeNode(x);
-        removed++;
-        traversed++;
-        x = next;
+#define SP_DISPATCH_VOID(sl, call) \
+    switch ((sl)->nkey) { \
+    case 1: sp1_##call; break; \
+    case 2: sp2_##call; break; \
+    case 3: sp3_##call; break; \
+    case 4: sp4_##call; break; \
+    default: spn_##call; break; \
     }
-    return removed;
-}
-
-unsigned long sp_slGetRank(struct skiplist_sp *sl, int64_t score[2], int64_t o) {
-    struct skiplistNode_sp *x;
-    unsigned long rank = 0;
-    int i;
-
-    x = sl->header;
-    for (i = sl->level - 1; i >= 0; i--) {
-        while (x->level[i].forward && 
-               (sp_compareScores(sl, x->level[i].forward->score, score) < 0 || 
-                (sp_compareScores(sl, x->level[i].forward->score, score) == 0 && 
-                 (x->level[i].forward->obj - o) <= 0))) {
-            rank += x->level[i].span;
-            x = x->level[i].forward;
-        }
-
-        if (x->obj && (x->obj == o)) {
-            return rank;
-        }
-    }
-    return 0;
+
+size_t sp_slShrink(struct skiplist_sp *sl) {
+    SP_DISPATCH(sl, slShrink(sl));
 }
 
-struct skiplistNode_sp *sp_slGetNodeByRank(struct skiplist_sp *sl, unsigned long rank) {
-    if (rank == 0 || rank > sl->length) {
-        return NULL;
-    }
+void sp_slClear(struct skiplist_sp *sl) {
+    SP_DISPATCH_VOID(sl, slClear(sl));
+}
 
-    struct skiplistNode_sp *x;
-    unsigned long traversed = 0;
-    int i;
-
-    x = sl->header;
-    for (i = sl->level - 1; i >= 0; i--) {
-        while (x->level[i].forward && (traversed + x->level[i].span) <= rank) {
-            traversed += x->level[i].span;
-            x = x->level[i].forward;
-        }
-        if (traversed == rank) {
-            return x;
-        }
-    }
+size_t sp_slMemory(struct skiplist_sp *sl) {
+    SP_DISPATCH(sl, slMemory(sl));
+}
 
-    return NULL;
+int sp_slEnableIndex(struct skiplist_sp *sl) {
+    SP_DISPATCH(sl, slEnableIndex(sl));
 }
 
-int sp_slIsInRange(struct skiplist_sp *sl, int64_t min[2], int64_t max[2]) {
-    struct skiplistNode_sp *x;
+void sp_slSetSeed(struct skiplist_sp *sl, uint64_t seed) {
+    SP_DISPATCH_VOID(sl, slSetSeed(sl, seed));
+}
 
-    if (sp_compareScores(sl, min, max) > 0) {
-        return 0;
-    }
-    x = sl->tail;
-    if (x == NULL || sp_compareScores(sl, x->score, min) < 0)
-        return 0;
+int sp_slInsert(struct skiplist_sp *sl, const int64_t *score, int64_t obj, slDeleteCb cb, void *ud) {
+    SP_DISPATCH(sl, slInsert(sl, score, obj, cb, ud));
+}
 
-    x = sl->header->level[0].forward;
-    if (x == NULL || sp_compareScores(sl, x->score, max) > 0)
-        return 0;
-    return 1;
+int sp_slDelete(struct skiplist_sp *sl, const int64_t *score, int64_t obj) {
+    SP_DISPATCH(sl, slDelete(sl, score, obj));
 }
 
-struct skiplistNode_sp *sp_slFirstInRange(struct skiplist_sp *sl, int64_t min[2], int64_t max[2]) {
-    struct skiplistNode_sp *x;
-    int i;
+int64_t sp_slDeleteTail(struct skiplist_sp *sl) {
+    SP_DISPATCH(sl, slDeleteTail(sl));
+}
 
-    if (!sp_slIsInRange(sl, min, max))
-        return NULL;
+void sp_slSortEntries(struct skiplist_sp *sl, struct skiplistEntry_sp *entries, unsigned long n) {
+    SP_DISPATCH_VOID(sl, slSortEntries(sl, entries, n));
+}
 
-    x = sl->header;
-    for (i = sl->level - 1; i >= 0; i--) {
-        while (x->level[i].forward && sp_compareScores(sl, x->level[i].forward->score, min) < 0)
-            x = x->level[i].forward;
-    }
+int sp_slInsertBatch(struct skiplist_sp *sl, struct skiplistEntry_sp *entries, unsigned long n, unsigned long *stored) {
+    SP_DISPATCH(sl, slInsertBatch(sl, entries, n, stored));
+}
 
-    x = x->level[0].forward;
-    return x;
+unsigned long sp_slDeleteBatch(struct skiplist_sp *sl, struct skiplistEntry_sp *entries, unsigned long n) {
+    SP_DISPATCH(sl, slDeleteBatch(sl, entries, n));
 }
 
-struct skiplistNode_sp *sp_slLastInRange(struct skiplist_sp *sl, int64_t min[2], int64_t max[2]) {
-    struct skiplistNode_sp *x;
-    int i;
+struct skiplistNode_sp *sp_slUpdateScore(struct skiplist_sp *sl, const int64_t *curscore, int64_t obj, const int64_t *newscore) {
+    SP_DISPATCH(sl, slUpdateScore(sl, curscore, obj, newscore));
+}
 
-    if (!sp_slIsInRange(sl, min, max))
-        return NULL;
+unsigned long sp_slDeleteByRank(struct skiplist_sp *sl, unsigned long start, unsigned long end, slDeleteCb cb, void *ud) {
+    SP_DISPATCH(sl, slDeleteByRank(sl, start, end, cb, ud));
+}
 
-    x = sl->header;
-    for (i = sl->level - 1; i >= 0; i--) {
-        while (x->level[i].forward && sp_compareScores(sl, x->level[i].forward->score, max) <= 0)
-            x = x->level[i].forward;
-    }
+unsigned long sp_slDeleteRangeByScore(struct skiplist_sp *sl, const int64_t *min, const int64_t *max, slDeleteCb cb, void *ud) {
+    SP_DISPATCH(sl, slDeleteRangeByScore(sl, min, max, cb, ud));
+}
 
-    return x;
+unsigned long sp_slGetRank(struct skiplist_sp *sl, const int64_t *score, int64_t o) {
+    SP_DISPATCH(sl, slGetRank(sl, score, o));
 }
 
-unsigned long sp_slGetRankByScore(struct skiplist_sp *sl, int64_t score[2]) {
-    if (sl->length == 0) {
-        return 0;
-    }
+void sp_slGetRanks(struct skiplist_sp *sl, struct skiplistEntry_sp *entries, unsigned long n, struct skiplistEntry_sp **order, unsigned long *ranks) {
+    SP_DISPATCH_VOID(sl, slGetRanks(sl, entries, n, order, ranks));
+}
 
-    struct skiplistNode_sp *x;
-    unsigned long rank = 0;
-    int i;
-
-    x = sl->header;
-    for (i = sl->level - 1; i >= 0; i--) {
-        while (x->level[i].forward && 
-               sp_compareScores(sl, x->level[i].forward->score, score) < 0) {
-            rank += x->level[i].span;
-            x = x->level[i].forward;
-        }
-    }
-    return rank + 1;
+struct skiplistNode_sp *sp_slGetNodeRank(struct skiplist_sp *sl, const int64_t *score, int64_t o, unsigned long *rank) {
+    SP_DISPATCH(sl, slGetNodeRank(sl, score, o, rank));
+}
+
+struct skiplistNode_sp *sp_slGetNodeByRank(struct skiplist_sp *sl, unsigned long rank) {
+    SP_DISPATCH(sl, slGetNodeByRank(sl, rank));
+}
+
+void sp_slGetNodesByRank(struct skiplist_sp *sl, const unsigned long *ranks, unsigned long n, struct skiplistNode_sp **nodes) {
+    SP_DISPATCH_VOID(sl, slGetNodesByRank(sl, ranks, n, nodes));
+}
+
+struct skiplistNode_sp *sp_slGetNodeByObj(struct skiplist_sp *sl, int64_t obj) {
+    SP_DISPATCH(sl, slGetNodeByObj(sl, obj));
+}
+
+int sp_slIsInRange(struct skiplist_sp *sl, const int64_t *min, const int64_t *max) {
+    SP_DISPATCH(sl, slIsInRange(sl, min, max));
+}
+
+struct skiplistNode_sp *sp_slFirstInRange(struct skiplist_sp *sl, const int64_t *min, const int64_t *max) {
+    SP_DISPATCH(sl, slFirstInRange(sl, min, max));
+}
+
+struct skiplistNode_sp *sp_slLastInRange(struct skiplist_sp *sl, const int64_t *min, const int64_t *max) {
+    SP_DISPATCH(sl, slLastInRange(sl, min, max));
+}
+
+unsigned long sp_slGetRankByScore(struct skiplist_sp *sl, const int64_t *score) {
+    SP_DISPATCH(sl, slGetRankByScore(sl, score));
+}
+
+unsigned long sp_slCountBefore(struct skiplist_sp *sl, const int64_t *score, int inclusive) {
+    SP_DISPATCH(sl, slCountBefore(sl, score, inclusive));
+}
+
+unsigned long sp_slCountInRange(struct skiplist_sp *sl, const int64_t *min, const int64_t *max) {
+    SP_DISPATCH(sl, slCountInRange(sl, min, max));
+}
+
+void sp_slCountBeforeBatch(struct skiplist_sp *sl, const int64_t *scores, unsigned long n, unsigned long *counts) {
+    SP_DISPATCH_VOID(sl, slCountBeforeBatch(sl, scores, n, counts));
+}
+
+void sp_slBuildBegin(struct skiplist_sp *sl, struct skiplistBuilder_sp *b, int deterministic) {
+    SP_DISPATCH_VOID(sl, slBuildBegin(sl, b, deterministic));
+}
+
+int sp_slBuildAppend(struct skiplistBuilder_sp *b, const int64_t *score, int64_t obj) {
+    SP_DISPATCH(b->sl, slBuildAppend(b, score, obj));
+}
+
+void sp_slBuildEnd(struct skiplistBuilder_sp *b) {
+    SP_DISPATCH_VOID(b->sl, slBuildEnd(b));
+}
+
+int sp_slBuildSorted(struct skiplist_sp *sl, const struct skiplistEntry_sp *entries, unsigned long n, int deterministic) {
+    SP_DISPATCH(sl, slBuildSorted(sl, entries, n, deterministic));
 }
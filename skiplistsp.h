@@ -2,41 +2,197 @@
 #define SKIPLIST_SP_HH
 
 #include <stdint.h>
+#include "slpool.h"
+#include "slkey.h"
 
+#define SKIPLIST_MAXLEVEL 32
+#define SKIPLIST_SP_MAXKEY 8
+
+// 节点前紧挨着存放 nkey 个分量的保序编码, 用 sp_slNodeScore 读取
 struct skiplistNode_sp {
     int64_t obj;
-    int64_t score[2];
+#if SKIPLIST_COMPACT
+    uint32_t backward;     // 前一个节点的 ref, 见 slpool.h
+    uint32_t self;         // 本节点的 ref
+    struct skiplistLevel {
+        uint32_t forward;
+        slSpan span;
+    } level[];
+#else
     struct skiplistNode_sp *backward;
     struct skiplistLevel {
         struct skiplistNode_sp *forward;
-        unsigned int span;
+#if SKIPLIST_LINKKEY
+        uint64_t fkey;      // forward 节点 key 的首字, forward 为 NULL 时无意义
+#endif
+        slSpan span;
+        unsigned int height; // 节点层数, 只在 level[0] 维护
     } level[];
+#endif
 };
 
+struct slIndex;
+
 struct skiplist_sp {
     struct skiplistNode_sp *header, *tail;
     unsigned long length;
     int level;
-    char cmp[2];
+    int nkey;                         // score 分量数
+    char cmp[SKIPLIST_SP_MAXKEY];     // 各分量方向, 1 为降序
+    struct slIndex *index; // obj -> node, NULL 表示未开启
+    char autoshrink;       // 删除较多时自动把空闲 slab 还给系统
+    unsigned long maxlength; // 长度上限, 0 表示不限
+    uint64_t rand;         // 层数随机数状态
+    slAllocator alloc;
+    slPool pool;
+};
+
+// nkey 之后的分量须为 0
+struct skiplistEntry_sp {
+    int64_t score[SKIPLIST_SP_MAXKEY];
+    int64_t obj;
+};
+
+struct skiplistBuilder_sp {
+    struct skiplist_sp *sl;
+    struct skiplistNode_sp *last[SKIPLIST_MAXLEVEL];
+    unsigned long lastrank[SKIPLIST_MAXLEVEL];
+    int deterministic;
+    int haslast;           // 已追加过元素, 超出 maxlength 被丢弃的也算
+    uint64_t lastkey[SKIPLIST_SP_MAXKEY]; // 最后追加的元素, 下一个须排在它之后
+    int64_t lastobj;
 };
 
 typedef void (*slDeleteCb)(void *ud, int64_t obj);
-void sp_slFreeNode(struct skiplistNode_sp *node);
-int sp_compareScores(struct skiplist_sp *sl, int64_t score1[2], int64_t score2[2]);
+void sp_slFreeNode(struct skiplist_sp *sl, struct skiplistNode_sp *node, int level);
+
+/* The encoded key of x, see slkey.h */
+static inline uint64_t *sp_slKey(const struct skiplist_sp *sl, const struct skiplistNode_sp *x) {
+    return (uint64_t *)x - sl->nkey;
+}
+
+/* The node after x in list order, NULL past the tail. sp_slNext(sl,
+ * sl->header) is the first node. */
+static inline struct skiplistNode_sp *sp_slNext(const struct skiplist_sp *sl, const struct skiplistNode_sp *x) {
+#if SKIPLIST_COMPACT
+    return slPoolPtr(&sl->pool, x->level[0].forward);
+#else
+    (void)sl;
+    return x->level[0].forward;
+#endif
+}
+
+/* The node before x, NULL for the first node */
+static inline struct skiplistNode_sp *sp_slPrev(const struct skiplist_sp *sl, const struct skiplistNode_sp *x) {
+#if SKIPLIST_COMPACT
+    return slPoolPtr(&sl->pool, x->backward);
+#else
+    (void)sl;
+    return x->backward;
+#endif
+}
 
-struct skiplist_sp *sp_slCreate(char cmp0, char cmp1);
+static inline uint64_t sp_slFlip(const struct skiplist_sp *sl, int j) {
+    return slKeyFlip(sl->cmp[j]);
+}
+
+/* The helpers taking n are meant to be called with a constant arity,
+ * see slimplsp.h, and then compile to straight line code */
+static inline void sp_slScoreKeyN(const struct skiplist_sp *sl, const int64_t *score, uint64_t *key, int n) {
+    int j;
+    for (j = 0; j < n; j++)
+        key[j] = slEncodeInt(score[j], sp_slFlip(sl, j));
+}
+
+static inline void sp_slScoreKey(const struct skiplist_sp *sl, const int64_t *score, uint64_t *key) {
+    sp_slScoreKeyN(sl, score, key, sl->nkey);
+}
+
+/* Component j of the score of x */
+static inline int64_t sp_slNodeScore(const struct skiplist_sp *sl, const struct skiplistNode_sp *x, int j) {
+    return slDecodeInt(sp_slKey(sl, x)[j], sp_slFlip(sl, j));
+}
+
+static inline void sp_slNodeScores(const struct skiplist_sp *sl, const struct skiplistNode_sp *x, int64_t *score) {
+    int j;
+    for (j = 0; j < sl->nkey; j++)
+        score[j] = sp_slNodeScore(sl, x, j);
+}
+
+/* Whether key k1/o1 of n components orders strictly before k2/o2. The
+ * keys are encoded, so no direction is looked at; the last component and
+ * the obj go through one 128-bit compare. */
+static inline int sp_slKeyLessN(const uint64_t *k1, int64_t o1, const uint64_t *k2, int64_t o2, int n) {
+    int i;
+    for (i = 0; i < n - 1; i++)
+        if (k1[i] != k2[i])
+            return k1[i] < k2[i];
+    return slKeyLess(k1[n - 1], o1, k2[n - 1], o2);
+}
+
+static inline int sp_slKeyCmpN(const uint64_t *k1, const uint64_t *k2, int n) {
+    int i;
+    for (i = 0; i < n; i++)
+        if (k1[i] != k2[i])
+            return k1[i] < k2[i] ? -1 : 1;
+    return 0;
+}
+
+static inline int sp_slKeyLess(const struct skiplist_sp *sl, const uint64_t *k1, int64_t o1, const uint64_t *k2, int64_t o2) {
+    return sp_slKeyLessN(k1, o1, k2, o2, sl->nkey);
+}
+
+static inline int sp_slKeyCmp(const struct skiplist_sp *sl, const uint64_t *k1, const uint64_t *k2) {
+    return sp_slKeyCmpN(k1, k2, sl->nkey);
+}
+
+/* Lexicographic compare of two plain scores in list order, for callers
+ * that hold scores rather than encoded keys */
+static inline int sp_compareScores(const struct skiplist_sp *sl, const int64_t *a, const int64_t *b) {
+    int i;
+    for (i = 0; i < sl->nkey; i++)
+        if (a[i] != b[i])
+            return (a[i] < b[i]) != sl->cmp[i] ? -1 : 1;
+    return 0;
+}
+
+struct skiplist_sp *sp_slCreate(int nkey, const char *cmp, slAllocFn allocf, void *ud);
 void sp_slFree(struct skiplist_sp *sl);
+void sp_slClear(struct skiplist_sp *sl);
+size_t sp_slMemory(struct skiplist_sp *sl);
+int sp_slEnableIndex(struct skiplist_sp *sl);
+void sp_slSetSeed(struct skiplist_sp *sl, uint64_t seed);
+size_t sp_slShrink(struct skiplist_sp *sl);
 
-void sp_slInsert(struct skiplist_sp *sl, int64_t score[2], int64_t obj);
-int sp_slDelete(struct skiplist_sp *sl, int64_t score[2], int64_t obj);
-unsigned long sp_slDeleteByRank(struct skiplist_sp *sl, unsigned int start, unsigned int end, slDeleteCb cb, void *ud);
+int sp_slInsert(struct skiplist_sp *sl, const int64_t *score, int64_t obj, slDeleteCb cb, void *ud);
+int sp_slDelete(struct skiplist_sp *sl, const int64_t *score, int64_t obj);
+int64_t sp_slDeleteTail(struct skiplist_sp *sl);
+void sp_slSortEntries(struct skiplist_sp *sl, struct skiplistEntry_sp *entries, unsigned long n);
+int sp_slInsertBatch(struct skiplist_sp *sl, struct skiplistEntry_sp *entries, unsigned long n, unsigned long *stored);
+unsigned long sp_slDeleteBatch(struct skiplist_sp *sl, struct skiplistEntry_sp *entries, unsigned long n);
+struct skiplistNode_sp *sp_slUpdateScore(struct skiplist_sp *sl, const int64_t *curscore, int64_t obj, const int64_t *newscore);
+unsigned long sp_slDeleteByRank(struct skiplist_sp *sl, unsigned long start, unsigned long end, slDeleteCb cb, void *ud);
+unsigned long sp_slDeleteRangeByScore(struct skiplist_sp *sl, const int64_t *min, const int64_t *max, slDeleteCb cb, void *ud);
 
-unsigned long sp_slGetRank(struct skiplist_sp *sl, int64_t score[2], int64_t o);
+unsigned long sp_slGetRank(struct skiplist_sp *sl, const int64_t *score, int64_t o);
+void sp_slGetRanks(struct skiplist_sp *sl, struct skiplistEntry_sp *entries, unsigned long n, struct skiplistEntry_sp **order, unsigned long *ranks);
+struct skiplistNode_sp *sp_slGetNodeRank(struct skiplist_sp *sl, const int64_t *score, int64_t o, unsigned long *rank);
 struct skiplistNode_sp *sp_slGetNodeByRank(struct skiplist_sp *sl, unsigned long rank);
+void sp_slGetNodesByRank(struct skiplist_sp *sl, const unsigned long *ranks, unsigned long n, struct skiplistNode_sp **nodes);
+struct skiplistNode_sp *sp_slGetNodeByObj(struct skiplist_sp *sl, int64_t obj);
+
+int sp_slIsInRange(struct skiplist_sp *sl, const int64_t *min, const int64_t *max);
+struct skiplistNode_sp *sp_slFirstInRange(struct skiplist_sp *sl, const int64_t *min, const int64_t *max);
+struct skiplistNode_sp *sp_slLastInRange(struct skiplist_sp *sl, const int64_t *min, const int64_t *max);
 
-struct skiplistNode_sp *sp_slFirstInRange(struct skiplist_sp *sl, int64_t min[2], int64_t max[2]);
-struct skiplistNode_sp *sp_slLastInRange(struct skiplist_sp *sl, int64_t min[2], int64_t max[2]);
+unsigned long sp_slGetRankByScore(struct skiplist_sp *sl, const int64_t *score);
+unsigned long sp_slCountBefore(struct skiplist_sp *sl, const int64_t *score, int inclusive);
+unsigned long sp_slCountInRange(struct skiplist_sp *sl, const int64_t *min, const int64_t *max);
+void sp_slCountBeforeBatch(struct skiplist_sp *sl, const int64_t *scores, unsigned long n, unsigned long *counts);
 
-unsigned long sp_slGetRankByScore(struct skiplist_sp *sl, int64_t score[2]);
+void sp_slBuildBegin(struct skiplist_sp *sl, struct skiplistBuilder_sp *b, int deterministic);
+int sp_slBuildAppend(struct skiplistBuilder_sp *b, const int64_t *score, int64_t obj);
+void sp_slBuildEnd(struct skiplistBuilder_sp *b);
+int sp_slBuildSorted(struct skiplist_sp *sl, const struct skiplistEntry_sp *entries, unsigned long n, int deterministic);
 
 #endif //SKIPLIST_SP_HH
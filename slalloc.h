@@ -0,0 +1,51 @@
+#ifndef SLALLOC_HH
+#define SLALLOC_HH
+
+#include <stddef.h>
+#include <stdlib.h>
+
+// 与 lua_Alloc 相同的签名，可以直接使用 lua_getallocf 的返回值
+// 分配失败(例如 skynet 服务超出内存上限)时返回 NULL, 由调用者逐层返回错误
+typedef void *(*slAllocFn)(void *ud, void *ptr, size_t osize, size_t nsize);
+
+typedef struct slAllocator {
+    slAllocFn fn;
+    void *ud;
+    size_t used;  // 当前通过该分配器申请的字节数
+} slAllocator;
+
+static inline void *slDefaultAlloc(void *ud, void *ptr, size_t osize, size_t nsize) {
+    (void)ud;
+    (void)osize;
+    if (nsize == 0) {
+        free(ptr);
+        return NULL;
+    }
+    return realloc(ptr, nsize);
+}
+
+static inline void slAllocatorInit(slAllocator *a, slAllocFn fn, void *ud) {
+    a->fn = fn ? fn : slDefaultAlloc;
+    a->ud = fn ? ud : NULL;
+    a->used = 0;
+}
+
+// 状态码: 分配失败, 结构保持调用前的状态
+#define SL_ENOMEM (-1)
+
+/* NULL when the allocator refuses, nothing is accounted then */
+static inline void *slMemAlloc(slAllocator *a, size_t size) {
+    void *p = a->fn(a->ud, NULL, 0, size);
+    if (p != NULL)
+        a->used += size;
+    return p;
+}
+
+static inline void slMemFree(slAllocator *a, void *p, size_t size) {
+    if (p == NULL)
+        return;
+    a->fn(a->ud, p, size, 0);
+    a->used -= size;
+}
+
+#endif //SLALLOC_HH
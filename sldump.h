@@ -0,0 +1,63 @@
+#ifndef SLDUMP_HH
+#define SLDUMP_HH
+
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * 快照格式, 所有整数均为小端:
+ *   header: "SKL" version(1) kind(1) cmp(1) reserved(2) length(8)
+ *   record: obj(8) score(8 * 分量数), 按 rank 顺序排列
+ * kind 为 score 分量数, 单分量的整数版本用 0x41 以区别于 double 版本,
+ * double 版本的 score 以 IEEE754 位模式保存; cmp 每个分量占一位。
+ */
+#define SLDUMP_VERSION 1
+#define SLDUMP_HEADSIZE 16
+#define SLDUMP_CHUNK 4096 // 文件读写时每批处理的记录数
+
+static inline void slDumpPutU64(char *p, uint64_t v) {
+    int i;
+    for (i = 0; i < 8; i++)
+        p[i] = (char)(v >> (i * 8));
+}
+
+static inline uint64_t slDumpGetU64(const char *p) {
+    uint64_t v = 0;
+    int i;
+    for (i = 0; i < 8; i++)
+        v |= (uint64_t)(unsigned char)p[i] << (i * 8);
+    return v;
+}
+
+static inline void slDumpPutDouble(char *p, double d) {
+    uint64_t v;
+    memcpy(&v, &d, sizeof(v));
+    slDumpPutU64(p, v);
+}
+
+static inline double slDumpGetDouble(const char *p) {
+    uint64_t v = slDumpGetU64(p);
+    double d;
+    memcpy(&d, &v, sizeof(d));
+    return d;
+}
+
+static inline void slDumpPutHeader(char *p, int kind, int cmp, uint64_t length) {
+    memcpy(p, "SKL", 3);
+    p[3] = SLDUMP_VERSION;
+    p[4] = (char)kind;
+    p[5] = (char)cmp;
+    p[6] = p[7] = 0;
+    slDumpPutU64(p + 8, length);
+}
+
+/* Returns 0 if p is not a snapshot header of the given kind */
+static inline int slDumpGetHeader(const char *p, int kind, int *cmp, uint64_t *length) {
+    if (memcmp(p, "SKL", 3) != 0 || p[3] != SLDUMP_VERSION || p[4] != kind)
+        return 0;
+    *cmp = (unsigned char)p[5];
+    *length = slDumpGetU64(p + 8);
+    return 1;
+}
+
+#endif //SLDUMP_HH
@@ -0,0 +1,1025 @@
+/*
+ * Key-type independent skiplist core, included once by skiplist.c and
+ * once by skiplistsp.c. No include guard on purpose: every includer gets
+ * its own instance. The includer defines
+ *
+ *   SL_NAME(n)            public name of n, e.g. sp_##n
+ *   SL_LIST, SL_NODE      list and node types
+ *   SL_ENTRY, SL_BUILDER  batch entry and builder types
+ *   SL_KEY                a score as callers pass it (double, const int64_t *)
+ *   SL_KEYS               an array of scores in list order
+ *   SL_KEYAT(sl, ks, k)   the k-th score of an SL_KEYS array
+ *   SL_IKEY               an encoded key as nodes hold it, see slkey.h
+ *   SL_DECLKEY(k)         declare k able to hold an encoded key
+ *   SL_ENCODE(sl, k, s)   encode score s into k
+ *   SL_NODEKEY(sl, x)     the encoded key of node x
+ *   SL_SETKEY(sl, x, k)   store encoded key k into node x
+ *   SL_COPYKEY(sl, d, k)  copy encoded key k into d, declared by SL_DECLKEY
+ *   SL_LESS(sl, a, ao, b, bo)  a/ao orders strictly before b/bo
+ *   SL_CMP(sl, a, b)      <0, 0, >0 of two encoded keys
+ *   SL_KEYWORD(k)         the first word of encoded key k
+ *   SL_ONEWORD(sl)        whether keys are a single word
+ *   SL_FN                 storage class of the public functions, empty
+ *                         unless the includer wraps the instance
+ *
+ * Scores are encoded once when they enter a public function; from there
+ * on the list order is the plain unsigned order of the encoded keys, so
+ * the descents never look at cmp.
+ *
+ * With SKIPLIST_LINKKEY every link also caches the first key word of the
+ * node it points at, so a descent settles most steps from the node it
+ * stands on and only loads the nodes it actually moves to. Whatever sets
+ * a forward pointer goes through slSetForward/slTakeLink to keep it right.
+ *
+ * The includer provides before the include:
+ *   SL_NODE *slCreateNode(SL_LIST *sl, int level, SL_IKEY key, int64_t obj);
+ *       (with SKIPLIST_COMPACT it also sets the node's own ref, self;
+ *       NULL when the pool cannot grow)
+ *   void slFreeNode(SL_LIST *sl, SL_NODE *node, int level);
+ *   int slEntryCmp(const void *a, const void *b);   ascending qsort order
+ *   void slFlipEntries(SL_LIST *sl, SL_ENTRY *entries, unsigned long n);
+ *       (all under SL_NAME) turns list order into ascending order and back
+ *
+ * Everything else, from the descent to the linear builder, lives here so
+ * both variants keep the same behaviour.
+ *
+ * Functions that allocate return SL_ENOMEM when the allocator refuses.
+ * They allocate before touching the list, so it is left as it was.
+ */
+
+/* Links as nodes. With SKIPLIST_COMPACT they hold 32-bit pool refs that
+ * are resolved through the slot table, otherwise plain pointers. A link
+ * is 0 exactly when it leads nowhere, so it can be tested directly. */
+#if SKIPLIST_COMPACT
+#define SL_LINKNODE(sl, l) ((SL_NODE *)slPoolPtr(&(sl)->pool, (l)->forward))
+#define SL_BACKWARD(sl, x) ((SL_NODE *)slPoolPtr(&(sl)->pool, (x)->backward))
+#define SL_REF(x) ((x) ? (x)->self : 0)
+#else
+#define SL_LINKNODE(sl, l) ((l)->forward)
+#define SL_BACKWARD(sl, x) ((x)->backward)
+#define SL_REF(x) (x)
+#endif
+#define SL_FORWARD(sl, x, i) SL_LINKNODE(sl, &(x)->level[i])
+#define SL_SETBACKWARD(x, p) ((x)->backward = SL_REF(p))
+
+#define SKIPLIST_SHRINK_MIN 1024
+
+#ifndef SL_FN
+#define SL_FN
+#endif
+
+/* Give fully free slabs back to the system, returns the bytes released */
+SL_FN size_t SL_NAME(slShrink)(SL_LIST *sl) {
+    return slPoolShrink(&sl->pool);
+}
+
+/* With autoshrink on, shrink once the frees since the last shrink
+ * outnumber the live nodes, which keeps the cost amortized. */
+static inline void SL_NAME(slMaybeShrink)(SL_LIST *sl) {
+    if (sl->autoshrink && sl->pool.freed > SKIPLIST_SHRINK_MIN && sl->pool.freed > sl->length)
+        slPoolShrink(&sl->pool);
+}
+
+/* Remove every element, keeping the options of the list */
+SL_FN void SL_NAME(slClear)(SL_LIST *sl) {
+    int j;
+
+    slPoolRelease(&sl->pool);
+    for (j = 0; j < SKIPLIST_MAXLEVEL; j++) {
+        sl->header->level[j].forward = 0;
+        sl->header->level[j].span = 0;
+    }
+    sl->level = 1;
+    sl->length = 0;
+    sl->tail = NULL;
+    if (sl->index)
+        slIndexClear(sl->index);
+}
+
+/* Bytes held by the list: the list itself, header, node slabs and index */
+SL_FN size_t SL_NAME(slMemory)(SL_LIST *sl) {
+    return sl->alloc.used;
+}
+
+/* Build the obj -> node index so members can be found without their score.
+ * Returns 0 if the list already holds duplicated objs, which the index
+ * cannot represent. */
+SL_FN int SL_NAME(slEnableIndex)(SL_LIST *sl) {
+    SL_NODE *x;
+
+    if (sl->index)
+        return 1;
+    sl->index = slIndexCreate(&sl->alloc);
+    if (sl->index == NULL)
+        return SL_ENOMEM;
+    if (!slIndexReserve(sl->index, sl->length)) {
+        slIndexFree(sl->index);
+        sl->index = NULL;
+        return SL_ENOMEM;
+    }
+    for (x = SL_FORWARD(sl, sl->header, 0); x; x = SL_FORWARD(sl, x, 0)) {
+        if (slIndexGet(sl->index, x->obj)) {
+            slIndexFree(sl->index);
+            sl->index = NULL;
+            return 0;
+        }
+        slIndexSet(sl->index, x->obj, x);
+    }
+    return 1;
+}
+
+/* Seed the per-list level generator, the same seed gives the same levels */
+SL_FN void SL_NAME(slSetSeed)(SL_LIST *sl, uint64_t seed) {
+    sl->rand = slRandSeed(seed);
+}
+
+/* Whether x orders strictly before key/obj */
+static inline int SL_NAME(slNodeBefore)(SL_LIST *sl, SL_NODE *x, SL_IKEY key, int64_t obj) {
+    return SL_LESS(sl, SL_NODEKEY(sl, x), x->obj, key, obj);
+}
+
+/* Whether x holds exactly key/obj */
+static inline int SL_NAME(slNodeIs)(SL_LIST *sl, SL_NODE *x, SL_IKEY key, int64_t obj) {
+    return x && x->obj == obj && SL_CMP(sl, SL_NODEKEY(sl, x), key) == 0;
+}
+
+/* Point link i of x at f */
+static inline void SL_NAME(slSetForward)(SL_LIST *sl, SL_NODE *x, int i, SL_NODE *f) {
+    x->level[i].forward = SL_REF(f);
+#if SKIPLIST_LINKKEY
+    if (f)
+        x->level[i].fkey = SL_KEYWORD(SL_NODEKEY(sl, f));
+#endif
+}
+
+/* Let link i of x lead where link i of y does, spans are left alone */
+static inline void SL_NAME(slTakeLink)(SL_NODE *x, SL_NODE *y, int i) {
+    x->level[i].forward = y->level[i].forward;
+#if SKIPLIST_LINKKEY
+    x->level[i].fkey = y->level[i].fkey;
+#endif
+}
+
+/* Whether the node link l leads to orders strictly before key/obj. A
+ * cached word that differs decides alone, only ties load the node. */
+static inline int SL_NAME(slLinkBefore)(SL_LIST *sl, const struct skiplistLevel *l, SL_IKEY key, int64_t obj) {
+#if SKIPLIST_LINKKEY
+    if (l->fkey != SL_KEYWORD(key))
+        return l->fkey < SL_KEYWORD(key);
+#endif
+    return SL_NAME(slNodeBefore)(sl, SL_LINKNODE(sl, l), key, obj);
+}
+
+/* Whether key/obj orders strictly before the node link l leads to */
+static inline int SL_NAME(slLinkAfter)(SL_LIST *sl, const struct skiplistLevel *l, SL_IKEY key, int64_t obj) {
+#if SKIPLIST_LINKKEY
+    if (l->fkey != SL_KEYWORD(key))
+        return SL_KEYWORD(key) < l->fkey;
+#endif
+    return SL_LESS(sl, key, obj, SL_NODEKEY(sl, SL_LINKNODE(sl, l)), SL_LINKNODE(sl, l)->obj);
+}
+
+/* <0, 0, >0 of the key of the node link l leads to against key */
+static inline int SL_NAME(slLinkCmp)(SL_LIST *sl, const struct skiplistLevel *l, SL_IKEY key) {
+#if SKIPLIST_LINKKEY
+    if (l->fkey != SL_KEYWORD(key))
+        return l->fkey < SL_KEYWORD(key) ? -1 : 1;
+    if (SL_ONEWORD(sl))
+        return 0;
+#endif
+    return SL_CMP(sl, SL_NODEKEY(sl, SL_LINKNODE(sl, l)), key);
+}
+
+/* x took a new key in place: refresh the word cached by the links that
+ * point at x. On level i that is the closest node before x standing
+ * higher than i, so the walk back only climbs. */
+static void SL_NAME(slRefreshLinks)(SL_LIST *sl, SL_NODE *x) {
+#if SKIPLIST_LINKKEY
+    SL_NODE *p = x->backward ? x->backward : sl->header;
+    uint64_t w = SL_KEYWORD(SL_NODEKEY(sl, x));
+    unsigned int i, height = x->level[0].height;
+
+    if (p->level[0].fkey == w)
+        return;
+    for (i = 0; i < height; i++) {
+        while (p->level[0].height <= i)
+            p = p->backward ? p->backward : sl->header;
+        p->level[i].fkey = w;
+    }
+#else
+    (void)sl;
+    (void)x;
+#endif
+}
+
+static int SL_NAME(slIsInRangeKey)(SL_LIST *sl, SL_IKEY min, SL_IKEY max);
+
+/* Descend to the position of key/obj: update[i] gets the last node
+ * before it on level i and rank[i] the rank of that node. With finger set,
+ * update[]/rank[] still hold the position of a smaller key from the last
+ * call and every level resumes from whichever node is further ahead. */
+static void SL_NAME(slFindPosition)(SL_LIST *sl, SL_IKEY key, int64_t obj, SL_NODE **update, unsigned long *rank, int finger) {
+    SL_NODE *x = sl->header;
+    unsigned long r = 0;
+    int i;
+
+    for (i = sl->level - 1; i >= 0; i--) {
+        if (finger && rank[i] > r) {
+            x = update[i];
+            r = rank[i];
+        }
+        /* store rank that is crossed to reach the insert position */
+        while (x->level[i].forward && SL_NAME(slLinkBefore)(sl, &x->level[i], key, obj)) {
+            r += x->level[i].span;
+            x = SL_FORWARD(sl, x, i);
+        }
+        update[i] = x;
+        rank[i] = r;
+    }
+}
+
+/* Same descent without ranks, for the paths that only unlink */
+static void SL_NAME(slFindUpdate)(SL_LIST *sl, SL_IKEY key, int64_t obj, SL_NODE **update) {
+    SL_NODE *x = sl->header;
+    int i;
+
+    for (i = sl->level - 1; i >= 0; i--) {
+        while (x->level[i].forward && SL_NAME(slLinkBefore)(sl, &x->level[i], key, obj))
+            x = SL_FORWARD(sl, x, i);
+        update[i] = x;
+    }
+}
+
+/* Link x of the given level after the position found by slFindPosition.
+ * Afterwards update[]/rank[] describe the position right after x, so they
+ * can serve as the finger for a following larger key. */
+static void SL_NAME(slLinkNode)(SL_LIST *sl, SL_NODE *x, int level, SL_NODE **update, unsigned long *rank) {
+    unsigned long xrank = rank[0] + 1;
+    int i;
+
+    if (level > sl->level) {
+        for (i = sl->level; i < level; i++) {
+            rank[i] = 0;
+            update[i] = sl->header;
+            update[i]->level[i].span = sl->length;
+        }
+        sl->level = level;
+    }
+    for (i = 0; i < level; i++) {
+        SL_NAME(slTakeLink)(x, update[i], i);
+        SL_NAME(slSetForward)(sl, update[i], i, x);
+
+        /* update span covered by update[i] as x is inserted here */
+        x->level[i].span = update[i]->level[i].span - (rank[0] - rank[i]);
+        update[i]->level[i].span = (rank[0] - rank[i]) + 1;
+    }
+
+    /* increment span for untouched levels */
+    for (i = level; i < sl->level; i++) {
+        update[i]->level[i].span++;
+    }
+
+    SL_SETBACKWARD(x, update[0] == sl->header ? NULL : update[0]);
+    if (x->level[0].forward)
+        SL_SETBACKWARD(SL_FORWARD(sl, x, 0), x);
+    else
+        sl->tail = x;
+    sl->length++;
+    if (sl->index)
+        slIndexSet(sl->index, x->obj, x);
+
+    for (i = 0; i < level; i++) {
+        update[i] = x;
+        rank[i] = xrank;
+    }
+}
+
+/* Link an allocated node of the given level at the position of its
+ * score/obj. Shared by slInsert and slUpdateScore. */
+static void SL_NAME(slInsertNode)(SL_LIST *sl, SL_NODE *x, int level) {
+    SL_NODE *update[SKIPLIST_MAXLEVEL];
+    unsigned long rank[SKIPLIST_MAXLEVEL];
+
+    SL_NAME(slFindPosition)(sl, SL_NODEKEY(sl, x), x->obj, update, rank, 0);
+    SL_NAME(slLinkNode)(sl, x, level, update, rank);
+}
+
+/* Internal function used by slDelete, slDeleteByScore
+ * Returns the level of the unlinked node. */
+SL_FN int SL_NAME(slDeleteNode)(SL_LIST *sl, SL_NODE *x, SL_NODE **update) {
+    int i, level = 0;
+    for (i = 0; i < sl->level; i++) {
+        if (SL_FORWARD(sl, update[i], i) == x) {
+            level++;
+            update[i]->level[i].span += x->level[i].span - 1;
+            SL_NAME(slTakeLink)(update[i], x, i);
+        } else {
+            update[i]->level[i].span -= 1;
+        }
+    }
+    if (x->level[0].forward) {
+        SL_FORWARD(sl, x, 0)->backward = x->backward;
+    } else {
+        sl->tail = SL_BACKWARD(sl, x);
+    }
+    while (sl->level > 1 && !sl->header->level[sl->level - 1].forward)
+        sl->level--;
+    sl->length--;
+    if (sl->index)
+        slIndexRemove(sl->index, x->obj);
+    return level;
+}
+
+/* Remove the last element and return its obj, the list must not be empty.
+ * The predecessors are found by running each level to its end, so no
+ * score is compared. */
+SL_FN int64_t SL_NAME(slDeleteTail)(SL_LIST *sl) {
+    SL_NODE *update[SKIPLIST_MAXLEVEL], *x, *tail = sl->tail;
+    int64_t obj = tail->obj;
+    int i;
+
+    x = sl->header;
+    for (i = sl->level - 1; i >= 0; i--) {
+        while (x->level[i].forward && SL_FORWARD(sl, x, i) != tail)
+            x = SL_FORWARD(sl, x, i);
+        update[i] = x;
+    }
+    SL_NAME(slFreeNode)(sl, tail, SL_NAME(slDeleteNode)(sl, tail, update));
+    SL_NAME(slMaybeShrink)(sl);
+    return obj;
+}
+
+/* With maxlength set and the list full, whether key/obj may still enter:
+ * 0 if it would land past the tail */
+static int SL_NAME(slHasRoom)(SL_LIST *sl, SL_IKEY key, int64_t obj) {
+    if (sl->maxlength == 0 || sl->length < sl->maxlength)
+        return 1;
+    return SL_LESS(sl, key, obj, SL_NODEKEY(sl, sl->tail), sl->tail->obj);
+}
+
+/* Evict the tail of a full capped list, reported through cb (which may
+ * be NULL), once slHasRoom let a new element in */
+static void SL_NAME(slMakeRoom)(SL_LIST *sl, slDeleteCb cb, void *ud) {
+    int64_t obj;
+
+    if (sl->maxlength == 0 || sl->length < sl->maxlength)
+        return;
+    obj = SL_NAME(slDeleteTail)(sl);
+    if (cb)
+        cb(ud, obj);
+}
+
+/* A node for key/obj with room for it in the index, NULL if either
+ * cannot be had */
+static SL_NODE *SL_NAME(slNewNode)(SL_LIST *sl, int level, SL_IKEY key, int64_t obj) {
+    if (sl->index && !slIndexReserve(sl->index, sl->index->count + 1))
+        return NULL;
+    return SL_NAME(slCreateNode)(sl, level, key, obj);
+}
+
+/* Check whether x may take newkey without leaving its position */
+static inline int SL_NAME(slFitsInPlace)(SL_LIST *sl, SL_NODE *x, SL_IKEY newkey) {
+    SL_NODE *prev = SL_BACKWARD(sl, x), *next = SL_FORWARD(sl, x, 0);
+
+    return (prev == NULL || SL_LESS(sl, SL_NODEKEY(sl, prev), prev->obj, newkey, x->obj)) &&
+        (next == NULL || SL_LESS(sl, newkey, x->obj, SL_NODEKEY(sl, next), next->obj));
+}
+
+/* Give node x, found with its predecessors in update (or NULL when it was
+ * found through the index), the key newkey. */
+static void SL_NAME(slMoveNode)(SL_LIST *sl, SL_NODE *x, SL_NODE **update, SL_IKEY newkey) {
+    SL_NODE *found[SKIPLIST_MAXLEVEL];
+    int level;
+
+    if (SL_NAME(slFitsInPlace)(sl, x, newkey)) {
+        SL_SETKEY(sl, x, newkey);
+        SL_NAME(slRefreshLinks)(sl, x);
+        return;
+    }
+    if (update == NULL) {
+        SL_NAME(slFindUpdate)(sl, SL_NODEKEY(sl, x), x->obj, found);
+        update = found;
+    }
+    level = SL_NAME(slDeleteNode)(sl, x, update);
+    SL_SETKEY(sl, x, newkey);
+    SL_NAME(slInsertNode)(sl, x, level);
+}
+
+/* Update the score of an element, reusing its node.
+ * When the new score keeps the node between its neighbours only the score
+ * is rewritten, otherwise the node is unlinked and linked again at its new
+ * position with the same level. Returns the node, NULL if not found. */
+SL_FN SL_NODE *SL_NAME(slUpdateScore)(SL_LIST *sl, SL_KEY curscore, int64_t obj, SL_KEY newscore) {
+    SL_NODE *update[SKIPLIST_MAXLEVEL], *x;
+    SL_DECLKEY(cur);
+    SL_DECLKEY(key);
+
+    SL_ENCODE(sl, cur, curscore);
+    SL_ENCODE(sl, key, newscore);
+
+    /* with the index the node is known without a search */
+    if (sl->index) {
+        x = slIndexGet(sl->index, obj);
+        if (!SL_NAME(slNodeIs)(sl, x, cur, obj))
+            return NULL;
+        SL_NAME(slMoveNode)(sl, x, NULL, key);
+        return x;
+    }
+
+    SL_NAME(slFindUpdate)(sl, cur, obj, update);
+    x = SL_FORWARD(sl, update[0], 0);
+    if (!SL_NAME(slNodeIs)(sl, x, cur, obj))
+        return NULL; /* not found */
+    SL_NAME(slMoveNode)(sl, x, update, key);
+    return x;
+}
+
+/* Returns 0 if the list is capped and full and the element ranks after
+ * the tail, nothing is allocated then. */
+SL_FN int SL_NAME(slInsert)(SL_LIST *sl, SL_KEY score, int64_t obj, slDeleteCb cb, void *ud) {
+    SL_NODE *x;
+    int level;
+    SL_DECLKEY(key);
+
+    SL_ENCODE(sl, key, score);
+    if (sl->index) {
+        /* with the index enabled an existing obj is replaced */
+        x = slIndexGet(sl->index, obj);
+        if (x) {
+            SL_NAME(slMoveNode)(sl, x, NULL, key);
+            return 1;
+        }
+    }
+    if (!SL_NAME(slHasRoom)(sl, key, obj))
+        return 0;
+
+    /* we assume the key is not already inside, since we allow duplicated
+	 * scores, and the re-insertion of score and redis object should never
+	 * happen since the caller of slInsert() should test in the hash table
+	 * if the element is already inside or not. */
+    level = slRandLevel(&sl->rand);
+    x = SL_NAME(slNewNode)(sl, level, key, obj);
+    if (x == NULL)
+        return SL_ENOMEM;
+    SL_NAME(slMakeRoom)(sl, cb, ud);
+    SL_NAME(slInsertNode)(sl, x, level);
+    return 1;
+}
+
+/* Delete an element with matching score/object from the skiplist. */
+SL_FN int SL_NAME(slDelete)(SL_LIST *sl, SL_KEY score, int64_t obj) {
+    SL_NODE *update[SKIPLIST_MAXLEVEL], *x;
+    SL_DECLKEY(key);
+
+    SL_ENCODE(sl, key, score);
+    SL_NAME(slFindUpdate)(sl, key, obj, update);
+    /* We may have multiple elements with the same score, what we need
+	 * is to find the element with both the right score and object. */
+    x = SL_FORWARD(sl, update[0], 0);
+    if (SL_NAME(slNodeIs)(sl, x, key, obj)) {
+        SL_NAME(slFreeNode)(sl, x, SL_NAME(slDeleteNode)(sl, x, update));
+        SL_NAME(slMaybeShrink)(sl);
+        return 1;
+    }
+    return 0; /* not found */
+}
+
+/* Sort entries into list order around an ascending sort, so the
+ * comparator needs no context. */
+SL_FN void SL_NAME(slSortEntries)(SL_LIST *sl, SL_ENTRY *entries, unsigned long n) {
+    SL_NAME(slFlipEntries)(sl, entries, n);
+    qsort(entries, n, sizeof(*entries), SL_NAME(slEntryCmp));
+    SL_NAME(slFlipEntries)(sl, entries, n);
+}
+
+/* Insert many elements at once. The entries are sorted first so that every
+ * search resumes from the position left by the previous one.
+ * stored gets the number of entries stored; on SL_ENOMEM the entries
+ * before the failing one are in. */
+SL_FN int SL_NAME(slInsertBatch)(SL_LIST *sl, SL_ENTRY *entries, unsigned long n, unsigned long *stored) {
+    SL_NODE *update[SKIPLIST_MAXLEVEL], *x;
+    unsigned long rank[SKIPLIST_MAXLEVEL];
+    unsigned long i;
+    int finger = 0, level, r;
+
+    *stored = 0;
+    SL_NAME(slSortEntries)(sl, entries, n);
+    for (i = 0; i < n; i++) {
+        SL_DECLKEY(key);
+        if ((sl->index && slIndexGet(sl->index, entries[i].obj)) || (sl->maxlength && sl->length >= sl->maxlength)) {
+            /* replacing moves a node elsewhere and evicting may unlink
+             * the finger, it is lost in both cases */
+            r = SL_NAME(slInsert)(sl, entries[i].score, entries[i].obj, NULL, NULL);
+            if (r == SL_ENOMEM)
+                return SL_ENOMEM;
+            *stored += r;
+            finger = 0;
+            continue;
+        }
+        SL_ENCODE(sl, key, entries[i].score);
+        level = slRandLevel(&sl->rand);
+        x = SL_NAME(slNewNode)(sl, level, key, entries[i].obj);
+        if (x == NULL)
+            return SL_ENOMEM;
+        SL_NAME(slFindPosition)(sl, key, entries[i].obj, update, rank, finger);
+        SL_NAME(slLinkNode)(sl, x, level, update, rank);
+        (*stored)++;
+        finger = 1;
+    }
+    return 1;
+}
+
+/* Delete many elements at once, returns the number removed */
+SL_FN unsigned long SL_NAME(slDeleteBatch)(SL_LIST *sl, SL_ENTRY *entries, unsigned long n) {
+    SL_NODE *update[SKIPLIST_MAXLEVEL], *x;
+    unsigned long rank[SKIPLIST_MAXLEVEL];
+    unsigned long i, removed = 0;
+
+    SL_NAME(slSortEntries)(sl, entries, n);
+    for (i = 0; i < n; i++) {
+        SL_DECLKEY(key);
+        SL_ENCODE(sl, key, entries[i].score);
+        /* nodes before the removed one keep their rank, the finger stays valid */
+        SL_NAME(slFindPosition)(sl, key, entries[i].obj, update, rank, i > 0);
+        x = SL_FORWARD(sl, update[0], 0);
+        if (SL_NAME(slNodeIs)(sl, x, key, entries[i].obj)) {
+            SL_NAME(slFreeNode)(sl, x, SL_NAME(slDeleteNode)(sl, x, update));
+            removed++;
+        }
+    }
+    SL_NAME(slMaybeShrink)(sl);
+    return removed;
+}
+
+static int SL_NAME(slEntryPtrCmp)(const void *a, const void *b) {
+    return SL_NAME(slEntryCmp)(*(const SL_ENTRY * const *)a, *(const SL_ENTRY * const *)b);
+}
+
+/* Look up the ranks of many elements at once, ranks[i] gets the rank of
+ * entries[i] or 0 if absent. order is scratch space for n pointers that
+ * visit the entries in list order, so every descent resumes from the
+ * previous one. entries are left as given. */
+SL_FN void SL_NAME(slGetRanks)(SL_LIST *sl, SL_ENTRY *entries, unsigned long n, SL_ENTRY **order, unsigned long *ranks) {
+    SL_NODE *update[SKIPLIST_MAXLEVEL], *x;
+    unsigned long rank[SKIPLIST_MAXLEVEL];
+    unsigned long i;
+
+    SL_NAME(slFlipEntries)(sl, entries, n);
+    for (i = 0; i < n; i++)
+        order[i] = &entries[i];
+    qsort(order, n, sizeof(*order), SL_NAME(slEntryPtrCmp));
+    SL_NAME(slFlipEntries)(sl, entries, n);
+
+    for (i = 0; i < n; i++) {
+        SL_ENTRY *e = order[i];
+        SL_DECLKEY(key);
+        SL_ENCODE(sl, key, e->score);
+        SL_NAME(slFindPosition)(sl, key, e->obj, update, rank, i > 0);
+        x = SL_FORWARD(sl, update[0], 0);
+        ranks[e - entries] = SL_NAME(slNodeIs)(sl, x, key, e->obj) ? rank[0] + 1 : 0;
+    }
+}
+
+/* Delete all elements with rank between start and end (inclusive)
+ * Note: ranks are 1-based */
+SL_FN unsigned long SL_NAME(slDeleteByRank)(SL_LIST *sl, unsigned long start, unsigned long end, slDeleteCb cb, void *ud) {
+    SL_NODE *update[SKIPLIST_MAXLEVEL], *x;
+    unsigned long traversed = 0, removed = 0;
+    int i;
+
+    x = sl->header;
+    for (i = sl->level - 1; i >= 0; i--) {
+        while (x->level[i].forward && (traversed + x->level[i].span) < start) {
+            traversed += x->level[i].span;
+            x = SL_FORWARD(sl, x, i);
+        }
+        update[i] = x;
+    }
+
+    traversed++;
+    x = SL_FORWARD(sl, x, 0);
+    while (x && traversed <= end) {
+        SL_NODE *next = SL_FORWARD(sl, x, 0);
+        int level = SL_NAME(slDeleteNode)(sl, x, update);
+        cb(ud, x->obj);
+        SL_NAME(slFreeNode)(sl, x, level);
+        removed++;
+        traversed++;
+        x = next;
+    }
+    SL_NAME(slMaybeShrink)(sl);
+    return removed;
+}
+
+/* Delete all elements with score in [min, max] (inclusive), like
+ * ZREMRANGEBYSCORE. One descent finds the predecessors, then the run is
+ * spliced out node by node while the span fixups, tail and level are
+ * settled once at the end. cb may be NULL. */
+SL_FN unsigned long SL_NAME(slDeleteRangeByScore)(SL_LIST *sl, SL_KEY min, SL_KEY max, slDeleteCb cb, void *ud) {
+    SL_NODE *update[SKIPLIST_MAXLEVEL], *x;
+    unsigned long removed = 0;
+    int i;
+    SL_DECLKEY(lo);
+    SL_DECLKEY(hi);
+
+    SL_ENCODE(sl, lo, min);
+    SL_ENCODE(sl, hi, max);
+    if (!SL_NAME(slIsInRangeKey)(sl, lo, hi))
+        return 0;
+
+    x = sl->header;
+    for (i = sl->level - 1; i >= 0; i--) {
+        while (x->level[i].forward && SL_NAME(slLinkCmp)(sl, &x->level[i], lo) < 0)
+            x = SL_FORWARD(sl, x, i);
+        update[i] = x;
+    }
+
+    x = SL_FORWARD(sl, x, 0);
+    while (x && SL_CMP(sl, SL_NODEKEY(sl, x), hi) <= 0) {
+        SL_NODE *next = SL_FORWARD(sl, x, 0);
+        /* update[i] points to x exactly on the levels x has */
+        for (i = 0; i < sl->level && SL_FORWARD(sl, update[i], i) == x; i++) {
+            update[i]->level[i].span += x->level[i].span;
+            SL_NAME(slTakeLink)(update[i], x, i);
+        }
+        if (sl->index)
+            slIndexRemove(sl->index, x->obj);
+        if (cb)
+            cb(ud, x->obj);
+        SL_NAME(slFreeNode)(sl, x, i);
+        removed++;
+        x = next;
+    }
+
+    for (i = 0; i < sl->level; i++)
+        update[i]->level[i].span -= removed;
+    if (x) {
+        SL_SETBACKWARD(x, update[0] == sl->header ? NULL : update[0]);
+    } else {
+        sl->tail = (update[0] == sl->header) ? NULL : update[0];
+    }
+    while (sl->level > 1 && !sl->header->level[sl->level - 1].forward)
+        sl->level--;
+    sl->length -= removed;
+    SL_NAME(slMaybeShrink)(sl);
+    return removed;
+}
+
+/* Same descent as slGetRank but also hands back the node, so callers can
+ * walk its neighbours without a second lookup by rank */
+SL_FN SL_NODE *SL_NAME(slGetNodeRank)(SL_LIST *sl, SL_KEY score, int64_t o, unsigned long *prank) {
+    SL_NODE *x;
+    unsigned long rank = 0;
+    int i;
+    SL_DECLKEY(key);
+
+    SL_ENCODE(sl, key, score);
+    x = sl->header;
+    for (i = sl->level - 1; i >= 0; i--) {
+        /* walk while forward <= key/o */
+        while (x->level[i].forward && !SL_NAME(slLinkAfter)(sl, &x->level[i], key, o)) {
+            rank += x->level[i].span;
+            x = SL_FORWARD(sl, x, i);
+        }
+
+        /* x might be equal to sl->header, whose obj is not a member */
+        if (x != sl->header && x->obj == o) {
+            *prank = rank;
+            return x;
+        }
+    }
+    return NULL;
+}
+
+/* Get element rank by score and key
+ * Returns: 0 if not found, 1-based rank otherwise
+ * (1-based due to header span) */
+SL_FN unsigned long SL_NAME(slGetRank)(SL_LIST *sl, SL_KEY score, int64_t o) {
+    unsigned long rank;
+    return SL_NAME(slGetNodeRank)(sl, score, o, &rank) ? rank : 0;
+}
+
+/* Get element by its 1-based rank */
+SL_FN SL_NODE *SL_NAME(slGetNodeByRank)(SL_LIST *sl, unsigned long rank) {
+    if (rank == 0 || rank > sl->length) {
+        return NULL;
+    }
+
+    SL_NODE *x;
+    unsigned long traversed = 0;
+    int i;
+
+    x = sl->header;
+    for (i = sl->level - 1; i >= 0; i--) {
+        while (x->level[i].forward && (traversed + x->level[i].span) <= rank) {
+            traversed += x->level[i].span;
+            x = SL_FORWARD(sl, x, i);
+        }
+        if (traversed == rank) {
+            return x;
+        }
+    }
+
+    return NULL;
+}
+
+/* Resolve ascending 1-based ranks in one pass, nodes[i] gets the node at
+ * ranks[i] or NULL if out of range. Each descent resumes from the nodes
+ * the previous one stopped at on every level. */
+SL_FN void SL_NAME(slGetNodesByRank)(SL_LIST *sl, const unsigned long *ranks, unsigned long n, SL_NODE **nodes) {
+    SL_NODE *update[SKIPLIST_MAXLEVEL], *x;
+    unsigned long rank[SKIPLIST_MAXLEVEL], traversed, k;
+    int i;
+
+    for (k = 0; k < n; k++) {
+        x = sl->header;
+        traversed = 0;
+        for (i = sl->level - 1; i >= 0; i--) {
+            if (k > 0 && rank[i] > traversed) {
+                x = update[i];
+                traversed = rank[i];
+            }
+            while (x->level[i].forward && (traversed + x->level[i].span) <= ranks[k]) {
+                traversed += x->level[i].span;
+                x = SL_FORWARD(sl, x, i);
+            }
+            update[i] = x;
+            rank[i] = traversed;
+        }
+        nodes[k] = (ranks[k] > 0 && traversed == ranks[k]) ? x : NULL;
+    }
+}
+
+/* Get element by obj, requires the index to be enabled */
+SL_FN SL_NODE *SL_NAME(slGetNodeByObj)(SL_LIST *sl, int64_t obj) {
+    if (sl->index == NULL) {
+        return NULL;
+    }
+    return slIndexGet(sl->index, obj);
+}
+
+static int SL_NAME(slIsInRangeKey)(SL_LIST *sl, SL_IKEY min, SL_IKEY max) {
+    SL_NODE *x;
+
+    /* Test for ranges that will always be empty. */
+    if (SL_CMP(sl, min, max) > 0) {
+        return 0;
+    }
+    x = sl->tail;
+    if (x == NULL || SL_CMP(sl, SL_NODEKEY(sl, x), min) < 0)
+        return 0;
+
+    x = SL_FORWARD(sl, sl->header, 0);
+    if (x == NULL || SL_CMP(sl, SL_NODEKEY(sl, x), max) > 0)
+        return 0;
+    return 1;
+}
+
+/* Check if any element is in score range [min, max] (inclusive) */
+SL_FN int SL_NAME(slIsInRange)(SL_LIST *sl, SL_KEY min, SL_KEY max) {
+    SL_DECLKEY(lo);
+    SL_DECLKEY(hi);
+
+    SL_ENCODE(sl, lo, min);
+    SL_ENCODE(sl, hi, max);
+    return SL_NAME(slIsInRangeKey)(sl, lo, hi);
+}
+
+/* Find the first node that is contained in the specified range.
+ * Returns NULL when no element is contained in the range. */
+SL_FN SL_NODE *SL_NAME(slFirstInRange)(SL_LIST *sl, SL_KEY min, SL_KEY max) {
+    SL_NODE *x;
+    int i;
+    SL_DECLKEY(lo);
+    SL_DECLKEY(hi);
+
+    /* If everything is out of range, return early. */
+    SL_ENCODE(sl, lo, min);
+    SL_ENCODE(sl, hi, max);
+    if (!SL_NAME(slIsInRangeKey)(sl, lo, hi))
+        return NULL;
+
+    x = sl->header;
+    for (i = sl->level - 1; i >= 0; i--) {
+        /* Go forward while *OUT* of range. */
+        while (x->level[i].forward && SL_NAME(slLinkCmp)(sl, &x->level[i], lo) < 0)
+            x = SL_FORWARD(sl, x, i);
+    }
+
+    /* This is an inner range, so the next node cannot be NULL. */
+    x = SL_FORWARD(sl, x, 0);
+    /* Check if score <= max, the range may fall between two nodes. */
+    if (SL_CMP(sl, SL_NODEKEY(sl, x), hi) > 0)
+        return NULL;
+    return x;
+}
+
+/* Find the last node that is contained in the specified range.
+ * Returns NULL when no element is contained in the range. */
+SL_FN SL_NODE *SL_NAME(slLastInRange)(SL_LIST *sl, SL_KEY min, SL_KEY max) {
+    SL_NODE *x;
+    int i;
+    SL_DECLKEY(lo);
+    SL_DECLKEY(hi);
+
+    /* If everything is out of range, return early. */
+    SL_ENCODE(sl, lo, min);
+    SL_ENCODE(sl, hi, max);
+    if (!SL_NAME(slIsInRangeKey)(sl, lo, hi))
+        return NULL;
+
+    x = sl->header;
+    for (i = sl->level - 1; i >= 0; i--) {
+        /* Go forward while *IN* range. */
+        while (x->level[i].forward && SL_NAME(slLinkCmp)(sl, &x->level[i], hi) <= 0)
+            x = SL_FORWARD(sl, x, i);
+    }
+
+    /* This is an inner range, so this node cannot be NULL. */
+    if (SL_CMP(sl, SL_NODEKEY(sl, x), lo) < 0)
+        return NULL;
+    return x;
+}
+
+/* Count elements ordered before key (or equal to it when inclusive),
+ * accumulating spans only, so level 0 is never walked. */
+static unsigned long SL_NAME(slCountBeforeKey)(SL_LIST *sl, SL_IKEY key, int inclusive) {
+    SL_NODE *x;
+    unsigned long rank = 0;
+    int i, c;
+
+    x = sl->header;
+    for (i = sl->level - 1; i >= 0; i--) {
+        while (x->level[i].forward) {
+            c = SL_NAME(slLinkCmp)(sl, &x->level[i], key);
+            if (c > 0 || (c == 0 && !inclusive))
+                break;
+            rank += x->level[i].span;
+            x = SL_FORWARD(sl, x, i);
+        }
+    }
+    return rank;
+}
+
+SL_FN unsigned long SL_NAME(slCountBefore)(SL_LIST *sl, SL_KEY score, int inclusive) {
+    SL_DECLKEY(key);
+
+    SL_ENCODE(sl, key, score);
+    return SL_NAME(slCountBeforeKey)(sl, key, inclusive);
+}
+
+/* The 1-based rank score would take if inserted ahead of the elements
+ * already holding it, 1 for an empty list */
+SL_FN unsigned long SL_NAME(slGetRankByScore)(SL_LIST *sl, SL_KEY score) {
+    return SL_NAME(slCountBefore)(sl, score, 0) + 1;
+}
+
+/* slCountBefore (exclusive) for n scores given in list order, resolved
+ * with resumed descents like slGetNodesByRank */
+SL_FN void SL_NAME(slCountBeforeBatch)(SL_LIST *sl, SL_KEYS scores, unsigned long n, unsigned long *counts) {
+    SL_NODE *update[SKIPLIST_MAXLEVEL], *x;
+    unsigned long rank[SKIPLIST_MAXLEVEL], traversed, k;
+    int i;
+
+    for (k = 0; k < n; k++) {
+        SL_DECLKEY(key);
+        SL_ENCODE(sl, key, SL_KEYAT(sl, scores, k));
+        x = sl->header;
+        traversed = 0;
+        for (i = sl->level - 1; i >= 0; i--) {
+            if (k > 0 && rank[i] > traversed) {
+                x = update[i];
+                traversed = rank[i];
+            }
+            while (x->level[i].forward && SL_NAME(slLinkCmp)(sl, &x->level[i], key) < 0) {
+                traversed += x->level[i].span;
+                x = SL_FORWARD(sl, x, i);
+            }
+            update[i] = x;
+            rank[i] = traversed;
+        }
+        counts[k] = traversed;
+    }
+}
+
+/* Count elements in score range [min, max] (inclusive), like ZCOUNT */
+SL_FN unsigned long SL_NAME(slCountInRange)(SL_LIST *sl, SL_KEY min, SL_KEY max) {
+    unsigned long before, last;
+    SL_DECLKEY(lo);
+    SL_DECLKEY(hi);
+
+    SL_ENCODE(sl, lo, min);
+    SL_ENCODE(sl, hi, max);
+    if (!SL_NAME(slIsInRangeKey)(sl, lo, hi))
+        return 0;
+    before = SL_NAME(slCountBeforeKey)(sl, lo, 0);
+    last = SL_NAME(slCountBeforeKey)(sl, hi, 1);
+    return last > before ? last - before : 0;
+}
+
+/* Start a linear build into an empty list. Elements must then be appended
+ * in list order; deterministic levels give a perfectly balanced list,
+ * otherwise levels are drawn as in slInsert. */
+SL_FN void SL_NAME(slBuildBegin)(SL_LIST *sl, SL_BUILDER *b, int deterministic) {
+    int i;
+
+    b->sl = sl;
+    b->deterministic = deterministic;
+    for (i = 0; i < SKIPLIST_MAXLEVEL; i++) {
+        b->last[i] = sl->header;
+        b->lastrank[i] = 0;
+    }
+    b->haslast = sl->tail != NULL;
+    if (b->haslast) {
+        SL_COPYKEY(sl, b->lastkey, SL_NODEKEY(sl, sl->tail));
+        b->lastobj = sl->tail->obj;
+    }
+}
+
+/* Remember key/obj as the element the next append must follow */
+static inline void SL_NAME(slBuildMark)(SL_BUILDER *b, SL_IKEY key, int64_t obj) {
+    SL_COPYKEY(b->sl, b->lastkey, key);
+    b->lastobj = obj;
+    b->haslast = 1;
+}
+
+/* Append the next element, returns 0 if it does not sort strictly after
+ * the previous one (or its obj is already indexed), SL_ENOMEM if it
+ * cannot be allocated. Elements beyond maxlength are dropped, they still
+ * have to be in order. */
+SL_FN int SL_NAME(slBuildAppend)(SL_BUILDER *b, SL_KEY score, int64_t obj) {
+    SL_LIST *sl = b->sl;
+    SL_NODE *x, *tail = sl->tail;
+    unsigned long rank = sl->length + 1;
+    int i, level;
+    SL_DECLKEY(key);
+
+    SL_ENCODE(sl, key, score);
+    if (b->haslast && !SL_LESS(sl, b->lastkey, b->lastobj, key, obj))
+        return 0;
+    if (sl->index && slIndexGet(sl->index, obj))
+        return 0;
+    /* the input is ordered, whatever exceeds the cap ranks after the tail */
+    if (sl->maxlength && sl->length >= sl->maxlength) {
+        SL_NAME(slBuildMark)(b, key, obj);
+        return 1;
+    }
+
+    /* position r gets one level per two trailing zero bits of r */
+    level = b->deterministic ? 1 + __builtin_ctzl(rank) / 2 : slRandLevel(&sl->rand);
+    if (level > SKIPLIST_MAXLEVEL)
+        level = SKIPLIST_MAXLEVEL;
+
+    x = SL_NAME(slNewNode)(sl, level, key, obj);
+    if (x == NULL)
+        return SL_ENOMEM;
+    for (i = 0; i < level; i++) {
+        SL_NAME(slSetForward)(sl, b->last[i], i, x);
+        b->last[i]->level[i].span = rank - b->lastrank[i];
+        x->level[i].forward = 0;
+        x->level[i].span = 0;
+        b->last[i] = x;
+        b->lastrank[i] = rank;
+    }
+    if (level > sl->level)
+        sl->level = level;
+    SL_SETBACKWARD(x, tail);
+    sl->tail = x;
+    sl->length++;
+    if (sl->index)
+        slIndexSet(sl->index, obj, x);
+    SL_NAME(slBuildMark)(b, key, obj);
+    return 1;
+}
+
+/* Close the build: the last node of every level spans to the end */
+SL_FN void SL_NAME(slBuildEnd)(SL_BUILDER *b) {
+    SL_LIST *sl = b->sl;
+    int i;
+
+    for (i = 0; i < sl->level; i++) {
+        b->last[i]->level[i].forward = 0;
+        b->last[i]->level[i].span = sl->length - b->lastrank[i];
+    }
+}
+
+/* Build an empty list from entries already in list order in O(n).
+ * Returns 0 (SL_ENOMEM) and leaves the list empty if the entries are not
+ * ordered (cannot be allocated). */
+SL_FN int SL_NAME(slBuildSorted)(SL_LIST *sl, const SL_ENTRY *entries, unsigned long n, int deterministic) {
+    SL_BUILDER b;
+    unsigned long i;
+    int r;
+
+    SL_NAME(slBuildBegin)(sl, &b, deterministic);
+    for (i = 0; i < n; i++) {
+        r = SL_NAME(slBuildAppend)(&b, entries[i].score, entries[i].obj);
+        if (r != 1) {
+            SL_NAME(slBuildEnd)(&b);
+            SL_NAME(slClear)(sl);
+            return r;
+        }
+    }
+    SL_NAME(slBuildEnd)(&b);
+    return 1;
+}
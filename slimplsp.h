@@ -0,0 +1,116 @@
+/*
+ * One arity of the composite key variant, included by skiplistsp.c once
+ * per specialised component count. No include guard on purpose. The
+ * includer defines
+ *
+ *   SP_NAME(n)     name of n in this instance, e.g. sp2_##n
+ *   SP_ARITY       the component count, 0 for the generic instance that
+ *                  reads it from sl->nkey
+ *
+ * With a constant count the key compares and copies below unroll, so the
+ * descents run without looking at sl->nkey. Everything that is not on
+ * those paths stays in skiplistsp.c.
+ */
+
+#if SP_ARITY
+#define SP_NKEY(sl) SP_ARITY
+#define SP_ENTRYKEYS SP_ARITY
+#else
+#define SP_NKEY(sl) ((sl)->nkey)
+#define SP_ENTRYKEYS SKIPLIST_SP_MAXKEY
+#endif
+
+#define SL_NAME(n) SP_NAME(n)
+#define SL_FN static
+#define SL_LIST struct skiplist_sp
+#define SL_NODE struct skiplistNode_sp
+#define SL_ENTRY struct skiplistEntry_sp
+#define SL_BUILDER struct skiplistBuilder_sp
+#define SL_KEY const int64_t *
+#define SL_KEYS const int64_t *
+#define SL_KEYAT(sl, ks, k) ((ks) + (k) * SP_NKEY(sl))
+#define SL_IKEY const uint64_t *
+#define SL_DECLKEY(k) uint64_t k[SKIPLIST_SP_MAXKEY]
+#define SL_ENCODE(sl, k, s) sp_slScoreKeyN(sl, s, k, SP_NKEY(sl))
+#define SL_NODEKEY(sl, x) ((uint64_t *)(x) - SP_NKEY(sl))
+#define SL_SETKEY(sl, x, k) memcpy(SL_NODEKEY(sl, x), k, SP_NKEY(sl) * sizeof(uint64_t))
+#define SL_COPYKEY(sl, d, k) memcpy(d, k, SP_NKEY(sl) * sizeof(uint64_t))
+#define SL_LESS(sl, a, ao, b, bo) sp_slKeyLessN(a, ao, b, bo, SP_NKEY(sl))
+#define SL_CMP(sl, a, b) sp_slKeyCmpN(a, b, SP_NKEY(sl))
+#define SL_KEYWORD(k) ((k)[0])
+#define SL_ONEWORD(sl) (SP_NKEY(sl) == 1)
+
+/* The key lives right in front of the node: the pool hands out blocks of
+ * nkey words plus the node, and the node points past the key. */
+static struct skiplistNode_sp *SL_NAME(slCreateNode)(struct skiplist_sp *sl, int level, const uint64_t *k, int64_t obj) {
+    struct skiplistNode_sp *n;
+#if SKIPLIST_COMPACT
+    uint32_t ref;
+    uint64_t *key = slPoolAllocRef(&sl->pool, level, &ref);
+    if (key == NULL)
+        return NULL;
+    n = (struct skiplistNode_sp *)(key + SP_NKEY(sl));
+    n->self = ref + SP_NKEY(sl); /* refs count words, the node follows the key */
+#else
+    uint64_t *key = slPoolAlloc(&sl->pool, level);
+    if (key == NULL)
+        return NULL;
+    n = (struct skiplistNode_sp *)(key + SP_NKEY(sl));
+    n->level[0].height = level;
+#endif
+    memcpy(key, k, SP_NKEY(sl) * sizeof(*key));
+    n->obj = obj;
+    return n;
+}
+
+static inline void SL_NAME(slFreeNode)(struct skiplist_sp *sl, struct skiplistNode_sp *node, int level) {
+    sp_slFreeNode(sl, node, level);
+}
+
+/* Components past nkey are zero in every entry, so the generic instance
+ * may compare all of them */
+static int SL_NAME(slEntryCmp)(const void *a, const void *b) {
+    const struct skiplistEntry_sp *x = a, *y = b;
+    int i;
+    for (i = 0; i < SP_ENTRYKEYS; i++) {
+        if (x->score[i] != y->score[i])
+            return x->score[i] < y->score[i] ? -1 : 1;
+    }
+    return x->obj < y->obj ? -1 : (x->obj > y->obj ? 1 : 0);
+}
+
+/* Descending components are bit flipped around an ascending sort,
+ * ~x reverses the int64 order without overflow. */
+static void SL_NAME(slFlipEntries)(struct skiplist_sp *sl, struct skiplistEntry_sp *entries, unsigned long n) {
+    unsigned long i;
+    int j;
+    for (j = 0; j < SP_NKEY(sl); j++) {
+        if (sl->cmp[j])
+            for (i = 0; i < n; i++)
+                entries[i].score[j] = ~entries[i].score[j];
+    }
+}
+
+#include "slimpl.h"
+
+#undef SP_NKEY
+#undef SP_ENTRYKEYS
+#undef SL_NAME
+#undef SL_FN
+#undef SL_LIST
+#undef SL_NODE
+#undef SL_ENTRY
+#undef SL_BUILDER
+#undef SL_KEY
+#undef SL_KEYS
+#undef SL_KEYAT
+#undef SL_IKEY
+#undef SL_DECLKEY
+#undef SL_ENCODE
+#undef SL_NODEKEY
+#undef SL_SETKEY
+#undef SL_COPYKEY
+#undef SL_LESS
+#undef SL_CMP
+#undef SL_KEYWORD
+#undef SL_ONEWORD
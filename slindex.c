@@ -0,0 +1,162 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "slindex.h"
+
+#define SLINDEX_MINSIZE 16
+
+static inline unsigned long slIndexHash(int64_t obj) {
+    /* splitmix64 finalizer, obj 通常是连续的 id，需要打散 */
+    uint64_t x = (uint64_t)obj;
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return (unsigned long)x;
+}
+
+static slIndexEntry *slIndexAllocSlots(slAllocator *alloc, unsigned long size) {
+    slIndexEntry *slots = slMemAlloc(alloc, size * sizeof(slIndexEntry));
+    if (slots)
+        memset(slots, 0, size * sizeof(slIndexEntry));
+    return slots;
+}
+
+/* Rehash into size slots, returns 0 and keeps the table if they cannot
+ * be allocated */
+static int slIndexResize(slIndex *idx, unsigned long size) {
+    slIndexEntry *old = idx->slots, *slots = slIndexAllocSlots(idx->alloc, size);
+    unsigned long oldsize = idx->mask + 1, i;
+
+    if (slots == NULL)
+        return 0;
+    idx->slots = slots;
+    idx->mask = size - 1;
+    for (i = 0; i < oldsize; i++) {
+        if (old[i].node) {
+            unsigned long j = slIndexHash(old[i].obj) & idx->mask;
+            while (idx->slots[j].node)
+                j = (j + 1) & idx->mask;
+            idx->slots[j] = old[i];
+        }
+    }
+    slMemFree(idx->alloc, old, oldsize * sizeof(slIndexEntry));
+    return 1;
+}
+
+/* NULL if the allocator refuses */
+slIndex *slIndexCreate(slAllocator *alloc) {
+    slIndex *idx = slMemAlloc(alloc, sizeof(*idx));
+    if (idx == NULL)
+        return NULL;
+    idx->alloc = alloc;
+    idx->slots = slIndexAllocSlots(alloc, SLINDEX_MINSIZE);
+    if (idx->slots == NULL) {
+        slMemFree(alloc, idx, sizeof(*idx));
+        return NULL;
+    }
+    idx->mask = SLINDEX_MINSIZE - 1;
+    idx->count = 0;
+    return idx;
+}
+
+/* Drop every entry. The table goes back to its minimum size when that can
+ * be allocated, otherwise the old one is emptied in place. */
+void slIndexClear(slIndex *idx) {
+    slIndexEntry *slots = NULL;
+
+    if (idx->mask + 1 > SLINDEX_MINSIZE)
+        slots = slIndexAllocSlots(idx->alloc, SLINDEX_MINSIZE);
+    if (slots) {
+        slMemFree(idx->alloc, idx->slots, (idx->mask + 1) * sizeof(slIndexEntry));
+        idx->slots = slots;
+        idx->mask = SLINDEX_MINSIZE - 1;
+    } else {
+        memset(idx->slots, 0, (idx->mask + 1) * sizeof(slIndexEntry));
+    }
+    idx->count = 0;
+}
+
+void slIndexFree(slIndex *idx) {
+    slMemFree(idx->alloc, idx->slots, (idx->mask + 1) * sizeof(slIndexEntry));
+    slMemFree(idx->alloc, idx, sizeof(*idx));
+}
+
+size_t slIndexMemory(slIndex *idx) {
+    return sizeof(*idx) + (idx->mask + 1) * sizeof(slIndexEntry);
+}
+
+void *slIndexGet(slIndex *idx, int64_t obj) {
+    unsigned long i = slIndexHash(obj) & idx->mask;
+    while (idx->slots[i].node) {
+        if (idx->slots[i].obj == obj)
+            return idx->slots[i].node;
+        i = (i + 1) & idx->mask;
+    }
+    return NULL;
+}
+
+/* Make room for n objs at a load factor below 3/4, returns 0 if the
+ * table cannot grow that far */
+int slIndexReserve(slIndex *idx, unsigned long n) {
+    unsigned long size = idx->mask + 1;
+
+    while (n * 4 > size * 3)
+        size *= 2;
+    return size == idx->mask + 1 || slIndexResize(idx, size);
+}
+
+/* Insert or overwrite obj -> node. Adding an obj needs room reserved
+ * through slIndexReserve first, the set itself then cannot fail. */
+void slIndexSet(slIndex *idx, int64_t obj, void *node) {
+    unsigned long i;
+
+    slIndexReserve(idx, idx->count + 1);
+
+    i = slIndexHash(obj) & idx->mask;
+    while (idx->slots[i].node) {
+        if (idx->slots[i].obj == obj) {
+            idx->slots[i].node = node;
+            return;
+        }
+        i = (i + 1) & idx->mask;
+    }
+    idx->slots[i].obj = obj;
+    idx->slots[i].node = node;
+    idx->count++;
+}
+
+/* Remove obj and return its node, NULL if not found.
+ * Uses backward shift deletion so no tombstones are left behind. */
+void *slIndexRemove(slIndex *idx, int64_t obj) {
+    unsigned long i = slIndexHash(obj) & idx->mask, j, k;
+    void *node;
+
+    while (idx->slots[i].node && idx->slots[i].obj != obj)
+        i = (i + 1) & idx->mask;
+    node = idx->slots[i].node;
+    if (node == NULL)
+        return NULL;
+
+    j = i;
+    for (;;) {
+        j = (j + 1) & idx->mask;
+        if (idx->slots[j].node == NULL)
+            break;
+        /* k is the home slot of entry j; it may move to i only if i lies
+         * cyclically between k and j */
+        k = slIndexHash(idx->slots[j].obj) & idx->mask;
+        if ((j > i && (k <= i || k > j)) || (j < i && (k <= i && k > j))) {
+            idx->slots[i] = idx->slots[j];
+            i = j;
+        }
+    }
+    idx->slots[i].node = NULL;
+    idx->count--;
+
+    if (idx->mask + 1 > SLINDEX_MINSIZE && idx->count * 8 < idx->mask + 1)
+        slIndexResize(idx, (idx->mask + 1) / 2);
+    return node;
+}
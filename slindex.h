@@ -0,0 +1,31 @@
+#ifndef SLINDEX_HH
+#define SLINDEX_HH
+
+#include <stdint.h>
+#include "slalloc.h"
+
+// obj -> node 的开放寻址哈希表(线性探测)，skiplist, skiplist_sp 与 btree 共用
+typedef struct slIndexEntry {
+    int64_t obj;
+    void *node;  // NULL 表示空槽
+} slIndexEntry;
+
+typedef struct slIndex {
+    slAllocator *alloc;
+    slIndexEntry *slots;
+    unsigned long mask;
+    unsigned long count;
+} slIndex;
+
+// 分配失败时 slIndexCreate 返回 NULL, slIndexReserve 返回 0
+slIndex *slIndexCreate(slAllocator *alloc);
+size_t slIndexMemory(slIndex *idx);
+void slIndexFree(slIndex *idx);
+void slIndexClear(slIndex *idx);
+
+void *slIndexGet(slIndex *idx, int64_t obj);
+int slIndexReserve(slIndex *idx, unsigned long n);
+void slIndexSet(slIndex *idx, int64_t obj, void *node);
+void *slIndexRemove(slIndex *idx, int64_t obj);
+
+#endif //SLINDEX_HH
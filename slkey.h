@@ -0,0 +1,95 @@
+#ifndef SLKEY_HH
+#define SLKEY_HH
+
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * 节点内的 score 以保序的 uint64 编码保存: 编码后按无符号整数比较即为链表
+ * 顺序, 降序方向在编码时已翻转, 查找路径上不再判断 cmp。
+ * 编码与解码都是异或, 同一个 flip 来回使用。
+ */
+#define SLKEY_SIGN 0x8000000000000000ULL
+
+/*
+ * 每层链接旁缓存 forward 节点 key 的首个字, 查找时多数步不必访问下一个节点
+ * 就能决定走不走。每层多 8 字节, 首字大量相同时反而更慢, 默认关闭,
+ * 编译时 -DSKIPLIST_LINKKEY=1 打开。
+ */
+#ifndef SKIPLIST_LINKKEY
+#define SKIPLIST_LINKKEY 0
+#endif
+
+/*
+ * 紧凑布局: 节点放在每个 list 自己的 slab 里, 链接用 32 位 ref 代替指针,
+ * 每层 forward+span 只占 8 字节, 上限是每个 list 32G 节点内存。沿链接走
+ * 一步多查一次槽表, 编译时 -DSKIPLIST_COMPACT=1 打开, 不能与 LINKKEY 同开。
+ */
+#ifndef SKIPLIST_COMPACT
+#define SKIPLIST_COMPACT 0
+#endif
+#if SKIPLIST_COMPACT && SKIPLIST_LINKKEY
+#error "SKIPLIST_COMPACT and SKIPLIST_LINKKEY cannot be combined"
+#endif
+
+/*
+ * 每层链接的跨度默认 32 位, 单个 list 须少于 2^32 个元素; 编译时
+ * -DSKIPLIST_BIGSPAN=1 改为与 length 同宽, 每层多 8 字节。排名运算总是 64 位。
+ */
+#ifndef SKIPLIST_BIGSPAN
+#define SKIPLIST_BIGSPAN 0
+#endif
+#if SKIPLIST_BIGSPAN
+typedef unsigned long slSpan;
+#else
+typedef unsigned int slSpan;
+#endif
+
+/* All ones for a descending direction */
+static inline uint64_t slKeyFlip(char cmp) {
+    return -(uint64_t)(cmp != 0);
+}
+
+/* IEEE754 bits made sortable: positives get the sign bit set, negatives
+ * are inverted. -0.0 is folded into 0.0 since they compare equal. */
+static inline uint64_t slEncodeDouble(double d, uint64_t flip) {
+    uint64_t u;
+    d += 0.0;
+    memcpy(&u, &d, sizeof(u));
+    u ^= (uint64_t)((int64_t)u >> 63) | SLKEY_SIGN;
+    return u ^ flip;
+}
+
+static inline double slDecodeDouble(uint64_t u, uint64_t flip) {
+    double d;
+    u ^= flip;
+    u ^= (uint64_t)((int64_t)~u >> 63) | SLKEY_SIGN;
+    memcpy(&d, &u, sizeof(d));
+    return d;
+}
+
+/* Biasing by the sign bit turns the signed order into the unsigned one */
+static inline uint64_t slEncodeInt(int64_t v, uint64_t flip) {
+    return (uint64_t)v ^ SLKEY_SIGN ^ flip;
+}
+
+static inline int64_t slDecodeInt(uint64_t u, uint64_t flip) {
+    return (int64_t)(u ^ SLKEY_SIGN ^ flip);
+}
+
+/* (k1, o1) < (k2, o2) with the obj as tie break, one 128-bit compare
+ * where the compiler has it */
+static inline int slKeyLess(uint64_t k1, int64_t o1, uint64_t k2, int64_t o2) {
+#ifdef __SIZEOF_INT128__
+    return ((unsigned __int128)k1 << 64 | ((uint64_t)o1 ^ SLKEY_SIGN)) <
+        ((unsigned __int128)k2 << 64 | ((uint64_t)o2 ^ SLKEY_SIGN));
+#else
+    return k1 < k2 || (k1 == k2 && o1 < o2);
+#endif
+}
+
+static inline int slKeyCmp(uint64_t k1, uint64_t k2) {
+    return (k1 > k2) - (k1 < k2);
+}
+
+#endif //SLKEY_HH
@@ -0,0 +1,277 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "slpool.h"
+
+#define SLPOOL_SLABSIZE (16 * 1024)
+#define SLPOOL_MINNODES 8
+
+typedef struct slPoolSlab {
+    struct slPoolSlab *next;
+    unsigned long nodes;
+    unsigned long slot;        // 槽表中的序号, 未开启 ref 时为 0
+    char data[];
+} slPoolSlab;
+
+/* Slot table of a pool without slabs, slPoolPtr(pool, 0) reads it */
+static char *slPoolNoSlots[1];
+
+/* A free node keeps its ref right behind the free list link */
+#define SLPOOL_FREEREF(p) (*(uint32_t *)((void **)(p) + 1))
+
+static inline size_t slPoolNodeSize(slPool *pool, int level) {
+    /* keep every node pointer aligned, refs count in 8 byte units */
+    size_t align = pool->refs ? 8 : sizeof(void *);
+    size_t size = pool->base + level * pool->unit;
+    return (size + align - 1) & ~(align - 1);
+}
+
+/* Give slab a free slot, growing the table when none is left. Returns 0
+ * when the table is at SLPOOL_MAXSLOTS or cannot grow. */
+static int slPoolTakeSlot(slPool *pool, slPoolSlab *slab) {
+    unsigned long i = pool->slotnext;
+
+    while (i < pool->nslots && pool->slots[i])
+        i++;
+    if (i >= pool->nslots) {
+        unsigned long n = pool->nslots ? pool->nslots * 2 : 16;
+        char **slots;
+        if (pool->nslots >= SLPOOL_MAXSLOTS)
+            return 0;
+        if (n > SLPOOL_MAXSLOTS)
+            n = SLPOOL_MAXSLOTS;
+        slots = slMemAlloc(pool->alloc, n * sizeof(*slots));
+        if (slots == NULL)
+            return 0;
+        memset(slots, 0, n * sizeof(*slots));
+        if (pool->nslots) {
+            memcpy(slots, pool->slots, pool->nslots * sizeof(*slots));
+            slMemFree(pool->alloc, pool->slots, pool->nslots * sizeof(*slots));
+        } else {
+            i = 1;
+        }
+        pool->slots = slots;
+        pool->nslots = n;
+    }
+    pool->slots[i] = slab->data;
+    pool->slotnext = i + 1;
+    slab->slot = i;
+    return 1;
+}
+
+static void slPoolDropSlot(slPool *pool, slPoolSlab *slab) {
+    if (slab->slot == 0)
+        return;
+    pool->slots[slab->slot] = NULL;
+    if (slab->slot < pool->slotnext)
+        pool->slotnext = slab->slot;
+}
+
+void slPoolInit(slPool *pool, slAllocator *alloc, size_t base, size_t unit) {
+    memset(pool, 0, sizeof(*pool));
+    pool->alloc = alloc;
+    pool->base = base;
+    pool->unit = unit;
+    pool->slots = slPoolNoSlots;
+}
+
+void slPoolRelease(slPool *pool) {
+    int i;
+    for (i = 0; i < SLPOOL_MAXLEVEL; i++) {
+        size_t size = slPoolNodeSize(pool, i + 1);
+        slPoolSlab *slab = pool->classes[i].slabs, *next;
+        while (slab) {
+            next = slab->next;
+            slMemFree(pool->alloc, slab, sizeof(*slab) + slab->nodes * size);
+            slab = next;
+        }
+        pool->classes[i].slabs = NULL;
+        pool->classes[i].free = NULL;
+        pool->classes[i].nfree = 0;
+        pool->classes[i].nslabs = 0;
+    }
+    /* the table comes back with the next slab, refs stay enabled */
+    if (pool->nslots)
+        slMemFree(pool->alloc, pool->slots, pool->nslots * sizeof(*pool->slots));
+    pool->slots = slPoolNoSlots;
+    pool->nslots = 0;
+    pool->slotnext = 0;
+    pool->bytes = 0;
+    pool->nfree = 0;
+    pool->freed = 0;
+}
+
+/* Add a slab to the class of level, returns 0 if it cannot be had */
+static int slPoolGrow(slPool *pool, int level) {
+    slPoolClass *c = &pool->classes[level - 1];
+    size_t size = slPoolNodeSize(pool, level);
+    unsigned long nodes = SLPOOL_SLABSIZE / size, i;
+    slPoolSlab *slab;
+
+    if (nodes < SLPOOL_MINNODES)
+        nodes = SLPOOL_MINNODES;
+    slab = slMemAlloc(pool->alloc, sizeof(*slab) + nodes * size);
+    if (slab == NULL)
+        return 0;
+    slab->nodes = nodes;
+    slab->slot = 0;
+    if (pool->refs && !slPoolTakeSlot(pool, slab)) {
+        slMemFree(pool->alloc, slab, sizeof(*slab) + nodes * size);
+        return 0;
+    }
+    slab->next = c->slabs;
+    c->slabs = slab;
+    c->nslabs++;
+    pool->bytes += sizeof(*slab) + nodes * size;
+
+    /* push in reverse so nodes are handed out in address order */
+    for (i = nodes; i > 0; i--) {
+        void **p = (void **)(slab->data + (i - 1) * size);
+        *p = c->free;
+        c->free = p;
+        if (pool->refs)
+            SLPOOL_FREEREF(p) = (uint32_t)(slab->slot << SLPOOL_REFSHIFT | ((i - 1) * size) >> 3);
+    }
+    c->nfree += nodes;
+    pool->nfree += nodes;
+    return 1;
+}
+
+/* NULL when no slab can be added for the node */
+void *slPoolAlloc(slPool *pool, int level) {
+    slPoolClass *c = &pool->classes[level - 1];
+    void **p;
+
+    if (c->free == NULL && !slPoolGrow(pool, level))
+        return NULL;
+    p = c->free;
+    c->free = *p;
+    c->nfree--;
+    pool->nfree--;
+    return p;
+}
+
+/* Make sure the next n allocations of level cannot fail. Returns 0 if the
+ * slabs for them cannot be had. */
+int slPoolReserve(slPool *pool, int level, unsigned long n) {
+    while (pool->classes[level - 1].nfree < n)
+        if (!slPoolGrow(pool, level))
+            return 0;
+    return 1;
+}
+
+void slPoolFree(slPool *pool, void *p, int level) {
+    slPoolClass *c = &pool->classes[level - 1];
+    *(void **)p = c->free;
+    c->free = p;
+    c->nfree++;
+    pool->nfree++;
+    pool->freed++;
+}
+
+/* Number every node from now on, so they can be linked by 32-bit refs
+ * instead of pointers. The pool must be empty, and a slab must hold at
+ * most 1 << SLPOOL_REFSHIFT words: nodes up to SLPOOL_SLABSIZE /
+ * SLPOOL_MINNODES bytes. Nodes are then handed out and taken back
+ * through slPoolAllocRef/slPoolFreeRef only. */
+void slPoolEnableRefs(slPool *pool) {
+    pool->refs = 1;
+}
+
+void *slPoolAllocRef(slPool *pool, int level, uint32_t *ref) {
+    void *p = slPoolAlloc(pool, level);
+    if (p)
+        *ref = SLPOOL_FREEREF(p);
+    return p;
+}
+
+void slPoolFreeRef(slPool *pool, void *p, int level, uint32_t ref) {
+    SLPOOL_FREEREF(p) = ref;
+    slPoolFree(pool, p, level);
+}
+
+static int slPoolSlabCmp(const void *a, const void *b) {
+    uintptr_t x = (uintptr_t)*(slPoolSlab *const *)a;
+    uintptr_t y = (uintptr_t)*(slPoolSlab *const *)b;
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+/* Find the slab holding p in an address sorted slab array */
+static long slPoolFindSlab(slPoolSlab **slabs, unsigned long n, void *p) {
+    long lo = 0, hi = (long)n - 1;
+    while (lo < hi) {
+        long mid = (lo + hi + 1) / 2;
+        if ((char *)slabs[mid] <= (char *)p)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+    return lo;
+}
+
+/* Return every slab whose nodes are all free to the system.
+ * Returns the number of bytes released. A class whose bookkeeping arrays
+ * cannot be allocated is skipped. */
+size_t slPoolShrink(slPool *pool) {
+    size_t released = 0;
+    int level;
+
+    for (level = 1; level <= SLPOOL_MAXLEVEL; level++) {
+        slPoolClass *c = &pool->classes[level - 1];
+        size_t size = slPoolNodeSize(pool, level);
+        slPoolSlab **slabs, *slab;
+        unsigned long *used, i, n = 0;
+        void **p, **prev;
+
+        if (c->nfree == 0)
+            continue;
+
+        slabs = slMemAlloc(pool->alloc, c->nslabs * sizeof(*slabs));
+        used = slMemAlloc(pool->alloc, c->nslabs * sizeof(*used));
+        if (slabs == NULL || used == NULL) {
+            slMemFree(pool->alloc, slabs, c->nslabs * sizeof(*slabs));
+            slMemFree(pool->alloc, used, c->nslabs * sizeof(*used));
+            continue;
+        }
+        memset(used, 0, c->nslabs * sizeof(*used));
+        for (slab = c->slabs; slab; slab = slab->next)
+            slabs[n++] = slab;
+        qsort(slabs, n, sizeof(*slabs), slPoolSlabCmp);
+
+        /* count free nodes per slab */
+        for (p = c->free; p; p = *p)
+            used[slPoolFindSlab(slabs, n, p)]++;
+
+        /* drop free nodes living in slabs about to be released */
+        prev = (void **)&c->free;
+        for (p = c->free; p; p = *p) {
+            i = slPoolFindSlab(slabs, n, p);
+            if (used[i] == slabs[i]->nodes) {
+                *prev = *p;
+                c->nfree--;
+                pool->nfree--;
+            } else {
+                prev = p;
+            }
+        }
+
+        c->slabs = NULL;
+        for (i = 0; i < n; i++) {
+            if (used[i] == slabs[i]->nodes) {
+                released += sizeof(*slabs[i]) + slabs[i]->nodes * size;
+                slPoolDropSlot(pool, slabs[i]);
+                slMemFree(pool->alloc, slabs[i], sizeof(*slabs[i]) + slabs[i]->nodes * size);
+                c->nslabs--;
+            } else {
+                slabs[i]->next = c->slabs;
+                c->slabs = slabs[i];
+            }
+        }
+        slMemFree(pool->alloc, slabs, n * sizeof(*slabs));
+        slMemFree(pool->alloc, used, n * sizeof(*used));
+    }
+    pool->bytes -= released;
+    pool->freed = 0;
+    return released;
+}
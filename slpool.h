@@ -0,0 +1,58 @@
+#ifndef SLPOOL_HH
+#define SLPOOL_HH
+
+#include <stddef.h>
+#include <stdint.h>
+#include "slalloc.h"
+
+#define SLPOOL_MAXLEVEL 32
+
+// ref: 节点的 32 位编号, 高位是 slab 在槽表中的序号, 低 SLPOOL_REFSHIFT 位是
+// 节点在 slab 内以 8 字节为单位的偏移, 0 表示 NULL
+#define SLPOOL_REFSHIFT 11
+#define SLPOOL_MAXSLOTS (1UL << (32 - SLPOOL_REFSHIFT))
+
+// 按节点层数分级的 slab 分配器，每个 skiplist 独占一个
+struct slPoolSlab;
+
+typedef struct slPoolClass {
+    void *free;                // 空闲节点链表，节点首字作为 next 指针
+    struct slPoolSlab *slabs;
+    unsigned long nfree;
+    unsigned long nslabs;
+} slPoolClass;
+
+typedef struct slPool {
+    slAllocator *alloc;
+    size_t base, unit;         // 节点大小 = base + level * unit
+    size_t bytes;              // 从系统申请的总字节数
+    unsigned long nfree;       // 所有级别的空闲节点数
+    unsigned long freed;       // 上次 shrink 之后释放的节点数
+    slPoolClass classes[SLPOOL_MAXLEVEL];
+    int refs;                  // 是否给节点编 ref
+    char **slots;              // slot -> slab 数据区, 0 号恒为 NULL
+    unsigned long nslots;      // 槽表容量
+    unsigned long slotnext;    // 从这里开始找空槽
+} slPool;
+
+void slPoolInit(slPool *pool, slAllocator *alloc, size_t base, size_t unit);
+void slPoolRelease(slPool *pool);
+
+// 分配失败时返回 NULL
+void *slPoolAlloc(slPool *pool, int level);
+int slPoolReserve(slPool *pool, int level, unsigned long n);
+void slPoolFree(slPool *pool, void *p, int level);
+size_t slPoolShrink(slPool *pool);
+
+void slPoolEnableRefs(slPool *pool);
+void *slPoolAllocRef(slPool *pool, int level, uint32_t *ref);
+void slPoolFreeRef(slPool *pool, void *p, int level, uint32_t ref);
+
+/* The address of ref, NULL for ref 0. Slot 0 is NULL so that case needs
+ * no branch. */
+static inline void *slPoolPtr(const slPool *pool, uint32_t ref) {
+    return (void *)((uintptr_t)pool->slots[ref >> SLPOOL_REFSHIFT] +
+        ((uintptr_t)(ref & ((1U << SLPOOL_REFSHIFT) - 1)) << 3));
+}
+
+#endif //SLPOOL_HH
@@ -0,0 +1,32 @@
+#ifndef SLRAND_HH
+#define SLRAND_HH
+
+#include <stdint.h>
+
+// 每个 skiplist 自带的随机数状态(xorshift64*)，避免 random() 的全局锁
+static inline uint64_t slRandSeed(uint64_t seed) {
+    /* splitmix64 spreads small seeds, and the state must never be zero */
+    uint64_t z = seed + 0x9e3779b97f4a7c15ULL;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    z ^= z >> 31;
+    return z ? z : 0x9e3779b97f4a7c15ULL;
+}
+
+static inline uint64_t slRandNext(uint64_t *state) {
+    uint64_t x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return x * 0x2545f4914f6cdd1dULL;
+}
+
+/* Level with P = 1/4: every two trailing zero bits add one level.
+ * The top bit is forced so the result never exceeds 32. */
+static inline int slRandLevel(uint64_t *state) {
+    uint64_t r = slRandNext(state) | (1ULL << 63);
+    return 1 + __builtin_ctzll(r) / 2;
+}
+
+#endif //SLRAND_HH
@@ -0,0 +1,97 @@
+#include "slsearch.h"
+
+#if SL_SIMD && (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define SLSEARCH_X86 1
+#include <immintrin.h>
+#else
+#define SLSEARCH_X86 0
+#endif
+
+/* The block is sorted, so counting the keys below k gives the lower bound.
+ * Counting the whole block keeps the loop free of data dependent branches,
+ * blocks are at most a few cache lines long. */
+static int slCountLessScalar(const uint64_t *key, int n, uint64_t k) {
+    int i, c = 0;
+    for (i = 0; i < n; i++)
+        c += key[i] < k;
+    return c;
+}
+
+#if SLSEARCH_X86
+/* There is no unsigned 64-bit compare before AVX-512, flipping the sign
+ * bit of both sides turns it into the signed one */
+__attribute__((target("avx2,popcnt")))
+static int slCountLessAvx2(const uint64_t *key, int n, uint64_t k) {
+    const __m256i sign = _mm256_set1_epi64x(INT64_MIN);
+    const __m256i kk = _mm256_xor_si256(_mm256_set1_epi64x((int64_t)k), sign);
+    int i = 0, c = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        __m256i a = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(key + i)), sign);
+        __m256i b = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(key + i + 4)), sign);
+        int ma = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(kk, a)));
+        int mb = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(kk, b)));
+        c += _mm_popcnt_u32((unsigned)(ma | mb << 4));
+    }
+    for (; i + 4 <= n; i += 4) {
+        __m256i a = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(key + i)), sign);
+        c += _mm_popcnt_u32((unsigned)_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(kk, a))));
+    }
+    for (; i < n; i++)
+        c += key[i] < k;
+    return c;
+}
+
+__attribute__((target("sse4.2,popcnt")))
+static int slCountLessSse42(const uint64_t *key, int n, uint64_t k) {
+    const __m128i sign = _mm_set1_epi64x(INT64_MIN);
+    const __m128i kk = _mm_xor_si128(_mm_set1_epi64x((int64_t)k), sign);
+    int i = 0, c = 0;
+
+    for (; i + 4 <= n; i += 4) {
+        __m128i a = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(key + i)), sign);
+        __m128i b = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(key + i + 2)), sign);
+        int ma = _mm_movemask_pd(_mm_castsi128_pd(_mm_cmpgt_epi64(kk, a)));
+        int mb = _mm_movemask_pd(_mm_castsi128_pd(_mm_cmpgt_epi64(kk, b)));
+        c += _mm_popcnt_u32((unsigned)(ma | mb << 2));
+    }
+    for (; i < n; i++)
+        c += key[i] < k;
+    return c;
+}
+#endif
+
+static int slCountLessInit(const uint64_t *key, int n, uint64_t k);
+
+int (*slKeyCountLessFn)(const uint64_t *key, int n, uint64_t k) = slCountLessInit;
+static const char *slSearchImpl = "scalar";
+
+/* Pick the kernel on first use. Racing threads all store the same
+ * values, relaxed atomics are enough. */
+static void slSearchResolve(void) {
+#if SLSEARCH_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt")) {
+        __atomic_store_n(&slSearchImpl, "avx2", __ATOMIC_RELAXED);
+        __atomic_store_n(&slKeyCountLessFn, slCountLessAvx2, __ATOMIC_RELAXED);
+        return;
+    }
+    if (__builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("popcnt")) {
+        __atomic_store_n(&slSearchImpl, "sse4.2", __ATOMIC_RELAXED);
+        __atomic_store_n(&slKeyCountLessFn, slCountLessSse42, __ATOMIC_RELAXED);
+        return;
+    }
+#endif
+    __atomic_store_n(&slKeyCountLessFn, slCountLessScalar, __ATOMIC_RELAXED);
+}
+
+static int slCountLessInit(const uint64_t *key, int n, uint64_t k) {
+    slSearchResolve();
+    return slKeyCountLess(key, n, k);
+}
+
+const char *slKeySearchImpl(void) {
+    if (__atomic_load_n(&slKeyCountLessFn, __ATOMIC_RELAXED) == slCountLessInit)
+        slSearchResolve();
+    return __atomic_load_n(&slSearchImpl, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,26 @@
+#ifndef SLSEARCH_HH
+#define SLSEARCH_HH
+
+#include <stdint.h>
+
+/*
+ * 有序 key 块(B+ 树叶子/内部节点的 key 数组)内的查找。key 是 slkey.h 的保序
+ * 编码, 升降序都已折进编码里, 统一按无符号比较。x86 上运行时选择 AVX2/SSE4.2
+ * 实现, 其他平台或编译时 -DSL_SIMD=0 时用标量实现。
+ */
+#ifndef SL_SIMD
+#define SL_SIMD 1
+#endif
+
+extern int (*slKeyCountLessFn)(const uint64_t *key, int n, uint64_t k);
+
+// 返回 key[0..n) 中小于 k 的个数, 即第一个不小于 k 的位置。共享榜单的读者会在
+// 多个线程里首次调用, 实现指针按原子变量读写
+static inline int slKeyCountLess(const uint64_t *key, int n, uint64_t k) {
+    return __atomic_load_n(&slKeyCountLessFn, __ATOMIC_RELAXED)(key, n, k);
+}
+
+// 当前使用的实现: "avx2", "sse4.2" 或 "scalar"
+const char *slKeySearchImpl(void);
+
+#endif //SLSEARCH_HH
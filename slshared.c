@@ -0,0 +1,170 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "slshared.h"
+
+/* A published snapshot waiting for the readers still holding it, or
+ * between slSharedPrepare and slSharedPublish the record for the one
+ * about to be replaced */
+struct slRetired {
+    struct slRetired *next;
+    struct slShared *board;
+    btree *snap;
+};
+
+typedef struct slShared {
+    struct slShared *next;
+    char *name;
+    btree *current;            // 最新快照, 读者无锁读取
+    pthread_mutex_t lock;      // 保护 readers 与 retired
+    slSharedReader *readers;
+    slRetired *retired;
+} slShared;
+
+static pthread_mutex_t slSharedBoardsLock = PTHREAD_MUTEX_INITIALIZER;
+static slShared *slSharedBoards;
+
+/* The board called name, created empty when create is set. NULL when
+ * there is no such board or it cannot be allocated. */
+static slShared *slSharedFind(const char *name, int create) {
+    slShared *b;
+
+    pthread_mutex_lock(&slSharedBoardsLock);
+    for (b = slSharedBoards; b; b = b->next)
+        if (strcmp(b->name, name) == 0)
+            break;
+    if (b == NULL && create) {
+        b = malloc(sizeof(*b));
+        if (b != NULL) {
+            b->name = strdup(name);
+            b->current = btCreate(NULL, NULL);
+            if (b->name == NULL || b->current == NULL) {
+                free(b->name);
+                if (b->current)
+                    btFree(b->current);
+                free(b);
+                b = NULL;
+            }
+        }
+        if (b != NULL) {
+            pthread_mutex_init(&b->lock, NULL);
+            b->readers = NULL;
+            b->retired = NULL;
+            b->next = slSharedBoards;
+            slSharedBoards = b;
+        }
+    }
+    pthread_mutex_unlock(&slSharedBoardsLock);
+    return b;
+}
+
+/* Free every retired snapshot no reader points at. The hazard pointers
+ * are read after the snapshot left current, so a reader that did not
+ * publish its pointer by then will see the new snapshot instead. */
+static void slSharedReclaim(slShared *b) {
+    slRetired **p = &b->retired, *t;
+    slSharedReader *r;
+
+    while ((t = *p) != NULL) {
+        for (r = b->readers; r; r = r->next)
+            if (__atomic_load_n(&r->hp, __ATOMIC_SEQ_CST) == t->snap)
+                break;
+        if (r) {
+            p = &t->next;
+            continue;
+        }
+        *p = t->next;
+        btFree(t->snap);
+        free(t);
+    }
+}
+
+/* Take what publishing to board name needs, creating the board if
+ * needed, before the caller builds the snapshot. NULL when out of memory;
+ * the board is unchanged then. */
+slRetired *slSharedPrepare(const char *name) {
+    slShared *b = slSharedFind(name, 1);
+    slRetired *t;
+
+    if (b == NULL)
+        return NULL;
+    t = malloc(sizeof(*t));
+    if (t == NULL)
+        return NULL;
+    t->next = NULL;
+    t->board = b;
+    t->snap = NULL;
+    return t;
+}
+
+/* Give up a prepared publish, the board keeps its snapshot */
+void slSharedCancel(slRetired *t) {
+    free(t);
+}
+
+/* Replace the snapshot of the prepared board, never fails. snap must come
+ * from btCreate(NULL, NULL) and is owned by the board from now on. */
+void slSharedPublish(slRetired *t, btree *snap) {
+    slShared *b = t->board;
+
+    pthread_mutex_lock(&b->lock);
+    t->snap = __atomic_exchange_n(&b->current, snap, __ATOMIC_SEQ_CST);
+    t->next = b->retired;
+    b->retired = t;
+    slSharedReclaim(b);
+    pthread_mutex_unlock(&b->lock);
+}
+
+/* A reader of board name, which reads empty until something is
+ * published. NULL when out of memory. */
+slSharedReader *slSharedOpen(const char *name) {
+    slShared *b = slSharedFind(name, 1);
+    slSharedReader *r;
+
+    if (b == NULL)
+        return NULL;
+    pthread_mutex_lock(&b->lock);
+    for (r = b->readers; r; r = r->next)
+        if (!r->inuse)
+            break;
+    if (r == NULL) {
+        r = malloc(sizeof(*r));
+        if (r == NULL) {
+            pthread_mutex_unlock(&b->lock);
+            return NULL;
+        }
+        r->board = b;
+        r->hp = NULL;
+        r->next = b->readers;
+        b->readers = r;
+    }
+    r->inuse = 1;
+    pthread_mutex_unlock(&b->lock);
+    return r;
+}
+
+/* Drop the reader, its slot is reused by a later open */
+void slSharedClose(slSharedReader *r) {
+    slShared *b = r->board;
+
+    pthread_mutex_lock(&b->lock);
+    __atomic_store_n(&r->hp, NULL, __ATOMIC_SEQ_CST);
+    r->inuse = 0;
+    slSharedReclaim(b);
+    pthread_mutex_unlock(&b->lock);
+}
+
+/* The latest snapshot, pinned until the next slSharedRead or
+ * slSharedClose on r. Never blocks: the loop only repeats when a publish
+ * lands between the load and the hazard pointer store. */
+btree *slSharedRead(slSharedReader *r) {
+    slShared *b = r->board;
+    btree *s;
+
+    do {
+        s = __atomic_load_n(&b->current, __ATOMIC_SEQ_CST);
+        __atomic_store_n(&r->hp, s, __ATOMIC_SEQ_CST);
+    } while (s != __atomic_load_n(&b->current, __ATOMIC_SEQ_CST));
+    return s;
+}
@@ -0,0 +1,31 @@
+#ifndef SLSHARED_HH
+#define SLSHARED_HH
+
+#include "btree.h"
+
+/*
+ * 进程内按名字共享的只读榜单。写者把自己的 list 做成不可变的 btree 快照
+ * 发布出去, 读者无锁地读最新快照: 每个读者有一个 hazard pointer 槽, 旧快照
+ * 在没有槽指向它时由写者回收。只有 open/close/publish 会加锁。
+ * 榜单一旦建立就存活到进程结束, 快照使用默认分配器, 不属于任何 lua_State。
+ * 内存不足时 prepare/open 返回 NULL, 不会中止进程。
+ */
+struct slShared;
+typedef struct slRetired slRetired;
+
+typedef struct slSharedReader {
+    struct slSharedReader *next;
+    struct slShared *board;
+    btree *hp;             // 正在读的快照, 写者不会释放它
+    int inuse;
+} slSharedReader;
+
+/* 发布分两步: prepare 先拿到发布所需的内存, 失败时榜单不变; publish 不会失败 */
+slRetired *slSharedPrepare(const char *name);
+void slSharedCancel(slRetired *t);
+void slSharedPublish(slRetired *t, btree *snap);
+slSharedReader *slSharedOpen(const char *name);
+void slSharedClose(slSharedReader *r);
+btree *slSharedRead(slSharedReader *r);
+
+#endif //SLSHARED_HH
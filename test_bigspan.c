@@ -0,0 +1,130 @@
+/*
+ * Ranks past 2^32 in the 64-bit span mode, without 2^32 real elements:
+ * the header spans are inflated so that BIG phantom elements rank ahead
+ * of every real node, then every rank path is checked against a walk of
+ * the bottom level. A 32-bit span would wrap on the first link. Counts
+ * by score that stop in front of the first real node never take a header
+ * link, so they see 0 there instead of BIG.
+ * Build and run with make test.
+ */
+#define SKIPLIST_BIGSPAN 1
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "skiplist.c"
+#include "slindex.c"
+#include "slpool.c"
+
+#define BIG (1UL << 32)
+
+typedef char testSpanIs64[sizeof(slSpan) == sizeof(unsigned long) && sizeof(unsigned long) == 8 ? 1 : -1];
+
+static long bad;
+static unsigned long deleted;
+
+#define CHECK(c) do { \
+    if (!(c)) { \
+        if (bad++ < 5) \
+            fprintf(stderr, "line %d: %s\n", __LINE__, #c); \
+    } \
+} while (0)
+
+static void testDeleted(void *ud, int64_t obj) {
+    (void)ud;
+    (void)obj;
+    deleted++;
+}
+
+/* Pretend n elements rank before every real node */
+static void testInflate(skiplist *sl, unsigned long n) {
+    int i;
+    for (i = 0; i < sl->level; i++)
+        sl->header->level[i].span += n;
+    sl->length += n;
+}
+
+/* Every real node against its bottom level position */
+static void testWalk(skiplist *sl) {
+    unsigned long r = BIG, ranks[4];
+    skiplistNode *first = slNext(sl, sl->header);
+    skiplistNode *x, *nodes[4];
+
+    for (x = slNext(sl, sl->header); x; x = slNext(sl, x)) {
+        r++;
+        CHECK(slGetRank(sl, slNodeScore(sl, x), x->obj) == r);
+        CHECK(slGetNodeByRank(sl, r) == x);
+        CHECK(slCountBefore(sl, slNodeScore(sl, x), 0) == (x == first ? 0 : r - 1));
+        CHECK(slCountBefore(sl, slNodeScore(sl, x), 1) == r);
+    }
+    CHECK(r == sl->length);
+
+    ranks[0] = BIG;
+    ranks[1] = BIG + 1;
+    ranks[2] = sl->length;
+    ranks[3] = sl->length + 1;
+    slGetNodesByRank(sl, ranks, 4, nodes);
+    CHECK(nodes[0] == NULL);
+    CHECK(nodes[1] == first);
+    CHECK(nodes[2] == slGetNodeByRank(sl, sl->length));
+    CHECK(nodes[3] == NULL);
+}
+
+int main(void) {
+    skiplist *sl = slCreate(NULL, NULL);
+    skiplistEntry e[3] = { { 5000, 2 }, { 6, 6 }, { 4, 4 } }, *order[3];
+    unsigned long ranks[3], counts[3], before;
+    double scores[3] = { 3.5, 500.5, 9999 };
+    int i;
+
+    if (sl == NULL || slEnableIndex(sl) != 1) {
+        printf("FAIL: out of memory\n");
+        return 1;
+    }
+    for (i = 1; i <= 1000; i++)
+        slInsert(sl, i, i, NULL, NULL);
+    testInflate(sl, BIG);
+    testWalk(sl);
+    CHECK(slCountInRange(sl, 2, 1000) == 999);
+    CHECK(slGetRankByScore(sl, 0) == 1);
+
+    /* inserts, deletes and updates among the real nodes keep the offset,
+     * new levels take their span from the inflated length */
+    for (i = 1001; i <= 3000; i++)
+        slInsert(sl, i - 0.5, i, NULL, NULL);
+    for (i = 1; i <= 3000; i += 3)
+        slDelete(sl, i <= 1000 ? i : i - 0.5, i);
+    slUpdateScore(sl, 2, 2, 5000);
+    testWalk(sl);
+
+    slGetRanks(sl, e, 3, order, ranks);
+    CHECK(ranks[0] == sl->length);
+    CHECK(ranks[1] == slGetRank(sl, 6, 6) && ranks[1] > BIG);
+    CHECK(ranks[2] == 0);
+
+    slCountBeforeBatch(sl, scores, 3, counts);
+    CHECK(counts[0] == BIG + 1);
+    CHECK(counts[1] == slCountBefore(sl, 500.5, 0));
+    CHECK(counts[2] == sl->length);
+
+    before = sl->length;
+    CHECK(slDeleteByRank(sl, BIG + 10, BIG + 19, testDeleted, NULL) == 10);
+    CHECK(deleted == 10 && sl->length == before - 10);
+    CHECK(slDeleteByRank(sl, 2 * BIG, 2 * BIG + 5, testDeleted, NULL) == 0);
+    CHECK(slDeleteRangeByScore(sl, 100, 200, testDeleted, NULL) > 0);
+    testWalk(sl);
+
+    /* a second inflation puts the real nodes past 2^33 */
+    testInflate(sl, BIG);
+    CHECK(slGetRank(sl, 5000, 2) == sl->length);
+    CHECK(slGetNodeByRank(sl, 2 * BIG + 1) == slNext(sl, sl->header));
+    CHECK(slGetNodeByRank(sl, BIG + 1) == NULL);
+
+    slFree(sl);
+    if (bad) {
+        printf("FAIL\n");
+        return 1;
+    }
+    printf("bigspan ok\n");
+    return 0;
+}
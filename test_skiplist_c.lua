@@ -111,3 +111,323 @@ local objs = sl1:objs_byscore(150, 50)
 for i, id in ipairs(objs) do
     print(i, id)
 end
+
+-- 测试obj索引
+print("\n测试obj索引:")
+local sli = skiplist(0, {index = true})
+sli:insert(1, 100)
+sli:insert(2, 50)
+sli:insert(3, 100)
+assert(sli:score(1) == 100 and sli:score(99) == nil)
+assert(sli:rank(1) == 2 and sli:rank(2) == 1 and sli:rank(99) == nil)
+assert(sli:rank_byobj(3) == 3)
+sli:insert(2, 300)  -- 已存在则替换
+assert(sli:get_count() == 3 and sli:score(2) == 300 and sli:rank(2) == 3)
+assert(sli:delete(1) == true and sli:delete(1) == false)
+assert(sli:delete(3, 1) == false, "score不匹配不应删除")
+assert(sli:get_count() == 2 and sli:rank(3) == 1)
+sli:insert(0, 10)
+assert(sli:score(0) == 10 and sli:rank(0) == 1 and sli:rank_byobj(0, 10) == 1, "obj 0也是成员")
+assert(sli:delete(0) == true and sli:rank(0) == nil)
+assert(not pcall(sl0.score, sl0, 1), "未开启索引应报错")
+
+-- 测试update/incrby
+print("\n测试update/incrby:")
+local slu = skiplist(0)
+slu:insert(1, 10)
+slu:insert(2, 20)
+slu:insert(3, 30)
+assert(slu:update(2, 20, 25) == true and slu:rank_byobj(2, 25) == 2, "原位更新")
+assert(slu:update(2, 20, 26) == false, "旧score不匹配")
+assert(slu:update(1, 10, 40) == true and slu:rank_byobj(1, 40) == 3, "需要移动位置")
+assert(slu:incrby(3, 30, -25) == 5 and slu:obj_byrank(1) == 3)
+assert(slu:incrby(9, 1, 1) == nil)
+assert(sli:incrby(2, nil, 10) == 310 and sli:score(2) == 310, "开启索引可省略旧score")
+assert(sli:update(3, nil, 400) == true and sli:rank(3) == 2)
+
+-- 测试count_byscore
+print("\n测试count_byscore:")
+assert(sl0:count_byscore(0, 100) == 3)
+assert(sl0:count_byscore(75, 75) == 0)
+assert(sl0:count_byscore(100, 0) == 0, "min>max应返回0")
+assert(sl0:count_byscore(-1, 10000) == sl0:get_count())
+assert(sl1:count_byscore(150, 50) == 3, "降序")
+assert(empty_sl:count_byscore(0, 100) == 0)
+
+-- 测试节点池回收
+print("\n测试shrink:")
+local slp = skiplist(0, {autoshrink = true})
+for i = 1, 10000 do slp:insert(i, i) end
+slp:delete_byrank(1, 10000, function() end)
+assert(slp:get_count() == 0)
+assert(slp:shrink() >= 0)
+slp:insert(1, 1)
+assert(slp:rank_byobj(1, 1) == 1)
+
+-- 测试memory
+print("\n测试memory:")
+local slm = skiplist(0, {index = true})
+local base = slm:memory()
+for i = 1, 1000 do slm:insert(i, i) end
+local total, nodes, index = slm:memory()
+assert(total > base and nodes > 0 and index > 0 and total >= nodes + index)
+local impl = select(4, skiplist(0, {engine = "btree"}):memory())
+assert(impl == "avx2" or impl == "sse4.2" or impl == "scalar", "btree的memory()应给出查找实现")
+print("btree search:", impl)
+
+-- 测试seed
+print("\n测试seed:")
+local sla, slb = skiplist(0, {seed = 42}), skiplist(0, {seed = 42})
+for i = 1, 1000 do sla:insert(i, i % 17) slb:insert(i, i % 17) end
+assert(sla:memory() == slb:memory(), "相同seed的层数分布应一致")
+assert(not pcall(skiplist, 0, {index = true, seed = "x"}), "非整数seed应报错")
+assert(sla:rank_byobj(500, 500 % 17) == slb:rank_byobj(500, 500 % 17))
+
+-- 测试批量插入/删除
+print("\n测试insert_batch/delete_batch:")
+local slb = skiplist(1)
+local objs, scores = {}, {}
+for i = 1, 1000 do objs[i] = i scores[i] = (i * 7919) % 101 end
+slb:insert_batch(objs, scores)
+assert(slb:get_count() == 1000)
+local prev
+for _, obj in ipairs(slb:objs_byrank(1, 1000)) do
+    local s = scores[obj]
+    assert(prev == nil or prev >= s, "降序")
+    prev = s
+end
+assert(slb:delete_batch({1, 2, 3, 2000}, {scores[1], scores[2], scores[3], 0}) == 3)
+assert(slb:get_count() == 997)
+assert(not pcall(slb.insert_batch, slb, {1, 2}, {1}), "长度不一致应报错")
+local slbi = skiplist(0, {index = true})
+slbi:insert_batch({1, 2, 3}, {30, 20, 10})
+slbi:insert_batch({2, 4}, {40, 5})  -- 2已存在则替换
+assert(slbi:get_count() == 4 and slbi:rank(2) == 4 and slbi:rank(4) == 1)
+assert(slbi:delete_batch({1, 2, 99}) == 2 and slbi:get_count() == 2)
+
+-- 测试from_sorted
+print("\n测试from_sorted:")
+local objs, scores = {}, {}
+for i = 1, 1000 do objs[i] = i scores[i] = i // 3 end
+local sls = skiplist(0):from_sorted(objs, scores)
+assert(sls:get_count() == 1000 and sls:rank_byobj(500, 500 // 3) == 500)
+local sld = skiplist(0):from_sorted(objs, scores, true)
+assert(sld:obj_byrank(777) == 777)
+local sl_desc = skiplist(1)
+assert(not pcall(sl_desc.from_sorted, sl_desc, objs, scores), "顺序与cmp不一致应报错")
+assert(sl_desc:get_count() == 0)
+assert(not pcall(sls.from_sorted, sls, objs, scores), "非空跳表应报错")
+
+-- 测试dump/load
+print("\n测试dump/load:")
+local sld = skiplist(1)
+for i = 1, 1000 do sld:insert(i, (i * 31) % 97 + 0.5) end
+local blob = sld:dump()
+local sll = skiplist(1)
+assert(sll:load(blob) == 1000)
+for r = 1, 1000, 37 do assert(sll:obj_byrank(r) == sld:obj_byrank(r)) end
+assert(not pcall(skiplist(0).load, skiplist(0), blob), "cmp不一致应报错")
+assert(not pcall(sll.load, sll, blob:sub(1, 20)), "截断的快照应报错")
+local path = os.tmpname()
+assert(sld:dump_file(path))
+local slf = skiplist(1, {index = true})
+assert(slf:load_file(path) == 1000)
+assert(slf:rank(500) == sld:rank_byobj(500, (500 * 31) % 97 + 0.5))
+os.remove(path)
+assert(slf:load_file(path) == nil, "文件不存在应返回nil")
+
+-- 测试range_byrank/range_byscore
+print("\n测试range_byrank/range_byscore:")
+local slr = skiplist(0)
+for i = 1, 100 do slr:insert(i, i * 10) end
+local objs, scores = slr:range_byrank(5, 8, true)
+assert(#objs == 4 and #scores == 4 and objs[1] == 5 and scores[4] == 80)
+assert(#slr:range_byrank(99, 200) == 2, "超出长度的rank应截断")
+objs, scores = slr:range_byscore(15, 45, true)
+assert(#objs == 3 and objs[1] == 2 and scores[3] == 40)
+objs, scores = slr:range_byscore(1001, 2000, true)
+assert(#objs == 0 and #scores == 0)
+assert(select("#", slr:range_byscore(10, 20)) == 1, "不带withscores只返回objs")
+
+-- 测试revrange_byrank/revrange_byscore
+print("\n测试revrange_byrank/revrange_byscore:")
+local objs, scores = slr:revrange_byrank(1, 3, true)
+assert(objs[1] == 100 and objs[3] == 98 and scores[2] == 990)
+assert(#slr:revrange_byrank(98, 200) == 3)
+objs = slr:revrange_byscore(500, 100)
+assert(#objs == 41 and objs[1] == 50 and objs[41] == 10)
+objs, scores = slr:revrange_byscore(500, 100, true, 1, 3)
+assert(#objs == 3 and objs[1] == 49 and objs[3] == 47 and scores[3] == 470)
+assert(#slr:revrange_byscore(500, 100, false, 100) == 0, "offset超出范围应返回空")
+
+-- 测试delete_byscore
+print("\n测试delete_byscore:")
+local sld = skiplist(0, {index = true})
+for i = 1, 100 do sld:insert(i, i) end
+assert(sld:delete_byscore(1, 10) == 10 and sld:get_count() == 90)
+local n, removed = sld:delete_byscore(91, 1000, true)
+assert(n == 10 and #removed == 10 and removed[1] == 91 and removed[10] == 100)
+assert(sld:delete_byscore(1000, 2000) == 0)
+assert(sld:score(5) == nil and sld:rank(11) == 1 and sld:rank(90) == 80)
+assert(sld:revrange_byrank(1, 1)[1] == 90, "tail应更新")
+
+-- 测试max_length
+print("\n测试max_length:")
+local slc = skiplist(1, {max_length = 3})
+for i = 1, 3 do assert(slc:insert(i, i * 10) == true) end
+assert(slc:insert(4, 5) == false and slc:get_count() == 3, "低于榜尾应直接拒绝")
+local ok, evicted = slc:insert(5, 100)
+assert(ok and evicted == 1 and slc:get_count() == 3, "应淘汰榜尾")
+assert(slc:rank_byobj(5, 100) == 1 and slc:rank_byobj(1, 10) == nil)
+assert(slc:insert_batch({6, 7}, {1000, 1}) == 1 and slc:get_count() == 3)
+slc = skiplist(0, {max_length = 2}):from_sorted({1, 2, 3}, {1, 2, 3})
+assert(slc:get_count() == 2 and slc:obj_byrank(2) == 2)
+for _, engine in ipairs({"skiplist", "btree"}) do
+    local slm = skiplist(0, {engine = engine, max_length = 2})
+    assert(not pcall(slm.from_sorted, slm, {1, 2, 3, 4}, {1, 2, 5, 3}), "超出max_length的部分也须有序")
+    assert(slm:get_count() == 0)
+end
+for _, engine in ipairs({"skiplist", "btree"}) do
+    assert(not pcall(skiplist, 0, {engine = engine, max_length = -1}), "负的max_length应报错")
+    assert(not pcall(skiplist, 0, {engine = engine, max_length = "x"}), "非整数max_length应报错")
+end
+
+-- 测试around
+print("\n测试around:")
+local sla = skiplist(0, {index = true})
+for i = 1, 10 do sla:insert(i, i * 10) end
+local rank, objs, scores = sla:around(5, 50, 2, 3, true)
+assert(rank == 5 and #objs == 6 and objs[1] == 3 and objs[6] == 8 and scores[6] == 80)
+rank, objs = sla:around(2, nil, 5, 1)
+assert(rank == 2 and #objs == 3 and objs[1] == 1 and objs[3] == 3, "前面不足时应截断")
+rank, objs = sla:around(10, 100, 0, 5)
+assert(rank == 10 and #objs == 1 and objs[1] == 10, "后面不足时应截断")
+assert(sla:around(99, 1) == nil)
+
+-- 测试ranks_of
+print("\n测试ranks_of:")
+local slk = skiplist(1, {index = true})
+for i = 1, 100 do slk:insert(i, i) end
+local ranks = slk:ranks_of({50, 1, 999, 100})
+assert(ranks[1] == 51 and ranks[2] == 100 and ranks[3] == false and ranks[4] == 1)
+ranks = slk:ranks_of({3, 2}, {3, 5})
+assert(ranks[1] == 98 and ranks[2] == false, "score不符应返回false")
+
+-- 测试quantile/quantiles/histogram
+print("\n测试quantile/histogram:")
+local slq = skiplist(0)
+for i = 1, 101 do slq:insert(i, i - 1) end
+local score, obj = slq:quantile(0.5)
+assert(score == 50 and obj == 51)
+assert(slq:quantile(0) == 0 and slq:quantile(1) == 100)
+local qs = slq:quantiles({0.1, 0.5, 0.99})
+assert(qs[1] == 10 and qs[2] == 50 and qs[3] == 99)
+local counts = slq:histogram({10, 50, 90})
+assert(counts[1] == 10 and counts[2] == 40 and counts[3] == 40 and counts[4] == 11)
+assert(empty_sl:quantile(0.5) == nil and #empty_sl:quantiles({0.5}) == 0)
+for _, engine in ipairs({"skiplist", "btree"}) do
+    local sln = skiplist(0, {engine = engine})
+    sln:insert(1, 1)
+    assert(not pcall(sln.quantile, sln, 0 / 0), "NaN分位数应报错")
+    assert(not pcall(sln.quantiles, sln, {0.1, 0 / 0}), "NaN分位数应报错")
+    assert(not pcall(sln.histogram, sln, {0 / 0, 10}), "NaN边界应报错")
+    assert(not pcall(sln.histogram, sln, {10, 0 / 0}), "NaN边界应报错")
+end
+
+-- 测试负数/无穷/小数score的顺序与取回
+print("\n测试score编码:")
+local sle = skiplist(1, {index = true})
+local vals = {-math.huge, -1e300, -2.5, -0.0, 0.5, 3, 1e300, math.huge}
+for i, v in ipairs(vals) do sle:insert(i, v) end
+for i, v in ipairs(vals) do
+    assert(sle:rank_byobj(i) == #vals - i + 1, "降序排名应与数值相反")
+    assert(sle:score(i) == v)
+end
+assert(sle:count_byscore(3, -3) == 4 and sle:rank_byobj(4, 0) == 5, "0与-0应视为相等")
+
+-- 测试btree引擎: 与skiplist引擎做同样的操作, 结果应完全一致
+print("\n测试btree引擎:")
+assert(not pcall(skiplist, 0, {engine = "nope"}), "未知engine应报错")
+local function same(a, b)
+    assert(#a == #b)
+    for i = 1, #a do assert(a[i] == b[i]) end
+end
+math.randomseed(7)
+for _, cmp in ipairs({0, 1}) do
+    local sl1 = skiplist(cmp, {index = true})
+    local sl2 = skiplist(cmp, {index = true, engine = "btree"})
+    for step = 1, 3000 do
+        local obj, score = math.random(0, 800), math.random(1, 60)
+        local op = math.random(1, 4)
+        if op <= 2 then
+            assert(sl1:insert(obj, score) == sl2:insert(obj, score))
+        elseif op == 3 then
+            assert(sl1:update(obj, nil, score) == sl2:update(obj, nil, score))
+        else
+            assert(sl1:delete(obj) == sl2:delete(obj))
+        end
+        if step % 500 == 0 then
+            assert(sl1:delete_byrank(10, 20, function() end) == sl2:delete_byrank(10, 20, function() end))
+            assert(sl1:delete_byscore(30, 31) == sl2:delete_byscore(30, 31))
+        end
+    end
+    assert(sl1:get_count() == sl2:get_count())
+    local n = sl1:get_count()
+    same(sl1:objs_byrank(1, n), sl2:objs_byrank(1, n))
+    same(sl1:objs_byscore(10, 40), sl2:objs_byscore(10, 40))
+    same(sl1:revrange_byscore(50, 5, false, 3, 100), sl2:revrange_byscore(50, 5, false, 3, 100))
+    same(sl1:revrange_byrank(5, 300), sl2:revrange_byrank(5, 300))
+    same(sl1:quantiles({0, 0.3, 0.9}), sl2:quantiles({0, 0.3, 0.9}))
+    same(sl1:histogram(cmp == 0 and {10, 20, 50} or {50, 20, 10}), sl2:histogram(cmp == 0 and {10, 20, 50} or {50, 20, 10}))
+    for obj = 0, 800, 7 do
+        assert(sl1:score(obj) == sl2:score(obj) and sl1:rank(obj) == sl2:rank(obj))
+        local r1, o1 = sl1:around(obj, nil, 2, 2)
+        local r2, o2 = sl2:around(obj, nil, 2, 2)
+        assert(r1 == r2)
+        if r1 then same(o1, o2) end
+    end
+    local a1, b1 = sl1:ranks_byscore(20, 25)
+    local a2, b2 = sl2:ranks_byscore(20, 25)
+    assert(a1 == a2 and b1 == b2 and sl1:count_byscore(20, 25) == sl2:count_byscore(20, 25))
+    assert(sl1:dump() == sl2:dump(), "两种引擎的快照应一致")
+    local slb = skiplist(cmp, {engine = "btree"})
+    assert(slb:load(sl1:dump()) == n)
+    same(slb:objs_byrank(1, n), sl1:objs_byrank(1, n))
+end
+local slb = skiplist(0, {engine = "btree", index = true}):from_sorted({1, 2, 3}, {10, 20, 30})
+assert(slb:get_count() == 3 and slb:rank(3) == 3 and slb:incrby(1, nil, 25) == 35 and slb:rank(1) == 3)
+
+-- 测试超过2^32的排名参数: 不能截断成小排名
+print("\n测试64位排名:")
+local slr64 = skiplist(0)
+for i = 1, 10 do slr64:insert(i, i) end
+local big = 2 ^ 32
+assert(slr64:delete_byrank(big + 1, big + 3, function() end) == 0 and slr64:get_count() == 10, "排名不应按32位截断")
+assert(slr64:obj_byrank(big + 1) == nil)
+assert(#slr64:objs_byrank(1, big * 4) == 10 and #slr64:range_byrank(1, big * 4) == 10)
+local r64, objs64 = slr64:around(5, 5, 0, big * 4)
+assert(r64 == 5 and #objs64 == 6)
+
+-- 测试共享榜单: 发布的是快照, 之后的修改要再次发布才可见
+print("\n测试共享榜单:")
+local shared = require "skiplist.shared"
+local board = shared.open("test_board")
+assert(board:get_count() == 0, "未发布的榜单应为空")
+for _, engine in ipairs({"skiplist", "btree"}) do
+    local slw = skiplist(1, {engine = engine, index = true})
+    for i = 1, 300 do slw:insert(i, i % 37) end
+    assert(slw:publish("test_board") == 300)
+    slw:insert(301, 100)
+    assert(board:get_count() == 300 and board:rank(301) == nil)
+    same(board:objs_byrank(1, 300), slw:objs_byrank(2, 301))
+    assert(board:score(5) == 5 and board:rank(5) == slw:rank(5) - 1)
+    local b2 = shared.open("test_board")
+    assert(slw:publish("test_board") == 301 and board:rank(301) == 1 and b2:obj_byrank(1) == 301)
+    assert(board:dump() == slw:dump())
+    local sld = skiplist(0, {engine = engine})
+    sld:insert(7, 1)
+    sld:insert(7, 1)
+    assert(not pcall(sld.publish, sld, "test_board"), "重复元素不能发布")
+    assert(board:get_count() == 301, "发布失败时榜单应保持不变")
+end
+assert(not pcall(board.get_count, skiplist(0)), "普通 list 不能当共享榜单用")
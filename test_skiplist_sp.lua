@@ -129,3 +129,236 @@ for i, id in ipairs(objs) do
         assert(id == 3-i+1, "时间降序验证失败")
     end
 end
+
+-- 测试obj索引
+print("\n测试obj索引:")
+local sli = skiplist(0, 0, {index = true})
+sli:insert(1, 100, 1)
+sli:insert(2, 50, 2)
+sli:insert(3, 100, 3)
+local s0, s1 = sli:score(1)
+assert(s0 == 100 and s1 == 1 and sli:score(99) == nil)
+assert(sli:rank(1) == 2 and sli:rank(2) == 1 and sli:rank(99) == nil)
+sli:insert(2, 300, 4)  -- 已存在则替换
+assert(sli:get_count() == 3 and sli:rank(2) == 3)
+assert(sli:delete(1) == true and sli:delete(1) == false)
+assert(sli:get_count() == 2 and sli:rank(3) == 1)
+sli:insert(0, 10, 0)
+assert(sli:score(0) == 10 and sli:rank(0) == 1 and sli:rank_byobj(0, 10, 0) == 1, "obj 0也是成员")
+assert(sli:delete(0) == true and sli:rank(0) == nil)
+assert(not pcall(sl0.score, sl0, 1), "未开启索引应报错")
+
+-- 测试update/incrby
+print("\n测试update/incrby:")
+local slu = skiplist(0, 0)
+slu:insert(1, 10, 1)
+slu:insert(2, 20, 2)
+slu:insert(3, 30, 3)
+assert(slu:update(2, 20, 2, 25, 2) == true and slu:rank_byobj(2, 25, 2) == 2, "原位更新")
+assert(slu:update(2, 20, 2, 26, 2) == false, "旧score不匹配")
+assert(slu:update(1, 10, 1, 40, 1) == true and slu:rank_byobj(1, 40, 1) == 3, "需要移动位置")
+local n0, n1 = slu:incrby(3, 30, 3, -25, 0)
+assert(n0 == 5 and n1 == 3 and slu:obj_byrank(1) == 3)
+assert(slu:incrby(9, 1, 1, 1, 0) == nil)
+n0, n1 = sli:incrby(2, nil, nil, 10, 1)
+assert(n0 == 310 and n1 == 5, "开启索引可省略旧score")
+assert(sli:update(3, nil, nil, 400, 0) == true and sli:rank(3) == 2)
+
+-- 测试count_byscore
+print("\n测试count_byscore:")
+assert(sl0:count_byscore(0,0, 100,math.maxinteger) == 3)
+assert(sl0:count_byscore(75,0, 75,math.maxinteger) == 0)
+assert(sl1:count_byscore(150,0, 50,math.maxinteger) == 3, "降序")
+assert(empty_sl:count_byscore(0,0, 100,0) == 0)
+
+-- 测试节点池回收
+print("\n测试shrink:")
+local slp = skiplist(0, 0, {autoshrink = true})
+for i = 1, 10000 do slp:insert(i, i, 0) end
+slp:delete_byrank(1, 10000, function() end)
+assert(slp:get_count() == 0)
+assert(slp:shrink() >= 0)
+slp:insert(1, 1, 0)
+assert(slp:rank_byobj(1, 1, 0) == 1)
+
+-- 测试memory
+print("\n测试memory:")
+local slm = skiplist(0, 0, {index = true})
+local base = slm:memory()
+for i = 1, 1000 do slm:insert(i, i, 0) end
+local total, nodes, index = slm:memory()
+assert(total > base and nodes > 0 and index > 0 and total >= nodes + index)
+
+-- 测试seed
+print("\n测试seed:")
+local sla, slb = skiplist(0, 0, {seed = 42}), skiplist(0, 0, {seed = 42})
+for i = 1, 1000 do sla:insert(i, i % 17, 0) slb:insert(i, i % 17, 0) end
+assert(sla:memory() == slb:memory(), "相同seed的层数分布应一致")
+assert(not pcall(skiplist, 0, 0, {index = true, seed = "x"}), "非整数seed应报错")
+
+-- 测试批量插入/删除
+print("\n测试insert_batch/delete_batch:")
+local slb = skiplist(1, 0)
+local objs, s0, s1 = {}, {}, {}
+for i = 1, 1000 do objs[i] = i s0[i] = (i * 7919) % 101 s1[i] = i end
+slb:insert_batch(objs, s0, s1)
+assert(slb:get_count() == 1000)
+assert(slb:rank_byobj(500, s0[500], s1[500]) ~= nil)
+assert(slb:delete_batch({1, 2, 3, 2000}, {s0[1], s0[2], s0[3], 0}, {1, 2, 3, 0}) == 3)
+assert(slb:get_count() == 997)
+local slbi = skiplist(0, 0, {index = true})
+slbi:insert_batch({1, 2, 3}, {30, 20, 10}, {0, 0, 0})
+slbi:insert_batch({2, 4}, {40, 5}, {0, 0})
+assert(slbi:get_count() == 4 and slbi:rank(2) == 4 and slbi:rank(4) == 1)
+assert(slbi:delete_batch({1, 2, 99}) == 2 and slbi:get_count() == 2)
+
+-- 测试from_sorted
+print("\n测试from_sorted:")
+local objs, s0, s1 = {}, {}, {}
+for i = 1, 1000 do objs[i] = i s0[i] = i // 3 s1[i] = -i end
+local sls = skiplist(0, 1):from_sorted(objs, s0, s1)
+assert(sls:get_count() == 1000 and sls:rank_byobj(500, 500 // 3, -500) == 500)
+local sl_bad = skiplist(0, 0)
+assert(not pcall(sl_bad.from_sorted, sl_bad, objs, s0, s1), "顺序与cmp不一致应报错")
+assert(sl_bad:get_count() == 0)
+local slm = skiplist(0, 0, {max_length = 2})
+assert(not pcall(slm.from_sorted, slm, {1, 2, 3, 4}, {1, 2, 5, 3}, {0, 0, 0, 0}), "超出max_length的部分也须有序")
+assert(slm:get_count() == 0)
+
+-- 测试dump/load
+print("\n测试dump/load:")
+local sld = skiplist(1, 0)
+for i = 1, 1000 do sld:insert(i, (i * 31) % 97, -i) end
+local blob = sld:dump()
+local sll = skiplist(1, 0)
+assert(sll:load(blob) == 1000)
+for r = 1, 1000, 37 do assert(sll:obj_byrank(r) == sld:obj_byrank(r)) end
+assert(not pcall(skiplist(1, 1).load, skiplist(1, 1), blob), "cmp不一致应报错")
+local path = os.tmpname()
+assert(sld:dump_file(path))
+local slf = skiplist(1, 0, {index = true})
+assert(slf:load_file(path) == 1000)
+assert(slf:rank(500) == sld:rank_byobj(500, (500 * 31) % 97, -500))
+os.remove(path)
+assert(slf:load_file(path) == nil, "文件不存在应返回nil")
+
+-- 测试range_byrank/range_byscore
+print("\n测试range_byrank/range_byscore:")
+local slr = skiplist(0, 1)
+for i = 1, 100 do slr:insert(i, i // 2, i) end
+local objs, s0, s1 = slr:range_byrank(1, 3, true)
+assert(#objs == 3 and objs[1] == 1 and objs[2] == 3 and objs[3] == 2)
+assert(s0[2] == 1 and s1[2] == 3 and s0[3] == 1 and s1[3] == 2)
+objs, s0, s1 = slr:range_byscore(10, 100, 11, 0, true)
+assert(#objs == 4 and objs[1] == 21 and objs[4] == 22 and s1[4] == 22)
+assert(#slr:range_byscore(1000, 0, 2000, 0) == 0)
+
+-- 测试revrange_byrank/revrange_byscore
+print("\n测试revrange_byrank/revrange_byscore:")
+local objs, s0, s1 = slr:revrange_byrank(1, 2, true)
+assert(objs[1] == 100 and objs[2] == 98 and s0[2] == 49 and s1[2] == 98)
+objs = slr:revrange_byscore(11, 0, 10, 100, false, 1, 2)
+assert(#objs == 2 and objs[1] == 23 and objs[2] == 20)
+
+-- 测试delete_byscore
+print("\n测试delete_byscore:")
+local sld = skiplist(0, 0, {index = true})
+for i = 1, 100 do sld:insert(i, i, 0) end
+assert(sld:delete_byscore(1,0, 10,0) == 10 and sld:get_count() == 90)
+local n, removed = sld:delete_byscore(91,0, 1000,0, true)
+assert(n == 10 and #removed == 10 and removed[1] == 91 and removed[10] == 100)
+assert(sld:score(5) == nil and sld:rank(11) == 1 and sld:rank(90) == 80)
+assert(sld:revrange_byrank(1, 1)[1] == 90, "tail应更新")
+
+-- 测试max_length
+print("\n测试max_length:")
+local slc = skiplist(1, 0, {max_length = 3})
+for i = 1, 3 do assert(slc:insert(i, i * 10, 0) == true) end
+assert(slc:insert(4, 5, 0) == false and slc:get_count() == 3, "低于榜尾应直接拒绝")
+local ok, evicted = slc:insert(5, 100, 0)
+assert(ok and evicted == 1 and slc:get_count() == 3, "应淘汰榜尾")
+assert(slc:rank_byobj(5, 100, 0) == 1 and slc:rank_byobj(1, 10, 0) == nil)
+assert(not pcall(skiplist, 1, 0, {max_length = -1}), "负的max_length应报错")
+assert(not pcall(skiplist, 1, 0, {max_length = "x"}), "非整数max_length应报错")
+
+-- 测试around
+print("\n测试around:")
+local sla = skiplist(0, 0, {index = true})
+for i = 1, 10 do sla:insert(i, i * 10, i) end
+local rank, objs, s0, s1 = sla:around(5, 50, 5, 2, 3, true)
+assert(rank == 5 and #objs == 6 and objs[1] == 3 and objs[6] == 8 and s0[6] == 80 and s1[6] == 8)
+rank, objs = sla:around(2, nil, nil, 5, 1)
+assert(rank == 2 and #objs == 3 and objs[1] == 1)
+assert(sla:around(99, 1, 1) == nil)
+
+-- 测试ranks_of
+print("\n测试ranks_of:")
+local slk = skiplist(1, 0, {index = true})
+for i = 1, 100 do slk:insert(i, i, 0) end
+local ranks = slk:ranks_of({50, 1, 999, 100})
+assert(ranks[1] == 51 and ranks[2] == 100 and ranks[3] == false and ranks[4] == 1)
+ranks = slk:ranks_of({3, 2}, {3, 2}, {0, 1})
+assert(ranks[1] == 98 and ranks[2] == false, "score不符应返回false")
+
+-- 测试quantile/quantiles/histogram
+print("\n测试quantile/histogram:")
+local slq = skiplist(0, 0)
+for i = 1, 101 do slq:insert(i, i - 1, 0) end
+local s0, s1, obj = slq:quantile(0.5)
+assert(s0 == 50 and s1 == 0 and obj == 51)
+local q0 = slq:quantiles({0.1, 0.99})
+assert(q0[1] == 10 and q0[2] == 99)
+assert(not pcall(slq.quantile, slq, 0 / 0), "NaN分位数应报错")
+assert(not pcall(slq.quantiles, slq, {0.1, 0 / 0}), "NaN分位数应报错")
+local counts = slq:histogram({10, 50, 90}, {0, 0, 0})
+assert(counts[1] == 10 and counts[2] == 40 and counts[3] == 40 and counts[4] == 11)
+
+-- 测试任意分量数的score
+print("\n测试三分量score:")
+local sl3 = skiplist(1, 0, 1, {index = true})  -- 等级降序, 积分升序, 时间降序
+sl3:insert(1, 10, 5, 100)
+sl3:insert(2, 10, 5, 200)
+sl3:insert(3, 10, 4, 100)
+sl3:insert(4, 20, 9, 0)
+local objs3, a3, b3, c3 = sl3:range_byrank(1, 4, true)
+assert(objs3[1] == 4 and objs3[2] == 3 and objs3[3] == 2 and objs3[4] == 1)
+assert(a3[2] == 10 and b3[2] == 4 and c3[2] == 100)
+local x, y, z = sl3:score(2)
+assert(x == 10 and y == 5 and z == 200)
+assert(sl3:rank_byobj(1) == 4 and sl3:rank_byobj(1, 10, 5, 100) == 4)
+assert(sl3:count_byscore(10, 5, 999, 10, 5, 0) == 2)
+x, y, z = sl3:incrby(1, nil, nil, nil, 0, 0, 200)
+assert(z == 300 and sl3:rank_byobj(1) == 3)
+assert(sl3:update(1, 10, 5, 300, 30, 0, 0) and sl3:rank_byobj(1) == 1)
+local rank3, around3 = sl3:around(2, nil, nil, nil, 1, 1)
+assert(rank3 == 4 and around3[1] == 3 and around3[2] == 2)
+local blob3 = sl3:dump()
+local sl3b = skiplist(1, 0, 1)
+assert(sl3b:load(blob3) == 4 and sl3b:rank_byobj(2, 10, 5, 200) == 4)
+assert(not pcall(sl0.load, sl0, blob3), "分量数不一致应报错")
+
+local sl1k = skiplist(1, {nkey = 1, index = true})  -- 单分量
+for i = 1, 10 do sl1k:insert(i, i) end
+assert(sl1k:obj_byrank(1) == 10 and sl1k:score(3) == 3)
+local q1 = sl1k:quantile(0)
+assert(q1 == 10)
+assert(not pcall(skiplist, 0, 0, 0, 0, 0, 0, 0, 0, 0), "分量数超过上限应报错")
+assert(not pcall(skiplist, 0, 0, 0, {nkey = 2}) and not pcall(skiplist, 0, {nkey = 0}), "nkey 与方向数不符应报错")
+
+-- 少于两个方向时仍是旧接口的两分量 list, 缺的方向为升序
+local sl2k = skiplist(1)
+sl2k:insert(1, 10, 2)
+sl2k:insert(2, 10, 1)
+sl2k:insert(3, 20, 5)
+assert(sl2k:obj_byrank(1) == 3 and sl2k:obj_byrank(2) == 2 and sl2k:rank_byobj(1, 10, 2) == 3)
+local sl2n = skiplist(nil, nil, {index = true})
+sl2n:insert(1, 5, 6)
+local s1, s2 = sl2n:score(1)
+assert(s1 == 5 and s2 == 6)
+
+-- 测试超过2^32的排名参数: 不能截断成小排名
+local slr64 = skiplist(0, {nkey = 1})
+for i = 1, 10 do slr64:insert(i, i) end
+local big = 2 ^ 32
+assert(slr64:delete_byrank(big + 1, big + 3, function() end) == 0 and slr64:get_count() == 10, "排名不应按32位截断")
+assert(#slr64:objs_byrank(1, big * 4) == 10)
@@ -0,0 +1,95 @@
+/*
+ * Checks every search kernel this CPU can run against the scalar one:
+ * block sizes around the vector widths, so the scalar tails after the
+ * vector loops are exercised, keys with the sign bit set, keys equal to
+ * block entries, and unsorted blocks, on which the kernels still count.
+ * Build and run with make test.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "slsearch.c"
+
+#define BLOCKMAX 67
+
+typedef int (*slCountFn)(const uint64_t *key, int n, uint64_t k);
+
+static uint64_t testRand(uint64_t *s) {
+    *s ^= *s << 13;
+    *s ^= *s >> 7;
+    *s ^= *s << 17;
+    return *s;
+}
+
+/* A key from a few classes: anything, sign bit set, small, near the top */
+static uint64_t testKey(uint64_t *s) {
+    uint64_t r = testRand(s);
+    switch (r & 3) {
+    case 0: return r;
+    case 1: return r | 0x8000000000000000ull;
+    case 2: return r >> 60;
+    default: return UINT64_MAX - (r >> 62);
+    }
+}
+
+static int testCmp(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+/* Runs fn on rounds random blocks, returns the number of mismatches */
+static long testKernel(const char *name, slCountFn fn, long rounds) {
+    uint64_t key[BLOCKMAX], k, s = 88172645463325252ull;
+    long round, bad = 0;
+    int i, n, want, got;
+
+    for (round = 0; round < rounds; round++) {
+        n = (int)(testRand(&s) % (BLOCKMAX + 1));
+        for (i = 0; i < n; i++)
+            key[i] = testKey(&s);
+        if (round & 1)
+            qsort(key, n, sizeof(*key), testCmp);
+        k = n && (testRand(&s) & 1) ? key[testRand(&s) % n] : testKey(&s);
+        want = slCountLessScalar(key, n, k);
+        got = fn(key, n, k);
+        if (got != want) {
+            if (bad++ < 5)
+                fprintf(stderr, "%s: n=%d k=%016llx got %d want %d\n", name, n, (unsigned long long)k, got, want);
+        }
+    }
+    printf("%-8s %ld blocks, %ld mismatches\n", name, rounds, bad);
+    return bad;
+}
+
+int main(void) {
+    const char *impl = slKeySearchImpl();
+    uint64_t edge[] = { 0, 1, 0x7fffffffffffffffull, 0x8000000000000000ull, UINT64_MAX };
+    long bad = 0;
+    int i, n;
+
+    printf("dispatch picks %s\n", impl);
+    if (strcmp(impl, "avx2") && strcmp(impl, "sse4.2") && strcmp(impl, "scalar"))
+        bad++;
+    bad += testKernel("dispatch", slKeyCountLess, 200000);
+#if SLSEARCH_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt"))
+        bad += testKernel("avx2", slCountLessAvx2, 200000);
+    if (__builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("popcnt"))
+        bad += testKernel("sse4.2", slCountLessSse42, 200000);
+#endif
+    /* every prefix of the signed/unsigned boundary against every edge key */
+    for (n = 0; n <= 5; n++) {
+        for (i = 0; i < 5; i++) {
+            if (slKeyCountLess(edge, n, edge[i]) != slCountLessScalar(edge, n, edge[i]))
+                bad++;
+        }
+    }
+    if (bad) {
+        printf("FAIL\n");
+        return 1;
+    }
+    printf("ok\n");
+    return 0;
+}